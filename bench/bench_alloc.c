@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/alloc.h"
+#include "../lib/filesystem.h"
+
+/*
+ * Fills an image block by block and prints the average cost of one allocation
+ * per tenth of the image, once for the old linear free_list scan and once for
+ * the bitmap allocator. The bitmap allocator should stay flat while the linear
+ * scan grows with the number of used blocks.
+ */
+
+#define BENCH_IMAGE "/tmp/bench_alloc.fs"
+#define STEPS 10
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// the allocation strategy find_free_block used before the bitmap allocator
+static int linear_alloc(file_system* fs){
+	for(uint32_t i = 0; i < fs->s_block->num_blocks; i++)
+	{
+		if(fs->free_list[i] == 1)
+		{
+			fs->free_list[i] = 0;
+			fs->s_block->free_blocks--;
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void run(const char* name, file_system* fs, int (*alloc)(file_system*)){
+	uint32_t num_blocks = fs->s_block->num_blocks;
+	uint32_t per_step = num_blocks / STEPS;
+
+	printf("%-8s", name);
+	for(int step = 0; step < STEPS; step++)
+	{
+		double start = now_ns();
+		for(uint32_t i = 0; i < per_step; i++)
+		{
+			if(alloc(fs) == -1)
+			{
+				fprintf(stderr, "image full too early\n");
+				exit(1);
+			}
+		}
+		printf(" %8.1f", (now_ns() - start) / per_step);
+	}
+	printf("   ns/alloc\n");
+}
+
+int main(int argc, char* argv[]){
+	uint32_t num_blocks = argc > 1 ? atoi(argv[1]) : 65536;
+
+	printf("%u blocks, columns are 0-10%% ... 90-100%% full\n", num_blocks);
+
+	file_system* fs = fs_create(BENCH_IMAGE, num_blocks);
+	run("linear", fs, linear_alloc);
+	cleanup(fs);
+
+	fs = fs_create(BENCH_IMAGE, num_blocks);
+	run("bitmap", fs, alloc_block);
+	cleanup(fs);
+
+	unlink(BENCH_IMAGE);
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/alloc.h"
+#include "../lib/filesystem.h"
+#include "../lib/lock.h"
+
+/*
+ * Every thread takes a few blocks and an inode and gives them back again, over and over,
+ * the way short files come and go. Once with the allocator lock of fs_threads_enable and
+ * once with alloc_lockfree_enable. Prints the total allocation throughput for 1 to
+ * MAX_THREADS threads.
+ */
+
+#define BENCH_IMAGE "/tmp/bench_alloc_threads.fs"
+#define BLOCKS 65536
+#define MAX_THREADS 8
+#define ROUNDS 100000
+#define HELD 16 //blocks a thread holds at once
+
+typedef struct _worker{
+	pthread_t thread;
+	file_system* fs;
+} worker;
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void* run_worker(void* arg){
+	worker* w = arg;
+	int held[HELD];
+	for(int i = 0; i < ROUNDS; i++)
+	{
+		int slot = i % HELD;
+		if(i >= HELD) release_block(w->fs, held[slot]);
+		held[slot] = alloc_block(w->fs);
+		int inode_num = claim_inode(w->fs, reg_file);
+		if(held[slot] == -1 || inode_num == -1)
+		{
+			fprintf(stderr, "allocation failed\n");
+			exit(1);
+		}
+		release_inode(w->fs, inode_num);
+	}
+	for(int i = 0; i < HELD && i < ROUNDS; i++)
+	{
+		release_block(w->fs, held[i]);
+	}
+	return NULL;
+}
+
+static void run(const char* name, int threads, int use_lockfree){
+	file_system* fs = fs_create(BENCH_IMAGE, BLOCKS);
+	if((use_lockfree ? alloc_lockfree_enable(fs) : fs_threads_enable(fs)) == -1)
+	{
+		fprintf(stderr, "no memory for the locks\n");
+		exit(1);
+	}
+
+	worker workers[MAX_THREADS];
+	double start = now_ns();
+	for(int t = 0; t < threads; t++)
+	{
+		workers[t].fs = fs;
+		pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+	}
+	for(int t = 0; t < threads; t++)
+	{
+		pthread_join(workers[t].thread, NULL);
+	}
+	double ns = now_ns() - start;
+
+	if(fs->s_block->free_blocks != BLOCKS)
+	{
+		fprintf(stderr, "%s: %u blocks lost\n", name, BLOCKS - fs->s_block->free_blocks);
+		exit(1);
+	}
+	double allocs = (double)threads * ROUNDS * 2;
+	printf("%-10s %d threads %8.2f M allocs/s\n", name, threads, allocs / (ns / 1e3));
+	cleanup(fs);
+}
+
+int main(int argc, char* argv[]){
+	for(int threads = 1; threads <= MAX_THREADS; threads *= 2)
+	{
+		run("mutex", threads, 0);
+		run("lock-free", threads, 1);
+	}
+	unlink(BENCH_IMAGE);
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+
+/*
+ * Writes a tree of DIRS directories with FILES_PER_DIR files each to the host, once with one
+ * fs_export per file and once with fs_export_tree on 1, 2, 4 and 8 threads. Prints the cost
+ * of one file and the export throughput, the best of ROUNDS runs each. Most of the time goes
+ * into creating the host files, more threads only help with more than one CPU.
+ */
+
+#define BENCH_IMAGE "/tmp/bench_export_tree.fs"
+#define HOST_DIR "/tmp/bench_export_tree"
+#define DIRS 20
+#define FILES_PER_DIR 100
+#define FILE_SIZE (4 * BLOCK_SIZE + 100)
+#define FILES (DIRS * FILES_PER_DIR)
+#define BLOCKS (FILES * (FILE_SIZE / BLOCK_SIZE + 2) + 256)
+#define VARIANTS 5 //fs_export and the tree on 1, 2, 4 and 8 threads
+#define ROUNDS 5
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char* name, double ns){
+	printf("%-14s %8.1f us/file %8.1f MiB/s\n", name, ns / FILES / 1e3,
+	       (double)FILES * FILE_SIZE / (1 << 20) / (ns / 1e9));
+}
+
+static void remove_host_tree(){
+	for(int d = 0; d < DIRS; d++)
+	{
+		char path[128];
+		for(int f = 0; f < FILES_PER_DIR; f++)
+		{
+			snprintf(path, sizeof(path), HOST_DIR "/dir%d/file%d", d, f);
+			unlink(path);
+		}
+		snprintf(path, sizeof(path), HOST_DIR "/dir%d", d);
+		rmdir(path);
+	}
+	rmdir(HOST_DIR);
+}
+
+/*
+ * variant 0 exports file by file with fs_export, variant v > 0 runs fs_export_tree on 2^(v-1) threads
+ * returns the time it took in ns
+ */
+static double export_variant(file_system* fs, int v){
+	double start = now_ns();
+	if(v > 0)
+	{
+		if(fs_export_tree(fs, "/", HOST_DIR, 1 << (v - 1)) != 0)
+		{
+			fprintf(stderr, "export_tree: failed\n");
+			exit(1);
+		}
+		return now_ns() - start;
+	}
+
+	mkdir(HOST_DIR, 0755);
+	for(int d = 0; d < DIRS; d++)
+	{
+		char int_path[64];
+		char ext_path[128];
+		snprintf(ext_path, sizeof(ext_path), HOST_DIR "/dir%d", d);
+		mkdir(ext_path, 0755);
+		for(int f = 0; f < FILES_PER_DIR; f++)
+		{
+			snprintf(int_path, sizeof(int_path), "/dir%d/file%d", d, f);
+			snprintf(ext_path, sizeof(ext_path), HOST_DIR "/dir%d/file%d", d, f);
+			if(fs_export(fs, int_path, ext_path) != 0)
+			{
+				fprintf(stderr, "export: %s failed\n", int_path);
+				exit(1);
+			}
+		}
+	}
+	return now_ns() - start;
+}
+
+int main(int argc, char* argv[]){
+	uint8_t content[FILE_SIZE];
+	memset(content, 'e', sizeof(content));
+	file_system* fs = fs_create(BENCH_IMAGE, BLOCKS);
+	for(int d = 0; d < DIRS; d++)
+	{
+		char int_path[64];
+		snprintf(int_path, sizeof(int_path), "/dir%d", d);
+		fs_mkdir(fs, int_path);
+		for(int f = 0; f < FILES_PER_DIR; f++)
+		{
+			snprintf(int_path, sizeof(int_path), "/dir%d/file%d", d, f);
+			fs_mkfile(fs, int_path);
+			if(fs_pwrite(fs, int_path, 0, content, FILE_SIZE) != FILE_SIZE)
+			{
+				fprintf(stderr, "pwrite: %s failed\n", int_path);
+				exit(1);
+			}
+		}
+	}
+
+	printf("%ld CPUs online\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	// The rounds take turns, so every variant sees the host in the same state
+	double best[VARIANTS];
+	for(int round = 0; round < ROUNDS; round++)
+	{
+		for(int v = 0; v < VARIANTS; v++)
+		{
+			remove_host_tree();
+			double ns = export_variant(fs, v);
+			if(round == 0 || ns < best[v]) best[v] = ns;
+		}
+	}
+
+	report("fs_export", best[0]);
+	for(int v = 1; v < VARIANTS; v++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "tree %d threads", 1 << (v - 1));
+		report(name, best[v]);
+	}
+
+	cleanup(fs);
+	remove_host_tree();
+	unlink(BENCH_IMAGE);
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/alloc.h"
+#include "../lib/extent.h"
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+#include "../lib/path.h"
+
+/*
+ * Churns an image with small files and removes a random half of them, then writes
+ * large files into the fragmented free space. Once block by block the way appends
+ * allocated before alloc_run, once with fs_writev asking for whole runs. Prints the
+ * runs per file (1 is a file in one piece) and how fast the files read back.
+ */
+
+#define BENCH_IMAGE "/tmp/bench_frag.fs"
+#define NUM_BLOCKS 65536
+#define SMALL_FILES 4000
+#define LARGE_FILES 64
+#define LARGE_BLOCKS 256
+#define READS 20
+
+static uint8_t buffer[LARGE_BLOCKS * BLOCK_SIZE];
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static file_system* churned_image(){
+	file_system* fs = fs_create(BENCH_IMAGE, NUM_BLOCKS);
+	srand(1);
+	char path[32];
+	for(int i = 0; i < SMALL_FILES; i++)
+	{
+		snprintf(path, sizeof(path), "/small%d", i);
+		fs_mkfile(fs, path);
+		struct iovec iov = {buffer, (1 + rand() % 8) * BLOCK_SIZE};
+		fs_writev(fs, path, &iov, 1);
+	}
+	for(int i = 0; i < SMALL_FILES; i++)
+	{
+		if(rand() % 2 == 0) continue;
+		snprintf(path, sizeof(path), "/small%d", i);
+		fs_rm(fs, path);
+	}
+	// A freshly loaded image starts allocating at the front, where the holes are
+	fs->alloc_cursor = 0;
+	return fs;
+}
+
+// appends the way write_text did before alloc_run, one alloc_block per block
+static void write_blockwise(file_system* fs, char* path){
+	int file = traverse_path(fs, path, strlen(path));
+	for(uint32_t i = 0; i < LARGE_BLOCKS; i++)
+	{
+		int block_num = alloc_block(fs);
+		if(block_num == -1 || extent_add_block(fs, file, i, block_num) == -1)
+		{
+			fprintf(stderr, "image full too early\n");
+			exit(1);
+		}
+		memcpy(fs->data_blocks[block_num].block, buffer + i * BLOCK_SIZE, BLOCK_SIZE);
+		fs->data_blocks[block_num].size = BLOCK_SIZE;
+		fs->inodes[file].size += BLOCK_SIZE;
+	}
+}
+
+static void write_runs(file_system* fs, char* path){
+	struct iovec iov = {buffer, sizeof(buffer)};
+	if(fs_writev(fs, path, &iov, 1) != sizeof(buffer))
+	{
+		fprintf(stderr, "image full too early\n");
+		exit(1);
+	}
+}
+
+static void run(const char* name, void (*write)(file_system*, char*)){
+	file_system* fs = churned_image();
+	char path[32];
+	uint32_t runs = 0;
+	for(int i = 0; i < LARGE_FILES; i++)
+	{
+		snprintf(path, sizeof(path), "/large%d", i);
+		fs_mkfile(fs, path);
+		write(fs, path);
+		runs += extent_count_runs(fs, traverse_path(fs, path, strlen(path)));
+	}
+
+	double start = now_ns();
+	for(int n = 0; n < READS; n++)
+	{
+		for(int i = 0; i < LARGE_FILES; i++)
+		{
+			snprintf(path, sizeof(path), "/large%d", i);
+			fs_pread(fs, path, 0, sizeof(buffer), buffer);
+		}
+	}
+	double seconds = (now_ns() - start) / 1e9;
+
+	printf("%-10s %8.1f runs/file %8.1f MiB/s read\n", name, (double)runs / LARGE_FILES,
+	       (double)READS * LARGE_FILES * sizeof(buffer) / (1 << 20) / seconds);
+	cleanup(fs);
+}
+
+int main(int argc, char* argv[]){
+	memset(buffer, 'f', sizeof(buffer));
+	run("blockwise", write_blockwise);
+	run("runs", write_runs);
+	unlink(BENCH_IMAGE);
+	return 0;
+}
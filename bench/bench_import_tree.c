@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+
+/*
+ * Loads a host tree of DIRS directories with FILES_PER_DIR files each, once with one
+ * fs_mkdir/fs_mkfile/fs_import per entry and once with fs_import_tree on 1 to MAX_THREADS
+ * threads. Prints the cost of one file and the import throughput.
+ */
+
+#define BENCH_IMAGE "/tmp/bench_import_tree.fs"
+#define HOST_DIR "/tmp/bench_import_tree"
+#define DIRS 20
+#define FILES_PER_DIR 100
+#define FILE_SIZE (4 * BLOCK_SIZE + 100)
+#define FILES (DIRS * FILES_PER_DIR)
+#define BLOCKS (FILES * (FILE_SIZE / BLOCK_SIZE + 2) + 256)
+#define MAX_THREADS 8
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char* name, double ns){
+	printf("%-14s %8.1f us/file %8.1f MiB/s\n", name, ns / FILES / 1e3,
+	       (double)FILES * FILE_SIZE / (1 << 20) / (ns / 1e9));
+}
+
+static void make_host_tree(){
+	char content[FILE_SIZE];
+	memset(content, 'h', sizeof(content));
+	mkdir(HOST_DIR, 0755);
+	for(int d = 0; d < DIRS; d++)
+	{
+		char path[128];
+		snprintf(path, sizeof(path), HOST_DIR "/dir%d", d);
+		mkdir(path, 0755);
+		for(int f = 0; f < FILES_PER_DIR; f++)
+		{
+			snprintf(path, sizeof(path), HOST_DIR "/dir%d/file%d", d, f);
+			FILE* file = fopen(path, "wb");
+			if(file == NULL || fwrite(content, 1, sizeof(content), file) != sizeof(content))
+			{
+				fprintf(stderr, "can't write %s\n", path);
+				exit(1);
+			}
+			fclose(file);
+		}
+	}
+}
+
+static void remove_host_tree(){
+	for(int d = 0; d < DIRS; d++)
+	{
+		char path[128];
+		for(int f = 0; f < FILES_PER_DIR; f++)
+		{
+			snprintf(path, sizeof(path), HOST_DIR "/dir%d/file%d", d, f);
+			unlink(path);
+		}
+		snprintf(path, sizeof(path), HOST_DIR "/dir%d", d);
+		rmdir(path);
+	}
+	rmdir(HOST_DIR);
+}
+
+int main(int argc, char* argv[]){
+	make_host_tree();
+
+	file_system* fs = fs_create(BENCH_IMAGE, BLOCKS);
+	double start = now_ns();
+	for(int d = 0; d < DIRS; d++)
+	{
+		char int_path[64];
+		char ext_path[128];
+		snprintf(int_path, sizeof(int_path), "/dir%d", d);
+		fs_mkdir(fs, int_path);
+		for(int f = 0; f < FILES_PER_DIR; f++)
+		{
+			snprintf(int_path, sizeof(int_path), "/dir%d/file%d", d, f);
+			snprintf(ext_path, sizeof(ext_path), HOST_DIR "/dir%d/file%d", d, f);
+			fs_mkfile(fs, int_path);
+			if(fs_import(fs, int_path, ext_path) != 0)
+			{
+				fprintf(stderr, "import: %s failed\n", ext_path);
+				exit(1);
+			}
+		}
+	}
+	report("fs_import", now_ns() - start);
+	cleanup(fs);
+
+	for(int threads = 1; threads <= MAX_THREADS; threads *= 2)
+	{
+		fs = fs_create(BENCH_IMAGE, BLOCKS);
+		start = now_ns();
+		if(fs_import_tree(fs, "/", HOST_DIR, threads) != 0)
+		{
+			fprintf(stderr, "import_tree: failed\n");
+			exit(1);
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "tree %d threads", threads);
+		report(name, now_ns() - start);
+		cleanup(fs);
+	}
+
+	remove_host_tree();
+	unlink(BENCH_IMAGE);
+	return 0;
+}
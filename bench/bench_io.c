@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/io.h"
+
+/*
+ * Dumps an image of BLOCKS blocks, loads it and checkpoints a change in every data block,
+ * once through io_uring and once through the thread pool. Prints the throughput of each.
+ * The image stays in the page cache here, on a real device the queue depth pays off more.
+ */
+
+#define BENCH_IMAGE "/tmp/bench_io.fs"
+#define BLOCKS 32768
+#define ROUNDS 5
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char* engine, const char* name, double ns, double bytes){
+	printf("%-8s %-11s %8.1f ms %8.1f MiB/s\n", engine, name, ns / ROUNDS / 1e6, bytes * ROUNDS / (1 << 20) / (ns / 1e9));
+}
+
+static void run(const char* name, enum io_engine engine){
+	if(io_set_engine(engine) == -1)
+	{
+		printf("%-8s not available\n", name);
+		return;
+	}
+	file_system* fs = fs_create(BENCH_IMAGE, BLOCKS);
+	double bytes = sizeof(superblock) + (double)BLOCKS * (1 + sizeof(inode) + sizeof(data_block));
+
+	double start = now_ns();
+	for(int i = 0; i < ROUNDS; i++)
+	{
+		if(fs_dump(fs, BENCH_IMAGE) == -1)
+		{
+			fprintf(stderr, "dump failed\n");
+			exit(1);
+		}
+	}
+	report(name, "dump", now_ns() - start, bytes);
+	cleanup(fs);
+
+	start = now_ns();
+	for(int i = 0; i < ROUNDS; i++)
+	{
+		fs = fs_load(BENCH_IMAGE);
+		if(i < ROUNDS - 1) cleanup(fs);
+	}
+	report(name, "load", now_ns() - start, bytes);
+
+	double ns = 0;
+	for(int i = 0; i < ROUNDS; i++)
+	{
+		for(int b = 0; b < BLOCKS; b += 2)
+		{
+			fs->data_blocks[b].block[0] = i;
+			mark_data_block_dirty(fs, b);
+		}
+		start = now_ns();
+		if(fs_checkpoint(fs, BENCH_IMAGE) == -1)
+		{
+			fprintf(stderr, "checkpoint failed\n");
+			exit(1);
+		}
+		ns += now_ns() - start;
+	}
+	report(name, "checkpoint", ns, bytes);
+	cleanup(fs);
+}
+
+int main(int argc, char* argv[]){
+	run("uring", IO_ENGINE_URING);
+	run("threads", IO_ENGINE_THREADS);
+	unlink(BENCH_IMAGE);
+	return 0;
+}
@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+#include "../lib/path.h"
+
+/*
+ * Resolves the parent, the leaf and the leaf name of a deep path over and over,
+ * once the way fs_rm and fs_mkfile did it before (traverse_path_parent, traverse_path
+ * and get_name) and once with resolve_path. Prints the cost of one lookup, how often
+ * the path was copied and tokenized and how many heap allocations it took.
+ */
+
+#define BENCH_IMAGE "/tmp/bench_resolve.fs"
+#define DEPTH 8
+#define LOOKUPS 200000
+
+// glibc's allocator, malloc below only counts the calls
+extern void* __libc_malloc(size_t size);
+static unsigned long allocations;
+
+void* malloc(size_t size){
+	allocations++;
+	return __libc_malloc(size);
+}
+
+static unsigned long passes;
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// the resolver functions as they were before resolve_path, with the passes counted
+
+static int legacy_find_child(file_system* fs, inode* parent, const char* name){
+	if(parent->n_type != directory) return -1;
+	for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+	{
+		int child = parent->direct_blocks[i];
+		if(child == -1) continue;
+		if(fs->inodes[child].n_type != free_block && strcmp(fs->inodes[child].name, name) == 0) return child;
+	}
+	return -1;
+}
+
+static int legacy_traverse_path(file_system* fs, const char* path, size_t size_of_path){
+	if(path == NULL || path[0] != '/' || strstr(path, "//") != NULL) return -1;
+
+	int inode_num = fs->root_node;
+	char path_copy[size_of_path + 1];
+	strcpy(path_copy, path);
+	passes++;
+	char* token = strtok(path_copy, "/");
+	while(token != NULL)
+	{
+		inode_num = legacy_find_child(fs, &fs->inodes[inode_num], token);
+		if(inode_num == -1) return -1;
+		token = strtok(NULL, "/");
+	}
+	return inode_num;
+}
+
+static int legacy_traverse_path_parent(file_system* fs, const char* path, size_t size_of_path){
+	if(path == NULL || path[0] != '/' || strstr(path, "//") != NULL) return -1;
+
+	char path_copy[size_of_path + 1];
+	strcpy(path_copy, path);
+	passes++;
+	char* token = strtok(path_copy, "/");
+	if(token == NULL) return -1;
+	token = strtok(NULL, "/");
+	if(token == NULL) return 0;
+
+	strcpy(path_copy, path);
+	passes++;
+	token = strtok(path_copy, "/");
+	int inode_num = fs->root_node;
+	char last_token[NAME_MAX_LENGTH] = "";
+	char before_last_token[NAME_MAX_LENGTH] = "";
+	while(token != NULL)
+	{
+		strcpy(before_last_token, last_token);
+		strcpy(last_token, token);
+		token = strtok(NULL, "/");
+		inode_num = (before_last_token[0] != '\0') ? legacy_find_child(fs, &fs->inodes[inode_num], before_last_token) : 0;
+		if(inode_num == -1) return -1;
+	}
+	return inode_num;
+}
+
+static char* legacy_get_name(const char* path, size_t size_of_path){
+	char path_copy[size_of_path + 1];
+	strcpy(path_copy, path);
+	passes++;
+	char* token = strtok(path_copy, "/");
+	if(token == NULL) return NULL;
+	char* last = token;
+	while(token != NULL)
+	{
+		last = token;
+		token = strtok(NULL, "/");
+	}
+	char* result = malloc(strlen(last) + 1);
+	if(result != NULL) strcpy(result, last);
+	return result;
+}
+
+static int legacy_lookup(file_system* fs, const char* path, size_t len){
+	int parent = legacy_traverse_path_parent(fs, path, len);
+	int child = legacy_traverse_path(fs, path, len);
+	char* name = legacy_get_name(path, len);
+	int ok = parent != -1 && child != -1 && name != NULL;
+	free(name);
+	return ok ? 0 : -1;
+}
+
+static int resolve_lookup(file_system* fs, const char* path, size_t len){
+	path_lookup lookup;
+	// resolve_path walks the path at most once, a cached path isn't walked at all
+	passes++;
+	return resolve_path(fs, path, len, &lookup);
+}
+
+static void run(const char* name, file_system* fs, const char* path, int (*lookup)(file_system*, const char*, size_t)){
+	size_t len = strlen(path);
+	passes = 0;
+	unsigned long allocations_before = allocations;
+
+	double start = now_ns();
+	for(int i = 0; i < LOOKUPS; i++)
+	{
+		if(lookup(fs, path, len) == -1)
+		{
+			fprintf(stderr, "%s: lookup failed\n", name);
+			exit(1);
+		}
+	}
+	double ns = (now_ns() - start) / LOOKUPS;
+
+	printf("%-8s %8.1f ns/lookup %6.2f passes/lookup %6.2f allocations/lookup\n", name, ns,
+	       (double)passes / LOOKUPS, (double)(allocations - allocations_before) / LOOKUPS);
+}
+
+int main(int argc, char* argv[]){
+	file_system* fs = fs_create(BENCH_IMAGE, 64);
+
+	char path[256] = "";
+	for(int depth = 0; depth < DEPTH; depth++)
+	{
+		size_t len = strlen(path);
+		snprintf(path + len, sizeof(path) - len, "/dir%d", depth);
+		fs_mkdir(fs, path);
+	}
+	strcat(path, "/file");
+	fs_mkfile(fs, path);
+
+	printf("%s\n", path);
+	run("legacy", fs, path, legacy_lookup);
+	run("resolve", fs, path, resolve_lookup);
+
+	cleanup(fs);
+	unlink(BENCH_IMAGE);
+	return 0;
+}
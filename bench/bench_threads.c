@@ -0,0 +1,110 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/lock.h"
+#include "../lib/operations.h"
+
+/*
+ * Every thread reads its own file with fs_pread over and over, optionally while every
+ * fourth thread overwrites its file with fs_pwrite instead. Once all calls go through one
+ * external mutex, the way the fs was shared before, and once with fs_threads_enable.
+ * Prints the total throughput for 1 to MAX_THREADS threads.
+ */
+
+#define BENCH_IMAGE "/tmp/bench_threads.fs"
+#define MAX_THREADS 8
+#define FILE_SIZE (16 * BLOCK_SIZE)
+#define CALLS 20000
+#define BLOCKS (MAX_THREADS * (FILE_SIZE / BLOCK_SIZE + 8) + 64)
+
+typedef struct _worker{
+	pthread_t thread;
+	file_system* fs;
+	pthread_mutex_t* big_lock; //NULL if the fs locks itself
+	char path[32];
+	int writer;
+} worker;
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void* run_worker(void* arg){
+	worker* w = arg;
+	uint8_t buf[FILE_SIZE];
+	memset(buf, 'w', sizeof(buf));
+	for(int i = 0; i < CALLS; i++)
+	{
+		if(w->big_lock != NULL) pthread_mutex_lock(w->big_lock);
+		long ret = w->writer ? fs_pwrite(w->fs, w->path, 0, buf, FILE_SIZE) : fs_pread(w->fs, w->path, 0, FILE_SIZE, buf);
+		if(w->big_lock != NULL) pthread_mutex_unlock(w->big_lock);
+		if(ret != FILE_SIZE)
+		{
+			fprintf(stderr, "%s: %s failed\n", w->path, w->writer ? "pwrite" : "pread");
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+static void run(const char* name, int threads, int use_locks, int writers){
+	file_system* fs = fs_create(BENCH_IMAGE, BLOCKS);
+	if(use_locks && fs_threads_enable(fs) == -1)
+	{
+		fprintf(stderr, "no memory for the locks\n");
+		exit(1);
+	}
+	pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+
+	uint8_t content[FILE_SIZE];
+	memset(content, 'c', sizeof(content));
+	worker workers[MAX_THREADS];
+	for(int t = 0; t < threads; t++)
+	{
+		worker* w = &workers[t];
+		w->fs = fs;
+		w->big_lock = use_locks ? NULL : &big_lock;
+		w->writer = writers && t % 4 == 3;
+		snprintf(w->path, sizeof(w->path), "/file%d", t);
+		fs_mkfile(fs, w->path);
+		fs_pwrite(fs, w->path, 0, content, FILE_SIZE);
+	}
+
+	double start = now_ns();
+	for(int t = 0; t < threads; t++)
+	{
+		pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+	}
+	for(int t = 0; t < threads; t++)
+	{
+		pthread_join(workers[t].thread, NULL);
+	}
+	double ns = now_ns() - start;
+
+	double calls = (double)threads * CALLS;
+	printf("%-14s %d threads %10.0f calls/s %8.1f MiB/s\n", name, threads, calls / (ns / 1e9),
+	       calls * FILE_SIZE / (1 << 20) / (ns / 1e9));
+	cleanup(fs);
+}
+
+int main(int argc, char* argv[]){
+	for(int writers = 0; writers <= 1; writers++)
+	{
+		printf(writers ? "reads with every fourth thread writing\n" : "reads only\n");
+		for(int threads = 1; threads <= MAX_THREADS; threads *= 2)
+		{
+			run("one mutex", threads, 0, writers);
+			run("inode locks", threads, 1, writers);
+		}
+	}
+	unlink(BENCH_IMAGE);
+	return 0;
+}
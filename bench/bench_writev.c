@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+
+/*
+ * Appends many small records to a file, once with one fs_writef per record and once
+ * with fs_writev taking BATCH records per call. Prints the cost of one record and
+ * the resulting append throughput.
+ */
+
+#define BENCH_IMAGE "/tmp/bench_writev.fs"
+#define RECORDS 200000
+#define RECORD_SIZE 48
+#define BATCH 256
+#define BLOCKS ((RECORDS * RECORD_SIZE) / BLOCK_SIZE + 64)
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char* name, double ns){
+	printf("%-8s %8.1f ns/record %8.1f MiB/s\n", name, ns / RECORDS,
+	       (double)RECORDS * RECORD_SIZE / (1 << 20) / (ns / 1e9));
+}
+
+int main(int argc, char* argv[]){
+	char record[RECORD_SIZE + 1];
+	memset(record, 'r', RECORD_SIZE);
+	record[RECORD_SIZE] = '\0';
+
+	file_system* fs = fs_create(BENCH_IMAGE, BLOCKS);
+	fs_mkfile(fs, "/writef");
+	double start = now_ns();
+	for(int i = 0; i < RECORDS; i++)
+	{
+		if(fs_writef(fs, "/writef", record) != RECORD_SIZE)
+		{
+			fprintf(stderr, "writef: append failed\n");
+			exit(1);
+		}
+	}
+	report("writef", now_ns() - start);
+	cleanup(fs);
+
+	fs = fs_create(BENCH_IMAGE, BLOCKS);
+	fs_mkfile(fs, "/writev");
+	struct iovec iov[BATCH];
+	for(int i = 0; i < BATCH; i++)
+	{
+		iov[i] = (struct iovec){record, RECORD_SIZE};
+	}
+	start = now_ns();
+	for(int i = 0; i < RECORDS; i += BATCH)
+	{
+		int cnt = (RECORDS - i < BATCH) ? RECORDS - i : BATCH;
+		if(fs_writev(fs, "/writev", iov, cnt) != (long)cnt * RECORD_SIZE)
+		{
+			fprintf(stderr, "writev: append failed\n");
+			exit(1);
+		}
+	}
+	report("writev", now_ns() - start);
+
+	cleanup(fs);
+	unlink(BENCH_IMAGE);
+	return 0;
+}
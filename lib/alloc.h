@@ -0,0 +1,97 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdint.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * Block allocator.
+ * The free list (one byte per block) stays the format on disk. In memory the allocator
+ * packs it into a bitmap with one bit per block (set == free), so it can skip 64 used
+ * blocks at once, and continues searching where the last allocation ended (next-fit).
+ * The bitmap is built from the free list on first use and every change is written
+ * through to the free list. File data asks for whole runs of blocks, so files are laid
+ * out sequentially even when the free space is fragmented.
+ * Copies share the data blocks of their source. The free list byte of a used block counts
+ * its references: 0 is a block of one file, n > 1 a block shared by n files.
+ * All functions but alloc_init take the allocator lock, see lock.h, unless the allocator
+ * runs lock-free.
+ */
+
+#define BLOCK_MAX_REFS UINT8_MAX
+
+/*
+ * where the threads on one CPU start searching in lock-free mode. Every hint has a cache
+ * line of its own, so CPUs don't take it from each other
+ */
+typedef struct _alloc_hint{
+	uint32_t block;
+	uint32_t inode;
+} __attribute__((aligned(64))) alloc_hint;
+
+/*
+ * Switches to lock-free allocation and calls fs_threads_enable. Blocks are claimed with a
+ * compare-and-swap on the words of the bitmap, inodes with one on their type, and free_blocks
+ * and the references of shared blocks are changed atomically, so allocating threads never
+ * wait for each other. Every CPU searches from a hint of its own, spread over the fs at first.
+ * Has to be called before the threads start, there is no way back.
+ * While the fs is journaled blocks still go through the allocator lock, the journal has to
+ * record them in the order they are taken.
+ * @return 0 on success, -1 if there is no memory
+ */
+int alloc_lockfree_enable(file_system* fs);
+
+/*
+ * @return the hint of the CPU the calling thread runs on, NULL unless the allocator is lock-free
+ */
+alloc_hint* alloc_cpu_hint(file_system* fs);
+
+/*
+ * @return the number of free blocks, may be called while other threads allocate
+ */
+uint32_t free_block_count(file_system* fs);
+
+/*
+ * (Re)builds the bitmap from the free list
+ * @return 0 on success, -1 if there is no memory for the bitmap
+ */
+int alloc_init(file_system* fs);
+
+/*
+ * claims a free block: marks it as used and updates the superblock
+ * @return the block number or -1 if there is no free block
+ */
+int alloc_block(file_system* fs);
+
+/*
+ * claims a run of up to want consecutive free blocks. If the block goal is free, the run
+ * starts there, so a file can continue its last run. Otherwise the first run of want blocks
+ * behind the cursor is taken, or the longest run if there is none that long
+ * @param int* start is set to the first block of the run
+ * @return the length of the run, 0 if there is no free block
+ */
+uint32_t alloc_run(file_system* fs, int goal, uint32_t want, int* start);
+
+/*
+ * adds a reference to a used block
+ * @return 0 on success, -1 if the block has BLOCK_MAX_REFS references already
+ */
+int share_block(file_system* fs, int block_num);
+
+/*
+ * @return 1 if more than one file references the block, 0 else
+ */
+int block_is_shared(file_system* fs, int block_num);
+
+/*
+ * drops a reference to a block, with the last one the block goes back to the allocator
+ */
+void release_block(file_system* fs, int block_num);
+
+/*
+ * frees the memory of the bitmap
+ */
+void alloc_cleanup(file_system* fs);
+
+#endif //ALLOC_H
@@ -0,0 +1,97 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * Path lookup (dentry) cache.
+ * Two direct mapped hash tables: one maps (parent inode, name) to the child inode,
+ * the other maps whole paths, so a hot path resolves with a single probe.
+ * Only successful lookups are cached. Every entry is checked against the inode it
+ * points to before it is used (still in use, same parent and name, same generation),
+ * so entries never have to be searched for when something changes. Releasing an inode
+ * bumps its generation, which drops every entry that resolves to it.
+ * The tables are built on first use. Lookups and dcache_get_stats take the dcache lock
+ * shared, lookups count their hits and misses with relaxed atomics. Every other function
+ * but dcache_cleanup takes the lock exclusively.
+ */
+
+#define DCACHE_PATH_MAX 128 //longer paths are only cached component by component
+#define DCACHE_MIN_ENTRIES 64
+#define DCACHE_MAX_ENTRIES 4096
+
+typedef struct _dcache_stats{
+	uint64_t path_hits;
+	uint64_t path_misses;
+	uint64_t name_hits;
+	uint64_t name_misses;
+} dcache_stats;
+
+typedef struct _dcache_name_entry{
+	int parent;
+	int inode; //-1 if empty
+	uint32_t gen;
+} dcache_name_entry;
+
+typedef struct _dcache_path_entry{
+	int inode; //-1 if empty
+	int parent;
+	uint32_t gen;
+	uint16_t len;
+	uint16_t name_offset; //start of the last component in path
+	char path[DCACHE_PATH_MAX];
+} dcache_path_entry;
+
+typedef struct _dcache{
+	uint32_t mask; //number of entries per table - 1
+	uint32_t* gens; //generation of every inode
+	dcache_name_entry* names;
+	dcache_path_entry* paths;
+	dcache_stats stats;
+} dcache;
+
+/*
+ * @return the inode of the child called name (name_len bytes) in the directory parent or -1 if not cached
+ */
+int dcache_lookup_name(file_system* fs, int parent, const char* name, size_t name_len);
+
+/*
+ * remembers that name (name_len bytes) in the directory parent is the inode child
+ */
+void dcache_add_name(file_system* fs, int parent, const char* name, size_t name_len, int child);
+
+/*
+ * @return the inode the first len bytes of path resolve to or -1 if not cached
+ */
+int dcache_lookup_path(file_system* fs, const char* path, size_t len);
+
+/*
+ * remembers that the first len bytes of path resolve to inode_num
+ */
+void dcache_add_path(file_system* fs, const char* path, size_t len, int inode_num);
+
+/*
+ * drops every entry resolving to the inode. Called when the inode is released
+ */
+void dcache_invalidate(file_system* fs, int inode_num);
+
+/*
+ * drops every entry resolving to the inode or anything below it.
+ * Has to be called by operations that move a subtree, e.g. a rename
+ */
+void dcache_invalidate_tree(file_system* fs, int inode_num);
+
+/*
+ * copies the hit and miss counters to stats. Lookups running meanwhile may or may not be counted
+ */
+void dcache_get_stats(file_system* fs, dcache_stats* stats);
+
+/*
+ * frees the tables
+ */
+void dcache_cleanup(file_system* fs);
+
+#endif //DCACHE_H
@@ -0,0 +1,84 @@
+#ifndef DIR_H
+#define DIR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * Directories.
+ * Small directories keep the inode numbers of their children in direct_blocks.
+ * Once a directory outgrows them, its children move into a hash table of inode numbers
+ * keyed by the child's name and stored in data blocks. indirect_block then points to the
+ * index block: a dir_header followed by the block numbers of the index leaves, which in
+ * turn hold the block numbers of the table blocks.
+ * The table uses linear probing and is rebuilt with twice the size once it is 3/4 full,
+ * so lookup, insert and remove take O(1) expected time and the number of children is
+ * only limited by the free blocks. A table that shrinks to DIR_INLINE_MIN children
+ * moves back into direct_blocks.
+ */
+
+#define DIR_SLOTS_PER_BLOCK (BLOCK_SIZE / sizeof(int))
+#define DIR_INLINE_MIN (DIRECT_BLOCKS_COUNT / 2)
+#define DIR_EMPTY -1
+#define DIR_DELETED -2 //slot of a removed child, probing continues behind it
+
+typedef struct _dir_header{
+	uint32_t entries;
+	uint32_t deleted; //number of DIR_DELETED slots
+	uint32_t table_blocks; //always a power of two
+} dir_header;
+
+#define DIR_INDEX_LEAVES ((BLOCK_SIZE - sizeof(dir_header)) / sizeof(int))
+
+typedef struct _dir_iter{
+	int dir;
+	uint32_t pos; //index in direct_blocks or slot in the table
+} dir_iter;
+
+/*
+ * @return the child called name (name_len bytes) of the directory dir or -1
+ */
+int dir_lookup(file_system* fs, int dir, const char* name, size_t name_len);
+
+/*
+ * adds child to the directory dir under the name stored in the child's inode.
+ * The caller makes sure there is no child with that name yet
+ * @return 0 on success, -1 if there are not enough free blocks
+ */
+int dir_add(file_system* fs, int dir, int child);
+
+/*
+ * removes child from the directory dir, has to be called while the child still has its name
+ * @return 0 on success, -1 if child is not in dir
+ */
+int dir_remove(file_system* fs, int dir, int child);
+
+/*
+ * forgets all children of the directory dir and frees its table
+ */
+void dir_clear(file_system* fs, int dir);
+
+/*
+ * @return the number of children of the directory dir
+ */
+uint32_t dir_count(file_system* fs, int dir);
+
+/*
+ * @return the number of data blocks holding the table of the directory dir, 0 if it has none
+ */
+uint32_t dir_block_count(file_system* fs, int dir);
+
+/*
+ * starts iterating over the children of the directory dir.
+ * The directory must not change while the iteration runs
+ */
+void dir_iter_init(dir_iter* iter, int dir);
+
+/*
+ * @return the next child or -1 if there are no more
+ */
+int dir_iter_next(file_system* fs, dir_iter* iter);
+
+#endif //DIR_H
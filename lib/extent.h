@@ -0,0 +1,81 @@
+#ifndef EXTENT_H
+#define EXTENT_H
+
+#include <stdint.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * File block map.
+ * The first DIRECT_BLOCKS_COUNT blocks of a file are listed one by one in direct_blocks,
+ * so small files don't need any extra block. The blocks behind them are mapped by extents,
+ * runs of consecutive blocks, kept in a tree whose root is the block indirect_block.
+ * Leaves hold the extents, inner nodes the first logical block and the block number of
+ * each child. Files only grow at their end, so extents are always added to the rightmost
+ * leaf. Once the root is full, it moves into a new block and gets one level deeper.
+ * Moving blocks inside the file (copy-on-write) builds the tree again.
+ */
+
+typedef struct _extent_node{
+	uint16_t depth; //0 for leaves
+	uint16_t count; //number of entries following the header
+} extent_node;
+
+typedef struct _extent{
+	uint32_t logical; //first block of the file in this run
+	uint32_t start; //block number of the first block
+	uint32_t len;
+} extent;
+
+typedef struct _extent_index{
+	uint32_t logical; //first block of the file below child
+	uint32_t child;
+} extent_index;
+
+#define EXTENTS_PER_NODE ((BLOCK_SIZE - sizeof(extent_node)) / sizeof(extent))
+#define EXTENT_INDEXES_PER_NODE ((BLOCK_SIZE - sizeof(extent_node)) / sizeof(extent_index))
+
+/*
+ * @return the number of the block holding block logical of the file or -1
+ */
+int extent_get_block(file_system* fs, int file, uint32_t logical);
+
+/*
+ * finds the run of consecutive blocks starting at block logical of the file
+ * @param int* start is set to the block number of the first block of the run
+ * @return the length of the run, 0 if the file has no block logical
+ */
+uint32_t extent_get_run(file_system* fs, int file, uint32_t logical, int* start);
+
+/*
+ * maps block logical of the file to block_num. logical has to be the block behind the last one
+ * @return 0 on success, -1 if there is no free block for the tree
+ */
+int extent_add_block(file_system* fs, int file, uint32_t logical, int block_num);
+
+/*
+ * maps the len blocks of the file from block logical on to the blocks from start on.
+ * logical has to be the block behind the last one
+ * @return 0 on success, -1 if there is no free block for the tree
+ */
+int extent_add_run(file_system* fs, int file, uint32_t logical, int start, uint32_t len);
+
+/*
+ * moves the count mapped blocks of the file from block logical on to the blocks from start on.
+ * The old blocks are not released
+ * @return 0 on success, -1 if there are not enough free blocks for the tree, the map is unchanged then
+ */
+int extent_remap(file_system* fs, int file, uint32_t logical, uint32_t count, int start);
+
+/*
+ * fragmentation metric: the number of runs of consecutive blocks holding the file,
+ * 1 if the file is stored in one piece, 0 if it has no blocks
+ */
+uint32_t extent_count_runs(file_system* fs, int file);
+
+/*
+ * gives every data block of the file and the tree back to the allocator
+ */
+void extent_release(file_system* fs, int file);
+
+#endif //EXTENT_H
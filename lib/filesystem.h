@@ -9,6 +9,10 @@
 #define BLOCK_SIZE 1024
 #define NAME_MAX_LENGTH 32
 #define DIRECT_BLOCKS_COUNT 12
+#define DIRTY_PAGE_SIZE 4096 //granularity of the dirty tracking for checkpoints
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 enum node_type{
 	reg_file=1,
@@ -23,37 +27,86 @@ typedef struct _data_block{
 
 /*
  * The direct_blocks can either point to other inode, in case this inode is a directory
- * or to data_blocks, in case this is a regular file
+ * or to data_blocks, in case this is a regular file.
+ * Directories with more children than direct_blocks keep them in a hash table, see dir.h.
+ * Files with more blocks than direct_blocks map the rest in an extent tree, see extent.h
  */
 typedef struct _inode {
 	enum node_type n_type;
-	uint16_t size;
+	uint64_t size;
 	char name[NAME_MAX_LENGTH];
 	int direct_blocks[DIRECT_BLOCKS_COUNT]; //Block numbers. -1 if there is no block
+	int indirect_block; //directory: index block of its hash table. Regular file: root of its extent tree. -1 if there is none
 	int parent; //inode number of parent
 } inode;
 
+/*
+ * Images start with FS_MAGIC and the FS_VERSION of their layout, fs_load and fs_mount
+ * refuse anything else. Images of the first layout have no magic, fs_upgrade converts them
+ */
+#define FS_MAGIC 0x32534648 //"HFS2"
+#define FS_VERSION 2
+
 typedef struct _superblock{
 	uint32_t num_blocks;
 	uint32_t free_blocks;
+	uint32_t magic;
+	uint32_t version;
 } superblock;
 
 typedef struct _fs{
 	superblock* s_block;
-	uint8_t * free_list; //free == 1
+	uint8_t * free_list; //free == 1, used by one file == 0, shared by n files == n
 	inode * inodes;	
 	data_block* data_blocks;
 	int root_node; //inode-number of root node
+	void* mapping; //start of the mmap'ed image if mounted with fs_mount, NULL else
+	size_t mapping_size;
+	int image_fd; //fd of the image the fs was loaded from, mounted from or last dumped to. -1 if none
+	uint64_t* block_bitmap; //free_list packed into bits, built by the allocator on first use
+	uint32_t alloc_cursor; //block number where the allocator continues searching
+	int* free_inodes; //stack of free inode numbers, built on first use lowest on top. Released inodes are pushed, so they are reused first
+	uint32_t free_inodes_count;
+	struct _alloc_hint* alloc_hints; //per-CPU search starts of the lock-free allocator, NULL unless it is on, see alloc.h
+	uint32_t alloc_hints_count;
+	uint64_t* dirty_pages; //one bit per DIRTY_PAGE_SIZE page of the image, changed since the last dump/checkpoint
+	struct _journal* journal; //NULL if changes are not journaled
+	struct _dcache* dcache; //path lookup cache, built on first use
+	struct _fs_locks* locks; //NULL unless the fs is shared between threads, see lock.h
 }file_system ;
 
 /**
 	* Allocates memory for a filesystem and loads an existing filesystem from a .fs-file.
+	* Operations recorded in the journal next to the file are replayed.
 	* @param const char* path to the fs-file
-	* @return pointer to a fs-struct 
+	* @return pointer to a fs-struct, NULL if the file is not an image of FS_VERSION.
+	*         The reason is printed to stderr
 **/
 file_system* fs_load(const char* fs_file_path);
 
 
+/**
+	* Maps an existing .fs-file into memory instead of reading it.
+	* s_block, free_list, inodes and data_blocks point straight into the mapping,
+	* so mounting costs O(1) and pages are only loaded when they are touched.
+	* Changes go directly to the mapping; fs_dump on the same file only msyncs them.
+	* Operations recorded in the journal next to the file are replayed.
+	* @param const char* path to the fs-file
+	* @return pointer to a fs-struct or NULL if the file can't be mapped or is not an
+	*         image of FS_VERSION, the latter is printed to stderr
+**/
+file_system* fs_mount(const char* fs_file_path);
+
+/**
+	* Converts an image of the first layout, which had no magic, a 16 bit file size and
+	* no extent or directory index blocks, into an image of FS_VERSION in place.
+	* The new image replaces the old one only once it is complete
+	* @param const char* path to the fs-file
+	* @return 0 on success or if the image is current already, -1 if the file is no image
+	*         of either layout or can't be written
+**/
+int fs_upgrade(const char* fs_file_path);
+
 /**
 	* creates a new file system file
 	* including Superblock, free list, space for inodes etc
@@ -65,12 +118,31 @@ file_system* fs_create(const char* fs_file_path, uint32_t size);
 
 /*
  * dumps the filesystem to harddrive
+ * The image is written to a temporary file that replaces file_path once it is complete.
+ * If fs is mounted and file_path is the mounted image, the dirty pages are msync'ed instead
  * @param file_system* fs the filesystem to dump
  * @param const char* file_path where to put the file on the harddrive
  * @return 0 on success, -1 else
  */
 int fs_dump(file_system* fs, const char* file_path);
 
+/*
+ * writes only the pages changed since the last dump or checkpoint back into the image.
+ * If file_path is not the image fs was loaded from or last dumped to, a full dump is done instead
+ * @param file_system* fs the filesystem to save
+ * @param const char* file_path where the image lives on the harddrive
+ * @return the number of bytes written, -1 on error
+ */
+long fs_checkpoint(file_system* fs, const char* file_path);
+
+/*
+ * record changes for the next checkpoint. Every change to the fs has to be marked
+ */
+void mark_superblock_dirty(file_system* fs);
+void mark_free_list_dirty(file_system* fs, int block_num);
+void mark_inode_dirty(file_system* fs, int num);
+void mark_data_block_dirty(file_system* fs, int block_num);
+
 
 /*
 	* Initialize an empty inode
@@ -78,9 +150,23 @@ int fs_dump(file_system* fs, const char* file_path);
 void inode_init(inode* i);
 /*
 	* find free inode and return its number or -1 if there is no free inode
+	* Amortized O(1): takes the top of the free inode stack, which is built on the first call.
+	* A lock-free allocator searches from the hint of the calling CPU on instead
 */
 int find_free_inode(file_system* fs);
 
+/*
+	* takes a free inode for a new node of the given type in one step, so no other thread
+	* can take the same one. The inode is reset and has no parent yet
+	* @return the inode number or -1 if there is no free inode
+*/
+int claim_inode(file_system* fs, enum node_type type);
+
+/*
+	* Resets an inode and gives it back to the free inode stack
+*/
+void release_inode(file_system* fs, int num);
+
 /*
 	* frees up memory
 */
@@ -0,0 +1,86 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Image I/O engine.
+ * Large transfers of the image are cut into IO_CHUNK_SIZE requests at offsets aligned to
+ * IO_CHUNK_SIZE in the file, so the device gets many requests at once instead of one long
+ * blocking call per region. The requests go through io_uring, IO_QUEUE_DEPTH in flight.
+ * Where the kernel has no io_uring or doesn't allow it, a pool of threads does them with
+ * pread/pwrite instead. A request io_uring rejects is done with pread/pwrite as well.
+ */
+
+#define IO_CHUNK_SIZE (256 * 1024)
+#define IO_QUEUE_DEPTH 32
+#define IO_THREADS 4
+
+enum io_engine{
+	IO_ENGINE_AUTO = 0, //io_uring if the kernel allows it, the thread pool else
+	IO_ENGINE_URING = 1,
+	IO_ENGINE_THREADS = 2
+};
+
+/*
+ * a part of a transfer, buf is read from or written to offset in the file
+ */
+typedef struct _io_req{
+	uint8_t* buf;
+	size_t len;
+	uint64_t offset;
+} io_req;
+
+/*
+ * requests that are collected and then done at once
+ */
+typedef struct _io_batch{
+	int fd;
+	int write; //1 to write the buffers into the file, 0 to read them from it
+	io_req* reqs;
+	size_t count;
+	size_t cap;
+	int failed; //an io_batch_add ran out of memory
+} io_batch;
+
+/*
+ * Chooses the engine for all following batches of the process
+ * @return 0 on success, -1 if io_uring is asked for but not available
+ */
+int io_set_engine(enum io_engine engine);
+
+/*
+ * @return the engine the batches use, IO_ENGINE_URING or IO_ENGINE_THREADS
+ */
+enum io_engine io_get_engine(void);
+
+void io_batch_init(io_batch* batch, int fd, int write);
+
+/*
+ * adds the cnt buffers of iov, which lie one after another in the file from offset on,
+ * cut into aligned requests
+ * @return 0 on success, -1 if there is no memory, the batch fails then as well
+ */
+int io_batch_add(io_batch* batch, const struct iovec* iov, int cnt, uint64_t offset);
+
+/*
+ * does all requests of the batch and empties it, in no particular order
+ * @return 0 if every byte was transferred, -1 else. A read behind the end of the file fails
+ */
+int io_batch_run(io_batch* batch);
+
+/*
+ * frees the requests of a batch that isn't run
+ */
+void io_batch_free(io_batch* batch);
+
+/*
+ * writes the cnt buffers of iov at the current position of fd, IOV_MAX per writev.
+ * A short write continues where it stopped, iov is changed on the way
+ * @return 0 on success, -1 else
+ */
+int io_write_all(int fd, struct iovec* iov, int cnt);
+
+#endif //IO_H
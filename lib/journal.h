@@ -0,0 +1,137 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * Metadata journal.
+ * Every operation that changes the fs is appended to <image>.journal as one record
+ * together with the blocks it allocated. fs_load and fs_mount replay the records on
+ * top of the image, handing the recorded blocks out again so the result is identical.
+ * A dump or checkpoint makes the records obsolete and empties the journal. fs_mount
+ * replays into the image itself, so it syncs the image and empties the journal as well.
+ *
+ * Checkpoints with an open journal first append the pages they are about to write and
+ * a commit record. If the process dies while the image is written, the pages are
+ * written again on the next load, so the image is never left torn.
+ */
+
+#define JOURNAL_SUFFIX ".journal"
+#define JOURNAL_MAGIC 0x4c4e524a
+
+enum journal_op{
+	j_mkdir=1,
+	j_mkfile=2,
+	j_writef=3,
+	j_rm=4,
+	j_cp=5,
+	j_import=6, //data is the content of the file after the import
+	j_pages=7, //image pages of a checkpoint
+	j_commit=8, //all pages of a checkpoint are in the journal
+	j_pwrite=9, //data is the 8 byte offset followed by the written bytes
+	j_writev=10 //data is the appended bytes
+};
+
+typedef struct _journal_header{
+	uint32_t magic;
+	uint32_t op;
+	uint32_t len; //length of the payload following the header
+	uint32_t checksum; //of the payload
+} journal_header;
+
+typedef struct _journal{
+	int fd; //-1 while replaying
+	int* allocs; //blocks allocated by the current operation
+	uint32_t allocs_count;
+	uint32_t allocs_cap;
+	uint32_t replay_pos; //next recorded block to hand out while replaying
+	int failed; //a record or block was lost, nothing is logged until the journal restarts
+} journal;
+
+/*
+ * starts journaling all changes to fs into <image_path>.journal
+ * Not possible for mounted filesystems, the kernel may write their pages back at any time
+ * @return 0 on success, -1 else
+ */
+int journal_open(file_system* fs, const char* image_path);
+
+/*
+ * stops journaling
+ */
+void journal_close(file_system* fs);
+
+/*
+ * finishes a checkpoint that was interrupted after its commit record was written,
+ * has to be called before the image is read
+ * @return 0 on success, -1 if the image couldn't be repaired
+ */
+int journal_recover(const char* image_path);
+
+/*
+ * applies all operations in <image_path>.journal to fs
+ * A torn record at the end is cut off
+ * @return the number of operations applied
+ */
+int journal_replay(file_system* fs, const char* image_path);
+
+/*
+ * appends an operation. path2 is only used by cp, data by writef and import
+ * If the record can't be written, the journal stops logging and says so on stderr. The
+ * records before it still replay to a consistent state, the next dump or checkpoint
+ * starts logging again
+ * @return 0 on success or without a journal, -1 if the journal failed
+ */
+int journal_log(file_system* fs, enum journal_op op, const char* path, const char* path2, const struct iovec* data, int data_cnt);
+
+/*
+ * stops logging because a record is lost, for callers that can't even build it
+ */
+void journal_fail(file_system* fs);
+
+/*
+ * called by the allocator for every block it hands out
+ * A block that can't be noted stops the journal like a lost record
+ */
+void journal_note_alloc(file_system* fs, int block_num);
+
+/*
+ * forgets the blocks noted for the current operation. For an operation that allocated
+ * from several threads at once, the order can't be replayed, the replay takes its blocks
+ * from the allocator instead
+ */
+void journal_drop_allocs(file_system* fs);
+
+/*
+ * while replaying: the next block the operation allocated originally, -1 else
+ */
+int journal_replay_alloc(file_system* fs);
+
+/*
+ * while replaying: the next run of consecutive blocks the operation allocated originally,
+ * at most want blocks long
+ * @param int* start is set to the first block
+ * @return the length of the run, 0 if not replaying
+ */
+uint32_t journal_replay_alloc_run(file_system* fs, uint32_t want, int* start);
+
+/*
+ * appends image pages at offset, that a checkpoint is about to write
+ */
+int journal_log_pages(file_system* fs, size_t offset, const struct iovec* pages, int pages_cnt);
+
+/*
+ * appends the commit record and waits until the journal is on disk
+ */
+int journal_commit(file_system* fs);
+
+/*
+ * the image at image_path now contains every change. Empties its journal and
+ * continues journaling there if the fs was journaled
+ */
+void journal_restart(file_system* fs, const char* image_path);
+
+#endif //JOURNAL_H
@@ -0,0 +1,69 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <pthread.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * Locking for a file system shared between threads.
+ * It is off until fs_threads_enable is called, every lock function returns at once
+ * before that, so a single thread pays nothing for it.
+ *
+ * The locks, outermost first:
+ *  - journal: held for a whole changing operation while the fs is journaled, so the
+ *    records and the blocks they allocated stay in the order the changes were made
+ *  - tree: shared by every operation. rm, dumps and checkpoints hold it exclusively,
+ *    so under the shared lock nodes are only ever added and a resolved path stays valid
+ *  - inodes: one reader/writer lock per inode. A directory is locked while it is
+ *    searched or gets a child, a file while it is read or written. An operation that
+ *    needs several locks takes the parent before the child. cp read-locks the source
+ *    tree while it copies it and only locks the destination once they are released
+ *  - alloc and dcache: taken inside the allocator and the dentry cache only, never
+ *    together and never while waiting for another lock. A lock-free allocator doesn't
+ *    take alloc, see alloc_lockfree_enable. Lookups share dcache, changes to the cache
+ *    take it exclusively
+ */
+
+typedef struct _fs_locks{
+	pthread_mutex_t journal;
+	pthread_rwlock_t tree;
+	pthread_rwlock_t* inodes; //one per inode
+	pthread_mutex_t alloc; //free_list, free_blocks, the bitmap, the cursor and the free inodes
+	pthread_rwlock_t dcache;
+} fs_locks;
+
+/**
+ * Makes fs safe to use from several threads at once. Has to be called before the
+ * threads start, a second call does nothing.
+ * Replaying the journal, journal_open and journal_close, cleanup and the allocator's
+ * alloc_init still need the fs to themselves.
+ *
+ * @return 0 on success, -1 if there is no memory for the locks
+ */
+int fs_threads_enable(file_system* fs);
+
+/*
+ * frees the locks, called by cleanup
+ */
+void lock_cleanup(file_system* fs);
+
+void lock_journal(file_system* fs);
+void unlock_journal(file_system* fs);
+
+void lock_tree_read(file_system* fs);
+void lock_tree_write(file_system* fs);
+void unlock_tree(file_system* fs);
+
+void lock_inode_read(file_system* fs, int num);
+void lock_inode_write(file_system* fs, int num);
+void unlock_inode(file_system* fs, int num);
+
+void lock_alloc(file_system* fs);
+void unlock_alloc(file_system* fs);
+
+void lock_dcache_read(file_system* fs);
+void lock_dcache_write(file_system* fs);
+void unlock_dcache(file_system* fs);
+
+#endif //LOCK_H
@@ -1,12 +1,12 @@
 #ifndef OPERATIONS_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #include "../lib/filesystem.h"
 
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
-
 /**
  * Creates a new directory under the given path
  *
@@ -36,7 +36,7 @@ int fs_mkfile(file_system *fs, char *path_and_name);
  * - -2 if file with same name already exists.
  * NOTE:
  * - the name of the new file/folder should be always given at the end dest_path.
- * - in case of copying a folder, the function should be called recursively.
+ * - a folder is copied with everything below it.
  */
  int fs_cp(file_system *fs, char *src_path, char *dst_path_and_name);
 /**
@@ -58,6 +58,103 @@ int fs_mkfile(file_system *fs, char *path_and_name);
  */
 char *fs_list(file_system *fs, char *path);
 
+/*
+ * an entry yielded by fs_dir_next. name points into the inode table and is
+ * only valid until the file system changes
+ */
+typedef struct _fs_dirent {
+	int inode;
+	enum node_type type;
+	const char *name;
+} fs_dirent;
+
+/*
+ * cursor over the children of a directory, in inode order. The children are
+ * taken when the directory is opened. A small directory is kept in the cursor
+ * itself, only a directory with more than DIRECT_BLOCKS_COUNT children needs
+ * one heap allocation. The cursor holds no pointer into itself and may be moved.
+ */
+typedef struct _fs_dir {
+	int dir; //inode number of the directory
+	int *children; //malloc'ed sorted inode numbers, NULL if they fit into inline_children
+	uint32_t count;
+	uint32_t pos;
+	int inline_children[DIRECT_BLOCKS_COUNT];
+	fs_dirent entry;
+} fs_dir;
+
+/**
+ * Opens the directory pointed to by @param path for reading with fs_dir_next.
+ *
+ * @Returns: 0 on success, -1 if the path is not a directory or there is no memory
+ */
+int fs_dir_open(file_system *fs, char *path, fs_dir *dir);
+
+/**
+ * @Returns: the next child of the directory or NULL after the last one.
+ * Children removed since fs_dir_open are skipped.
+ */
+fs_dirent *fs_dir_next(file_system *fs, fs_dir *dir);
+
+/**
+ * Frees what fs_dir_open allocated
+ */
+void fs_dir_close(fs_dir *dir);
+
+/*
+ * what a fs_walk callback tells the walk to do next
+ */
+enum fs_walk_action {
+	FS_WALK_CONTINUE = 0,
+	FS_WALK_PRUNE = 1, //skip the children of this directory, only in pre-order
+	FS_WALK_STOP = 2 //end the walk
+};
+
+#define FS_WALK_PRE 0 //visit a directory before its children, the default
+#define FS_WALK_POST 1 //visit a directory after its children
+#define FS_WALK_DEPTH_SHIFT 8
+#define FS_WALK_MAX_DEPTH(n) (((n) + 1) << FS_WALK_DEPTH_SHIFT) //only visit nodes up to n levels below the root
+
+/*
+ * called for every node of a walk. path is the node's path in a buffer that is reused
+ * for the next node, depth is 0 for the root of the walk
+ */
+typedef int (*fs_walk_fn)(file_system *fs, int inode_num, const char *path, int depth, void *ctx);
+
+/**
+ * Visits every node below and including @param root once, without resolving any
+ * path but the root. Children are visited in inode order. @param flags is
+ * FS_WALK_PRE or FS_WALK_POST, optionally combined with FS_WALK_MAX_DEPTH(n).
+ * The file system may be changed by the callback, removed nodes are skipped.
+ *
+ * @Returns:
+ * 0 if every node was visited
+ * 1 if the callback stopped the walk
+ * -1 if the root was not found or there is no memory
+ */
+int fs_walk(file_system *fs, char *root, int flags, fs_walk_fn callback, void *ctx);
+
+/*
+ * fixed-size record of fs_list_stat, the fields leave no padding
+ */
+typedef struct _fs_stat {
+	int32_t inode;
+	uint32_t type; //enum node_type
+	uint64_t size; //in bytes
+	uint64_t blocks; //data blocks holding the content of a file or the table of a directory
+	char name[NAME_MAX_LENGTH];
+} fs_stat;
+
+/**
+ * Fills @param out with a record for every child of the directory pointed to by
+ * @param path, in inode order. At most @param cap records are written.
+ *
+ * @Returns:
+ * the number of children, if it is larger than cap only the first cap are in out
+ * -1 if the path is not a directory or there is no memory
+ */
+long fs_list_stat(file_system *fs, char *path, fs_stat *out, size_t cap);
+
 /**
  * Write (append, not overwrite) @param text to a file pointed to by @param
  * filename The file must exist before it can be written to
@@ -69,6 +166,31 @@ char *fs_list(file_system *fs, char *path);
  */
 int fs_writef(file_system *fs, char *filename, char *text);
 
+/**
+ * Writes @param len bytes of @param buf at @param offset into the file pointed
+ * to by @param path. Bytes inside the file are overwritten in place, the file
+ * grows as needed. Writing behind the end fills the gap with zeros.
+ *
+ * @Returns:
+ * number of written bytes on success
+ * -1 if the file is not available
+ * -2 if the file system is full, the bytes written up to then are kept. If the
+ *    gap up to offset doesn't fit, nothing is allocated
+ */
+long fs_pwrite(file_system *fs, char *path, uint64_t offset, const uint8_t *buf, size_t len);
+
+/**
+ * Appends the @param iovcnt buffers of @param iov to the file pointed to by
+ * @param path in one go. The path is resolved once and all new blocks are
+ * reserved before the buffers are copied.
+ *
+ * @Returns:
+ * number of appended bytes on success
+ * -1 if the file is not available
+ * -2 if the file system is full, as many bytes as fit are appended
+ */
+long fs_writev(file_system *fs, char *path, const struct iovec *iov, int iovcnt);
+
 /**
  * Reads a file and allocates memory for a uint8_t buffer (array). Reads this
  * file into the buffer writes the file_size into the memory pointed to by int*
@@ -78,6 +200,51 @@ int fs_writef(file_system *fs, char *filename, char *text);
  */
 uint8_t *fs_readf(file_system *fs, char *filename, int *file_size);
 
+/**
+ * Reads up to len bytes at offset of a file into buf, which is owned by the caller.
+ * Only the blocks covering the range are copied and nothing is allocated.
+ *
+ * @Returns:
+ * the number of bytes read, less than len if the file ends earlier
+ * 0 if offset is at or behind the end of the file, an empty file is no error
+ * -1 if the file does not exist or is a directory
+ */
+long fs_pread(file_system *fs, char *path, uint64_t offset, size_t len, uint8_t *buf);
+
+/**
+ * A range of a file as it lies in the data blocks, one span per block.
+ * The spans point straight into the file system. They stay valid until the view is
+ * released: the view holds a reference to every block, like a copy made by fs_cp, so
+ * the file is copied on write and the blocks outlive an fs_rm. No lock is held, the
+ * file system can be used as usual meanwhile and the view keeps showing the old content.
+ * A dump or checkpoint saves the references too, release views before the image is written.
+ */
+typedef struct _read_view {
+	struct iovec *spans;
+	int count;
+	size_t len; //bytes in all spans together
+	file_system *fs;
+	int *blocks; //block of every span, each referenced by the view. NULL if there are none
+} read_view;
+
+/**
+ * Points view at up to len bytes at offset of a file without copying them.
+ * The spans can be passed to writev or hashed in place.
+ * Every view has to be given back with fs_release_view, also an empty one.
+ *
+ * @Returns:
+ * 0 on success, view->len is 0 if offset is at or behind the end of the file
+ * -1 if the file does not exist, is a directory, there is no memory for the spans or
+ *  a block of the range can't take another reference
+ */
+int fs_read_view(file_system *fs, char *path, uint64_t offset, size_t len, read_view *view);
+
+/**
+ * Ends the lifetime of a view and drops its references, blocks only the view still
+ * used go back to the allocator
+ */
+void fs_release_view(read_view *view);
+
 /**
  * Deletes a file or a directory recursively.
  *
@@ -89,7 +256,10 @@ int fs_rm(file_system *fs, char *path);
 
 /**
  * Imports the file and saves it in the current filesystem under the path
- * pointed to by the second parameter
+ * pointed to by the second parameter.
+ * The blocks for a regular file are reserved before it is read, and the data is read
+ * straight into them. The old content is only replaced once the import is complete,
+ * a failed import leaves the file unchanged.
  *
  * @Param: char* int_path path where the imported file should be saved in the
  * internal file system
@@ -97,10 +267,40 @@ int fs_rm(file_system *fs, char *path);
  *
  * @Returns:
  * 0 on success
- * -1 if the file or directory wasn't found
+ * -1 if the file or directory wasn't found or the file doesn't fit
  */
 int fs_import(file_system *fs, char *int_path, char *ext_path);
 
+/**
+ * Same as fs_import, but reads the content from an already opened stream.
+ * The stream is read until EOF and is not closed. Its size is not known in advance,
+ * so a stream that doesn't fit is only noticed while it is read.
+ *
+ * @Returns:
+ * 0 on success
+ * -1 if the file wasn't found or doesn't fit into the file system
+ */
+int fs_import_file(file_system *fs, char *int_path, FILE *ext_file);
+
+/**
+ * Imports the host directory @param ext_dir with everything below it into the directory
+ * pointed to by @param int_dir. The directories and empty files are created first, then
+ * @param nthreads workers fill the files. Each worker takes free blocks from the allocator
+ * in batches, so the workers rarely meet there. If fs_threads_enable wasn't called, more than
+ * one thread turns the locks on for the import only and off again before it returns. The
+ * caller must not use the fs from other threads then, as always without fs_threads_enable.
+ * Existing directories are merged and existing files replaced. Only directories and regular
+ * files are imported, symlinks and other entries are skipped.
+ *
+ * @Returns:
+ * 0 on success
+ * -1 if int_dir is not a directory, ext_dir can't be read or there is no memory
+ * -2 if some entries couldn't be imported (name too long, a file where a directory is or
+ *  the other way round, no space, unreadable), everything else is imported. A file that
+ *  couldn't be imported keeps its old content, -2 never loses data that was there before
+ */
+int fs_import_tree(file_system *fs, char *int_dir, char *ext_dir, int nthreads);
+
 /**
  * Exports the file and saves it in the external filesystem under the path pointed to by the second parameter
  * @Param: char* int_path path where the exported file lives
@@ -112,5 +312,19 @@ int fs_import(file_system *fs, char *int_path, char *ext_path);
  */
 int fs_export(file_system *fs, char *int_path, char *ext_path);
 
+/**
+ * Recreates the directory pointed to by @param int_dir with everything below it under the
+ * host directory @param ext_dir. The host directories are created first, then @param nthreads
+ * workers write the files straight from the data blocks. With one thread every file is written
+ * as soon as its directory is created, without a queue. Existing host directories are merged
+ * and existing files overwritten. The file system can't be changed by rm meanwhile.
+ *
+ * @Returns:
+ * 0 on success
+ * -1 if int_dir is not a directory, ext_dir can't be created or there is no memory
+ * -2 if some entries couldn't be written, everything else is exported
+ */
+int fs_export_tree(file_system *fs, char *int_dir, char *ext_dir, int nthreads);
+
 #define OPERATIONS_H
 #endif /* OPERATIONS_H */
@@ -0,0 +1,36 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <stddef.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * Path resolution.
+ * Paths are walked once, component by component, straight from the string: nothing is
+ * copied or allocated. Every step goes through the dentry cache, and whole paths as
+ * well as the parent of the leaf are looked up in its path table first.
+ * Shared between threads, the caller holds the tree lock and every directory is
+ * locked while it is searched, see lock.h.
+ */
+
+typedef struct _path_lookup{
+	int parent; //directory holding the leaf, -1 if it doesn't exist or the path is "/"
+	int inode; //the leaf itself, -1 if it doesn't exist
+	const char* name; //leaf name, points into the path and is not terminated
+	size_t name_len;
+} path_lookup;
+
+/*
+ * resolves the first size_of_path bytes of path. result is filled in as far as the
+ * path exists, so a missing leaf still yields its parent and name
+ * @return 0 if the leaf exists, -1 else
+ */
+int resolve_path(file_system* fs, const char* path, size_t size_of_path, path_lookup* result);
+
+/*
+ * @return the inode the path resolves to or -1
+ */
+int traverse_path(file_system* fs, const char* path, size_t size_of_path);
+
+#endif //PATH_H
@@ -0,0 +1,427 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../lib/alloc.h"
+#include "../lib/journal.h"
+#include "../lib/lock.h"
+
+#define WORD_BITS 64
+#define MAX_HINTS 256
+
+/*
+ * blocks are claimed without the allocator lock. Not while the fs is journaled, the journal
+ * has to see the blocks in the order they are taken
+ */
+static int lockfree(file_system* fs){
+	return fs->alloc_hints != NULL && fs->journal == NULL;
+}
+
+static uint64_t load_word(file_system* fs, uint32_t w){
+	return __atomic_load_n(&fs->block_bitmap[w], __ATOMIC_RELAXED);
+}
+
+static uint32_t bitmap_words(file_system* fs){
+	return (fs->s_block->num_blocks + WORD_BITS - 1) / WORD_BITS;
+}
+
+int alloc_init(file_system* fs){
+	uint32_t num_blocks = fs->s_block->num_blocks;
+	uint32_t words = bitmap_words(fs);
+
+	uint64_t* bitmap = fs->block_bitmap;
+	if(bitmap == NULL){
+		bitmap = malloc(words * sizeof(uint64_t));
+		if(bitmap == NULL) return -1;
+	}
+	memset(bitmap, 0, words * sizeof(uint64_t));
+
+	for(uint32_t i = 0; i < num_blocks; i++)
+	{
+		if(fs->free_list[i] == 1) bitmap[i / WORD_BITS] |= 1ULL << (i % WORD_BITS);
+	}
+
+	fs->block_bitmap = bitmap;
+	if(fs->alloc_cursor >= num_blocks) fs->alloc_cursor = 0;
+	return 0;
+}
+
+int alloc_lockfree_enable(file_system* fs){
+	if(fs->alloc_hints != NULL) return 0;
+	if(fs_threads_enable(fs) == -1) return -1;
+	if(fs->s_block->num_blocks > 0 && alloc_init(fs) == -1) return -1;
+
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	uint32_t count = (cpus < 1) ? 1 : MIN(cpus, MAX_HINTS);
+	alloc_hint* hints = aligned_alloc(sizeof(alloc_hint), count * sizeof(alloc_hint));
+	if(hints == NULL) return -1;
+	// Every CPU starts in a region of its own
+	for(uint32_t i = 0; i < count; i++)
+	{
+		hints[i].block = (uint64_t)fs->s_block->num_blocks * i / count;
+		hints[i].inode = (uint64_t)fs->s_block->num_blocks * i / count;
+	}
+
+	// Free inodes are found by their type from now on
+	free(fs->free_inodes);
+	fs->free_inodes = NULL;
+	fs->free_inodes_count = 0;
+	fs->alloc_hints_count = count;
+	fs->alloc_hints = hints;
+	return 0;
+}
+
+alloc_hint* alloc_cpu_hint(file_system* fs){
+	if(fs->alloc_hints == NULL) return NULL;
+	int cpu = sched_getcpu();
+	return &fs->alloc_hints[(cpu < 0) ? 0 : cpu % fs->alloc_hints_count];
+}
+
+uint32_t free_block_count(file_system* fs){
+	return __atomic_load_n(&fs->s_block->free_blocks, __ATOMIC_RELAXED);
+}
+
+/*
+ * block number where the search for free blocks starts
+ */
+static uint32_t search_start(file_system* fs){
+	if(!lockfree(fs)) return fs->alloc_cursor;
+	return __atomic_load_n(&alloc_cpu_hint(fs)->block, __ATOMIC_RELAXED) % fs->s_block->num_blocks;
+}
+
+/*
+ * finds the first set bit at or after cursor, wrapping around once
+ */
+static int bitmap_next_free(file_system* fs, uint32_t cursor){
+	uint32_t words = bitmap_words(fs);
+	uint32_t start_word = cursor / WORD_BITS;
+	// Ignore the blocks in front of the cursor in the first word, they are checked after wrapping
+	uint64_t word = load_word(fs, start_word) & (~0ULL << (cursor % WORD_BITS));
+
+	for(uint32_t n = 0; n <= words; n++)
+	{
+		uint32_t w = (start_word + n) % words;
+		if(n > 0) word = load_word(fs, w);
+		if(word != 0) return w * WORD_BITS + __builtin_ctzll(word);
+	}
+	return -1;
+}
+
+static void set_free_bit(file_system* fs, int block_num){
+	uint64_t bit = 1ULL << (block_num % WORD_BITS);
+	if(lockfree(fs)) __atomic_fetch_or(&fs->block_bitmap[block_num / WORD_BITS], bit, __ATOMIC_RELEASE);
+	else fs->block_bitmap[block_num / WORD_BITS] |= bit;
+}
+
+/*
+ * lock-free: clears the set bits in a row from start on, at most len, with one
+ * compare-and-swap per bitmap word. Whoever clears a bit owns the block
+ * @return the number of bits cleared, 0 if the bit of start isn't set
+ */
+static uint32_t claim_bits(file_system* fs, uint32_t start, uint32_t len){
+	uint32_t claimed = 0;
+	while(claimed < len)
+	{
+		uint32_t block_num = start + claimed;
+		uint32_t bit = block_num % WORD_BITS;
+		uint32_t span = MIN(WORD_BITS - bit, len - claimed);
+		uint64_t* word = &fs->block_bitmap[block_num / WORD_BITS];
+		uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+		uint32_t taken;
+		uint64_t mask;
+		do
+		{
+			uint64_t free_bits = old >> bit;
+			taken = MIN((~free_bits != 0) ? (uint32_t)__builtin_ctzll(~free_bits) : WORD_BITS, span);
+			if(taken == 0) return claimed;
+			mask = ((taken == WORD_BITS) ? ~0ULL : (1ULL << taken) - 1) << bit;
+		}
+		while(!__atomic_compare_exchange_n(word, &old, old & ~mask, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+		claimed += taken;
+		if(taken < span) break;
+	}
+	return claimed;
+}
+
+/*
+ * marks a free block as used
+ * @return 0 on success, -1 if the block is not free
+ */
+static int claim_block(file_system* fs, int block_num){
+	fs->block_bitmap[block_num / WORD_BITS] &= ~(1ULL << (block_num % WORD_BITS));
+	if(fs->free_list[block_num] != 1) return -1;
+
+	fs->free_list[block_num] = 0;
+	fs->s_block->free_blocks--;
+	mark_free_list_dirty(fs, block_num);
+	mark_superblock_dirty(fs);
+	fs->alloc_cursor = (block_num + 1) % fs->s_block->num_blocks;
+	journal_note_alloc(fs, block_num);
+	return 0;
+}
+
+/*
+ * claims up to len free blocks in a row from start on
+ * @return the number of blocks claimed, 0 if start is not free
+ */
+static uint32_t claim_run(file_system* fs, uint32_t start, uint32_t len){
+	uint32_t claimed = 0;
+	if(!lockfree(fs))
+	{
+		while(claimed < len && claim_block(fs, start + claimed) == 0) claimed++;
+		return claimed;
+	}
+
+	uint32_t bits = claim_bits(fs, start, len);
+	while(claimed < bits && __atomic_load_n(&fs->free_list[start + claimed], __ATOMIC_RELAXED) == 1)
+	{
+		__atomic_store_n(&fs->free_list[start + claimed], 0, __ATOMIC_RELAXED);
+		mark_free_list_dirty(fs, start + claimed);
+		claimed++;
+	}
+	// A stale bit ends the run, the blocks behind it go back
+	for(uint32_t i = claimed + 1; i < bits; i++)
+	{
+		set_free_bit(fs, start + i);
+	}
+	if(claimed > 0)
+	{
+		__atomic_fetch_sub(&fs->s_block->free_blocks, claimed, __ATOMIC_RELAXED);
+		mark_superblock_dirty(fs);
+		__atomic_store_n(&alloc_cpu_hint(fs)->block, (start + claimed) % fs->s_block->num_blocks, __ATOMIC_RELAXED);
+	}
+	return claimed;
+}
+
+static int take_block(file_system* fs){
+	if(fs->s_block->num_blocks == 0) return -1;
+	if(fs->block_bitmap == NULL && alloc_init(fs) == -1) return -1;
+
+	// A replayed operation gets the same blocks it got originally
+	int block_num = journal_replay_alloc(fs);
+	if(block_num >= 0 && block_num < fs->s_block->num_blocks && claim_block(fs, block_num) == 0) return block_num;
+
+	uint32_t cursor = search_start(fs);
+	int resynced = 0;
+	while(1)
+	{
+		block_num = bitmap_next_free(fs, cursor);
+		if(block_num == -1)
+		{
+			// The free list is the authority. If it was changed behind the allocator's back
+			// there may be free blocks the bitmap doesn't know about, so resync once.
+			// Lock-free, nothing changes behind its back
+			if(resynced || lockfree(fs) || alloc_init(fs) == -1) return -1;
+			resynced = 1;
+			continue;
+		}
+
+		// A stale bit means the block is already in use, another thread may have taken it as
+		// well. Either way its bit is clear now, keep searching
+		if(claim_run(fs, block_num, 1) == 1) return block_num;
+		cursor = block_num;
+	}
+}
+
+int alloc_block(file_system* fs){
+	if(lockfree(fs)) return take_block(fs);
+	lock_alloc(fs);
+	int block_num = take_block(fs);
+	unlock_alloc(fs);
+	return block_num;
+}
+
+static int bit_is_free(file_system* fs, uint32_t block_num){
+	return (load_word(fs, block_num / WORD_BITS) >> (block_num % WORD_BITS)) & 1;
+}
+
+/*
+ * looks for a run of want free blocks in [from, to), remembering the longest run seen in best_*
+ * @return 1 if a run of want blocks was found, it is in best_*, 0 else
+ */
+static int scan_runs(file_system* fs, uint32_t from, uint32_t to, uint32_t want, uint32_t* best_start, uint32_t* best_len){
+	uint32_t run_start = from;
+	uint32_t run_len = 0;
+	for(uint32_t i = from; i < to;)
+	{
+		// Skip the whole span of equal bits starting at i
+		uint32_t bit = i % WORD_BITS;
+		uint64_t word = load_word(fs, i / WORD_BITS) >> bit;
+		uint32_t span;
+		if(word & 1) span = (~word != 0) ? __builtin_ctzll(~word) : WORD_BITS;
+		else span = (word != 0) ? __builtin_ctzll(word) : WORD_BITS;
+		span = MIN(span, MIN(WORD_BITS - bit, to - i));
+
+		if(word & 1)
+		{
+			if(run_len == 0) run_start = i;
+			run_len += span;
+			if(run_len >= want)
+			{
+				*best_start = run_start;
+				*best_len = want;
+				return 1;
+			}
+			if(run_len > *best_len)
+			{
+				*best_start = run_start;
+				*best_len = run_len;
+			}
+		}
+		else
+		{
+			run_len = 0;
+		}
+		i += span;
+	}
+	return 0;
+}
+
+static uint32_t take_run(file_system* fs, int goal, uint32_t want, int* start){
+	uint32_t num_blocks = fs->s_block->num_blocks;
+	if(num_blocks == 0 || want == 0) return 0;
+	if(fs->block_bitmap == NULL && alloc_init(fs) == -1) return 0;
+
+	// A replayed operation gets the same runs it got originally
+	uint32_t replayed = journal_replay_alloc_run(fs, want, start);
+	if(replayed > 0)
+	{
+		uint32_t claimed = 0;
+		while(claimed < replayed && *start + claimed < num_blocks && claim_block(fs, *start + claimed) == 0) claimed++;
+		if(claimed > 0) return claimed;
+	}
+
+	uint32_t cursor = search_start(fs);
+	int resynced = 0;
+	while(1)
+	{
+		uint32_t best_start = 0;
+		uint32_t best_len = 0;
+		if(goal >= 0 && goal < num_blocks && bit_is_free(fs, goal))
+		{
+			// Continue at the goal, no matter how long the run there is
+			best_start = goal;
+			while(best_len < want && best_start + best_len < num_blocks && bit_is_free(fs, best_start + best_len)) best_len++;
+		}
+		else if(!scan_runs(fs, cursor, num_blocks, want, &best_start, &best_len))
+		{
+			// Rescan from the front, so no run is cut at the cursor
+			scan_runs(fs, 0, num_blocks, want, &best_start, &best_len);
+		}
+
+		if(best_len == 0)
+		{
+			// Same as alloc_block, the free list may know about more free blocks
+			if(resynced || lockfree(fs) || alloc_init(fs) == -1) return 0;
+			resynced = 1;
+			continue;
+		}
+
+		// A stale bit or another thread ends the run early, if it is the first block search again
+		uint32_t claimed = claim_run(fs, best_start, best_len);
+		if(claimed > 0)
+		{
+			*start = best_start;
+			return claimed;
+		}
+		goal = -1;
+	}
+}
+
+uint32_t alloc_run(file_system* fs, int goal, uint32_t want, int* start){
+	if(lockfree(fs)) return take_run(fs, goal, want, start);
+	lock_alloc(fs);
+	uint32_t run_length = take_run(fs, goal, want, start);
+	unlock_alloc(fs);
+	return run_length;
+}
+
+/*
+ * lock-free: changes the references of a used block with a compare-and-swap.
+ * delta is 1 to add a reference, -1 to drop one
+ * @return the new free list byte, -1 if the block is free or has BLOCK_MAX_REFS references
+ */
+static int change_refs(file_system* fs, int block_num, int delta){
+	uint8_t* refs = &fs->free_list[block_num];
+	uint8_t old = __atomic_load_n(refs, __ATOMIC_RELAXED);
+	uint8_t new;
+	do
+	{
+		if(old == 1 || (delta > 0 && old == BLOCK_MAX_REFS)) return -1;
+		if(delta > 0) new = (old == 0) ? 2 : old + 1;
+		else new = (old == 0) ? 1 : (old == 2) ? 0 : old - 1;
+	}
+	while(!__atomic_compare_exchange_n(refs, &old, new, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	mark_free_list_dirty(fs, block_num);
+	return new;
+}
+
+int share_block(file_system* fs, int block_num){
+	if(lockfree(fs)) return (change_refs(fs, block_num, 1) == -1) ? -1 : 0;
+	lock_alloc(fs);
+	uint8_t* refs = &fs->free_list[block_num];
+	int ret = -1;
+	if(*refs != 1 && *refs != BLOCK_MAX_REFS)
+	{
+		*refs = (*refs == 0) ? 2 : *refs + 1;
+		mark_free_list_dirty(fs, block_num);
+		ret = 0;
+	}
+	unlock_alloc(fs);
+	return ret;
+}
+
+int block_is_shared(file_system* fs, int block_num){
+	if(lockfree(fs)) return __atomic_load_n(&fs->free_list[block_num], __ATOMIC_RELAXED) > 1;
+	lock_alloc(fs);
+	int shared = fs->free_list[block_num] > 1;
+	unlock_alloc(fs);
+	return shared;
+}
+
+static void drop_block(file_system* fs, int block_num){
+	if(fs->free_list[block_num] == 1) return;
+
+	// Another file still uses the block
+	if(fs->free_list[block_num] > 1)
+	{
+		fs->free_list[block_num] = (fs->free_list[block_num] == 2) ? 0 : fs->free_list[block_num] - 1;
+		mark_free_list_dirty(fs, block_num);
+		return;
+	}
+
+	fs->free_list[block_num] = 1;
+	fs->s_block->free_blocks++;
+	mark_free_list_dirty(fs, block_num);
+	mark_superblock_dirty(fs);
+	if(fs->block_bitmap != NULL) set_free_bit(fs, block_num);
+}
+
+void release_block(file_system* fs, int block_num){
+	if(block_num < 0 || block_num >= fs->s_block->num_blocks) return;
+	if(lockfree(fs))
+	{
+		// The free list byte is 1 before the bit is set, so whoever claims the bit sees it free
+		if(change_refs(fs, block_num, -1) == 1)
+		{
+			__atomic_fetch_add(&fs->s_block->free_blocks, 1, __ATOMIC_RELAXED);
+			mark_superblock_dirty(fs);
+			set_free_bit(fs, block_num);
+		}
+		return;
+	}
+	lock_alloc(fs);
+	drop_block(fs, block_num);
+	unlock_alloc(fs);
+}
+
+void alloc_cleanup(file_system* fs){
+	free(fs->block_bitmap);
+	fs->block_bitmap = NULL;
+	free(fs->alloc_hints);
+	fs->alloc_hints = NULL;
+	fs->alloc_hints_count = 0;
+}
@@ -0,0 +1,227 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/dcache.h"
+#include "../lib/dir.h"
+#include "../lib/lock.h"
+
+#define HASH_INIT 14695981039346656037ULL
+
+// FNV-1a
+static uint64_t hash_add(uint64_t hash, const void* data, size_t len){
+	const uint8_t* bytes = data;
+	for(size_t i = 0; i < len; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static uint32_t name_slot(dcache* cache, int parent, const char* name, size_t name_len){
+	uint64_t hash = hash_add(HASH_INIT, &parent, sizeof(parent));
+	hash = hash_add(hash, name, name_len);
+	return (hash ^ (hash >> 32)) & cache->mask;
+}
+
+static uint32_t path_slot(dcache* cache, const char* path, size_t len){
+	uint64_t hash = hash_add(HASH_INIT, path, len);
+	return (hash ^ (hash >> 32)) & cache->mask;
+}
+
+/*
+ * returns the cache of fs, builds it if there is none yet. NULL if there is no memory
+ */
+static dcache* get_cache(file_system* fs){
+	if(fs->dcache != NULL) return fs->dcache;
+
+	uint32_t num_inodes = fs->s_block->num_blocks;
+	uint32_t entries = DCACHE_MIN_ENTRIES;
+	while(entries < num_inodes && entries < DCACHE_MAX_ENTRIES) entries *= 2;
+
+	dcache* cache = calloc(1, sizeof(dcache));
+	if(cache == NULL) return NULL;
+	cache->mask = entries - 1;
+	cache->gens = calloc(num_inodes, sizeof(uint32_t));
+	cache->names = malloc(entries * sizeof(dcache_name_entry));
+	cache->paths = malloc(entries * sizeof(dcache_path_entry));
+	if(cache->gens == NULL || cache->names == NULL || cache->paths == NULL)
+	{
+		free(cache->gens);
+		free(cache->names);
+		free(cache->paths);
+		free(cache);
+		return NULL;
+	}
+	for(uint32_t i = 0; i < entries; i++)
+	{
+		cache->names[i].inode = -1;
+		cache->paths[i].inode = -1;
+	}
+
+	// Lookups look for the cache before they take the lock
+	__atomic_store_n(&fs->dcache, cache, __ATOMIC_RELEASE);
+	return cache;
+}
+
+/*
+ * the cache for a lookup, built under the exclusive lock if there is none yet.
+ * It is only freed by dcache_cleanup, so it can be used once the shared lock is taken
+ */
+static dcache* lookup_cache(file_system* fs){
+	dcache* cache = __atomic_load_n(&fs->dcache, __ATOMIC_ACQUIRE);
+	if(cache != NULL) return cache;
+	lock_dcache_write(fs);
+	cache = get_cache(fs);
+	unlock_dcache(fs);
+	return cache;
+}
+
+static void count_lookup(uint64_t* counter){
+	__atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * checks that an entry still describes the inode: it is in use, has not been released
+ * since the entry was made and still sits under parent
+ */
+static int entry_valid(file_system* fs, dcache* cache, int inode_num, uint32_t gen, int parent){
+	if(inode_num < 0 || inode_num >= fs->s_block->num_blocks) return 0;
+	inode* node = &fs->inodes[inode_num];
+	return cache->gens[inode_num] == gen && node->n_type != free_block && node->parent == parent;
+}
+
+/*
+ * compares an inode name to a name that isn't terminated
+ */
+static int name_equals(const char* inode_name, const char* name, size_t name_len){
+	return name_len < NAME_MAX_LENGTH && strncmp(inode_name, name, name_len) == 0 && inode_name[name_len] == '\0';
+}
+
+int dcache_lookup_name(file_system* fs, int parent, const char* name, size_t name_len){
+	dcache* cache = lookup_cache(fs);
+	lock_dcache_read(fs);
+	int child = -1;
+	if(cache != NULL)
+	{
+		dcache_name_entry* entry = &cache->names[name_slot(cache, parent, name, name_len)];
+		if(entry->parent == parent && fs->inodes[parent].n_type == directory
+			&& entry_valid(fs, cache, entry->inode, entry->gen, parent)
+			&& name_equals(fs->inodes[entry->inode].name, name, name_len))
+		{
+			count_lookup(&cache->stats.name_hits);
+			child = entry->inode;
+		}
+		else
+		{
+			count_lookup(&cache->stats.name_misses);
+		}
+	}
+	unlock_dcache(fs);
+	return child;
+}
+
+void dcache_add_name(file_system* fs, int parent, const char* name, size_t name_len, int child){
+	lock_dcache_write(fs);
+	dcache* cache = get_cache(fs);
+	if(cache != NULL)
+	{
+		dcache_name_entry* entry = &cache->names[name_slot(cache, parent, name, name_len)];
+		entry->parent = parent;
+		entry->inode = child;
+		entry->gen = cache->gens[child];
+	}
+	unlock_dcache(fs);
+}
+
+int dcache_lookup_path(file_system* fs, const char* path, size_t len){
+	dcache* cache = lookup_cache(fs);
+	lock_dcache_read(fs);
+	int inode_num = -1;
+	if(cache != NULL)
+	{
+		dcache_path_entry* entry = &cache->paths[path_slot(cache, path, len)];
+		if(entry->len == len && memcmp(entry->path, path, len) == 0
+			&& entry_valid(fs, cache, entry->inode, entry->gen, entry->parent))
+		{
+			// The generation only changes on release, so also make sure the inode still has the name
+			const char* name = entry->path + entry->name_offset;
+			if(name_equals(fs->inodes[entry->inode].name, name, strcspn(name, "/"))) inode_num = entry->inode;
+		}
+		count_lookup((inode_num != -1) ? &cache->stats.path_hits : &cache->stats.path_misses);
+	}
+	unlock_dcache(fs);
+	return inode_num;
+}
+
+void dcache_add_path(file_system* fs, const char* path, size_t len, int inode_num){
+	if(len >= DCACHE_PATH_MAX) return;
+
+	// Find the last component, ignoring trailing slashes
+	size_t end = len;
+	while(end > 0 && path[end - 1] == '/') end--;
+	if(end == 0) return;
+	size_t start = end;
+	while(start > 0 && path[start - 1] != '/') start--;
+
+	lock_dcache_write(fs);
+	dcache* cache = get_cache(fs);
+	if(cache == NULL)
+	{
+		unlock_dcache(fs);
+		return;
+	}
+	dcache_path_entry* entry = &cache->paths[path_slot(cache, path, len)];
+	memcpy(entry->path, path, len);
+	entry->path[len] = '\0';
+	entry->len = len;
+	entry->name_offset = start;
+	entry->inode = inode_num;
+	entry->parent = fs->inodes[inode_num].parent;
+	entry->gen = cache->gens[inode_num];
+	unlock_dcache(fs);
+}
+
+void dcache_invalidate(file_system* fs, int inode_num){
+	lock_dcache_write(fs);
+	if(fs->dcache != NULL) fs->dcache->gens[inode_num]++;
+	unlock_dcache(fs);
+}
+
+void dcache_invalidate_tree(file_system* fs, int inode_num){
+	if(fs->dcache == NULL) return;
+	dcache_invalidate(fs, inode_num);
+
+	inode* node = &fs->inodes[inode_num];
+	if(node->n_type != directory) return;
+	dir_iter iter;
+	dir_iter_init(&iter, inode_num);
+	int child;
+	while((child = dir_iter_next(fs, &iter)) != -1)
+	{
+		dcache_invalidate_tree(fs, child);
+	}
+}
+
+void dcache_get_stats(file_system* fs, dcache_stats* stats){
+	lock_dcache_read(fs);
+	if(fs->dcache == NULL) memset(stats, 0, sizeof(dcache_stats));
+	else
+	{
+		dcache_stats* counters = &fs->dcache->stats;
+		stats->path_hits = __atomic_load_n(&counters->path_hits, __ATOMIC_RELAXED);
+		stats->path_misses = __atomic_load_n(&counters->path_misses, __ATOMIC_RELAXED);
+		stats->name_hits = __atomic_load_n(&counters->name_hits, __ATOMIC_RELAXED);
+		stats->name_misses = __atomic_load_n(&counters->name_misses, __ATOMIC_RELAXED);
+	}
+	unlock_dcache(fs);
+}
+
+void dcache_cleanup(file_system* fs){
+	if(fs->dcache == NULL) return;
+	free(fs->dcache->gens);
+	free(fs->dcache->names);
+	free(fs->dcache->paths);
+	free(fs->dcache);
+	fs->dcache = NULL;
+}
@@ -0,0 +1,334 @@
+#include <stdint.h>
+#include <string.h>
+#include "../lib/dir.h"
+#include "../lib/alloc.h"
+
+// FNV-1a
+static uint32_t name_hash(const char* name, size_t name_len){
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < name_len; i++)
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int name_equals(const char* inode_name, const char* name, size_t name_len){
+	return name_len < NAME_MAX_LENGTH && strncmp(inode_name, name, name_len) == 0 && inode_name[name_len] == '\0';
+}
+
+static dir_header* header_of(file_system* fs, int index_block){
+	return (dir_header*)fs->data_blocks[index_block].block;
+}
+
+static int* leaves_of(file_system* fs, int index_block){
+	return (int*)(fs->data_blocks[index_block].block + sizeof(dir_header));
+}
+
+/*
+ * @return the block number of the table block number n of the table behind index_block
+ */
+static int table_block(file_system* fs, int index_block, uint32_t n){
+	int leaf = leaves_of(fs, index_block)[n / DIR_SLOTS_PER_BLOCK];
+	return ((int*)fs->data_blocks[leaf].block)[n % DIR_SLOTS_PER_BLOCK];
+}
+
+static int* slot_ptr(file_system* fs, int index_block, uint32_t slot){
+	int block = table_block(fs, index_block, slot / DIR_SLOTS_PER_BLOCK);
+	return (int*)fs->data_blocks[block].block + slot % DIR_SLOTS_PER_BLOCK;
+}
+
+static uint32_t leaf_count(uint32_t table_blocks){
+	return (table_blocks + DIR_SLOTS_PER_BLOCK - 1) / DIR_SLOTS_PER_BLOCK;
+}
+
+/*
+ * claims a block for the table and marks it as fully used
+ */
+static int claim_table_block(file_system* fs){
+	int block_num = alloc_block(fs);
+	if(block_num == -1) return -1;
+	fs->data_blocks[block_num].size = BLOCK_SIZE;
+	mark_data_block_dirty(fs, block_num);
+	return block_num;
+}
+
+/*
+ * gives the index, leaf and table blocks of a table back
+ */
+static void release_table(file_system* fs, int index_block){
+	uint32_t table_blocks = header_of(fs, index_block)->table_blocks;
+	for(uint32_t n = 0; n < table_blocks; n++)
+	{
+		release_block(fs, table_block(fs, index_block, n));
+	}
+	for(uint32_t leaf = 0; leaf < leaf_count(table_blocks); leaf++)
+	{
+		release_block(fs, leaves_of(fs, index_block)[leaf]);
+	}
+	release_block(fs, index_block);
+}
+
+/*
+ * builds an empty table with table_blocks blocks
+ * @return the index block or -1 if there are not enough free blocks
+ */
+static int build_table(file_system* fs, uint32_t table_blocks){
+	uint32_t leaves = leaf_count(table_blocks);
+	// Check first, so a failed build doesn't leave half a table behind
+	if(leaves > DIR_INDEX_LEAVES || free_block_count(fs) < 1 + leaves + table_blocks) return -1;
+
+	int index_block = claim_table_block(fs);
+	if(index_block == -1) return -1;
+	dir_header* header = header_of(fs, index_block);
+	header->entries = 0;
+	header->deleted = 0;
+	header->table_blocks = 0;
+
+	for(uint32_t leaf = 0; leaf < leaves; leaf++)
+	{
+		int leaf_block = claim_table_block(fs);
+		if(leaf_block == -1)
+		{
+			release_table(fs, index_block);
+			return -1;
+		}
+		leaves_of(fs, index_block)[leaf] = leaf_block;
+
+		uint32_t first = leaf * DIR_SLOTS_PER_BLOCK;
+		for(uint32_t n = first; n < MIN(table_blocks, first + DIR_SLOTS_PER_BLOCK); n++)
+		{
+			int block = claim_table_block(fs);
+			if(block == -1)
+			{
+				// release_table only finds leaves that hold a table block
+				if(n == first) release_block(fs, leaf_block);
+				release_table(fs, index_block);
+				return -1;
+			}
+			((int*)fs->data_blocks[leaf_block].block)[n % DIR_SLOTS_PER_BLOCK] = block;
+			header->table_blocks++;
+			memset(fs->data_blocks[block].block, 0xff, BLOCK_SIZE); //every slot DIR_EMPTY
+		}
+	}
+	return index_block;
+}
+
+/*
+ * puts child into a free slot of the table. The table must have room for it
+ */
+static void table_insert(file_system* fs, int index_block, int child){
+	dir_header* header = header_of(fs, index_block);
+	const char* name = fs->inodes[child].name;
+	uint32_t mask = header->table_blocks * DIR_SLOTS_PER_BLOCK - 1;
+
+	// The caller made sure the name is new, so the first free slot can be taken
+	for(uint32_t slot = name_hash(name, strnlen(name, NAME_MAX_LENGTH)) & mask;; slot = (slot + 1) & mask)
+	{
+		int* entry = slot_ptr(fs, index_block, slot);
+		if(*entry >= 0) continue;
+
+		if(*entry == DIR_DELETED) header->deleted--;
+		*entry = child;
+		header->entries++;
+		mark_data_block_dirty(fs, table_block(fs, index_block, slot / DIR_SLOTS_PER_BLOCK));
+		mark_data_block_dirty(fs, index_block);
+		return;
+	}
+}
+
+/*
+ * moves the children of dir into a new table with table_blocks blocks
+ * @return 0 on success, -1 if there are not enough free blocks
+ */
+static int rebuild(file_system* fs, int dir, uint32_t table_blocks){
+	int index_block = build_table(fs, table_blocks);
+	if(index_block == -1) return -1;
+
+	dir_iter iter;
+	dir_iter_init(&iter, dir);
+	int child;
+	while((child = dir_iter_next(fs, &iter)) != -1)
+	{
+		table_insert(fs, index_block, child);
+	}
+
+	dir_clear(fs, dir);
+	fs->inodes[dir].indirect_block = index_block;
+	return 0;
+}
+
+/*
+ * moves the children of a small table back into direct_blocks
+ */
+static void move_inline(file_system* fs, int dir){
+	int children[DIRECT_BLOCKS_COUNT];
+	int count = 0;
+	dir_iter iter;
+	dir_iter_init(&iter, dir);
+	int child;
+	while(count < DIRECT_BLOCKS_COUNT && (child = dir_iter_next(fs, &iter)) != -1)
+	{
+		children[count++] = child;
+	}
+
+	dir_clear(fs, dir);
+	memcpy(fs->inodes[dir].direct_blocks, children, count * sizeof(int));
+}
+
+int dir_lookup(file_system* fs, int dir, const char* name, size_t name_len){
+	inode* node = &fs->inodes[dir];
+	if(node->n_type != directory || name_len >= NAME_MAX_LENGTH) return -1;
+
+	if(node->indirect_block == -1)
+	{
+		for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+		{
+			int child = node->direct_blocks[i];
+			if(child != -1 && fs->inodes[child].n_type != free_block && name_equals(fs->inodes[child].name, name, name_len)) return child;
+		}
+		return -1;
+	}
+
+	uint32_t mask = header_of(fs, node->indirect_block)->table_blocks * DIR_SLOTS_PER_BLOCK - 1;
+	uint32_t slot = name_hash(name, name_len) & mask;
+	for(uint32_t probes = 0; probes <= mask; probes++, slot = (slot + 1) & mask)
+	{
+		int child = *slot_ptr(fs, node->indirect_block, slot);
+		if(child == DIR_EMPTY) return -1;
+		if(child >= 0 && fs->inodes[child].n_type != free_block && name_equals(fs->inodes[child].name, name, name_len)) return child;
+	}
+	return -1;
+}
+
+int dir_add(file_system* fs, int dir, int child){
+	inode* node = &fs->inodes[dir];
+
+	if(node->indirect_block == -1)
+	{
+		for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+		{
+			if(node->direct_blocks[i] != -1) continue;
+			node->direct_blocks[i] = child;
+			mark_inode_dirty(fs, dir);
+			return 0;
+		}
+		// The inline slots are full, switch to the smallest table
+		if(rebuild(fs, dir, 1) == -1) return -1;
+	}
+	else
+	{
+		dir_header* header = header_of(fs, node->indirect_block);
+		uint32_t slots = header->table_blocks * DIR_SLOTS_PER_BLOCK;
+		if((header->entries + header->deleted + 1) * 4 > slots * 3)
+		{
+			// Only grow if the children need the room, else getting rid of the deleted slots is enough
+			uint32_t table_blocks = header->table_blocks;
+			if((header->entries + 1) * 2 > slots) table_blocks *= 2;
+			if(rebuild(fs, dir, table_blocks) == -1) return -1;
+		}
+	}
+
+	table_insert(fs, node->indirect_block, child);
+	mark_inode_dirty(fs, dir);
+	return 0;
+}
+
+int dir_remove(file_system* fs, int dir, int child){
+	inode* node = &fs->inodes[dir];
+
+	if(node->indirect_block == -1)
+	{
+		for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+		{
+			if(node->direct_blocks[i] != child) continue;
+			node->direct_blocks[i] = -1;
+			mark_inode_dirty(fs, dir);
+			return 0;
+		}
+		return -1;
+	}
+
+	dir_header* header = header_of(fs, node->indirect_block);
+	uint32_t mask = header->table_blocks * DIR_SLOTS_PER_BLOCK - 1;
+	const char* name = fs->inodes[child].name;
+	uint32_t slot = name_hash(name, strnlen(name, NAME_MAX_LENGTH)) & mask;
+	for(uint32_t probes = 0; probes <= mask; probes++, slot = (slot + 1) & mask)
+	{
+		int* entry = slot_ptr(fs, node->indirect_block, slot);
+		if(*entry == DIR_EMPTY) return -1;
+		if(*entry != child) continue;
+
+		*entry = DIR_DELETED;
+		header->entries--;
+		header->deleted++;
+		mark_data_block_dirty(fs, table_block(fs, node->indirect_block, slot / DIR_SLOTS_PER_BLOCK));
+		mark_data_block_dirty(fs, node->indirect_block);
+		if(header->entries <= DIR_INLINE_MIN) move_inline(fs, dir);
+		return 0;
+	}
+	return -1;
+}
+
+void dir_clear(file_system* fs, int dir){
+	inode* node = &fs->inodes[dir];
+	if(node->indirect_block != -1) release_table(fs, node->indirect_block);
+	node->indirect_block = -1;
+	for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+	{
+		node->direct_blocks[i] = -1;
+	}
+	mark_inode_dirty(fs, dir);
+}
+
+uint32_t dir_count(file_system* fs, int dir){
+	inode* node = &fs->inodes[dir];
+	if(node->indirect_block != -1) return header_of(fs, node->indirect_block)->entries;
+
+	uint32_t count = 0;
+	for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+	{
+		if(node->direct_blocks[i] != -1) count++;
+	}
+	return count;
+}
+
+uint32_t dir_block_count(file_system* fs, int dir){
+	inode* node = &fs->inodes[dir];
+	if(node->indirect_block == -1) return 0;
+	uint32_t table_blocks = header_of(fs, node->indirect_block)->table_blocks;
+	return 1 + leaf_count(table_blocks) + table_blocks;
+}
+
+void dir_iter_init(dir_iter* iter, int dir){
+	iter->dir = dir;
+	iter->pos = 0;
+}
+
+int dir_iter_next(file_system* fs, dir_iter* iter){
+	inode* node = &fs->inodes[iter->dir];
+
+	if(node->indirect_block == -1)
+	{
+		while(iter->pos < DIRECT_BLOCKS_COUNT)
+		{
+			int child = node->direct_blocks[iter->pos++];
+			if(child != -1) return child;
+		}
+		return -1;
+	}
+
+	uint32_t slots = header_of(fs, node->indirect_block)->table_blocks * DIR_SLOTS_PER_BLOCK;
+	while(iter->pos < slots)
+	{
+		// Look up the table block once and scan it
+		int* table = (int*)fs->data_blocks[table_block(fs, node->indirect_block, iter->pos / DIR_SLOTS_PER_BLOCK)].block;
+		for(uint32_t i = iter->pos % DIR_SLOTS_PER_BLOCK; i < DIR_SLOTS_PER_BLOCK; i++)
+		{
+			iter->pos++;
+			if(table[i] >= 0) return table[i];
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,286 @@
+#include <stdint.h>
+#include <string.h>
+#include "../lib/extent.h"
+#include "../lib/alloc.h"
+
+static extent_node* node_of(file_system* fs, int block_num){
+	return (extent_node*)fs->data_blocks[block_num].block;
+}
+
+static extent* extents_of(extent_node* node){
+	return (extent*)(node + 1);
+}
+
+static extent_index* indexes_of(extent_node* node){
+	return (extent_index*)(node + 1);
+}
+
+/*
+ * claims a block for an empty node of the tree
+ */
+static int claim_node(file_system* fs, uint16_t depth){
+	int block_num = alloc_block(fs);
+	if(block_num == -1) return -1;
+	fs->data_blocks[block_num].size = BLOCK_SIZE;
+	extent_node* node = node_of(fs, block_num);
+	node->depth = depth;
+	node->count = 0;
+	mark_data_block_dirty(fs, block_num);
+	return block_num;
+}
+
+/*
+ * @return the extent holding block logical or NULL
+ */
+static extent* find_extent(file_system* fs, int node_block, uint32_t logical){
+	while(1)
+	{
+		extent_node* node = node_of(fs, node_block);
+		if(node->count == 0) return NULL;
+
+		// Binary search for the last entry starting at or before logical. Both kinds of entries start with it
+		uint32_t entry_size = (node->depth == 0) ? sizeof(extent) : sizeof(extent_index);
+		uint8_t* entries = (uint8_t*)(node + 1);
+		uint32_t lo = 0, hi = node->count;
+		while(hi - lo > 1)
+		{
+			uint32_t mid = (lo + hi) / 2;
+			if(*(uint32_t*)(entries + mid * entry_size) <= logical) lo = mid;
+			else hi = mid;
+		}
+
+		if(node->depth == 0)
+		{
+			extent* e = &extents_of(node)[lo];
+			return (logical >= e->logical && logical - e->logical < e->len) ? e : NULL;
+		}
+		node_block = indexes_of(node)[lo].child;
+	}
+}
+
+/*
+ * builds a path of new nodes down to a leaf holding a single extent
+ * @return the top node or -1 if there are not enough free blocks
+ */
+static int new_branch(file_system* fs, uint16_t depth, uint32_t logical, int block_num, uint32_t len){
+	int node_block = claim_node(fs, depth);
+	if(node_block == -1) return -1;
+	extent_node* node = node_of(fs, node_block);
+
+	if(depth == 0)
+	{
+		extents_of(node)[0] = (extent){logical, block_num, len};
+	}
+	else
+	{
+		int child = new_branch(fs, depth - 1, logical, block_num, len);
+		if(child == -1)
+		{
+			release_block(fs, node_block);
+			return -1;
+		}
+		indexes_of(node)[0] = (extent_index){logical, child};
+	}
+	node->count = 1;
+	return node_block;
+}
+
+/*
+ * appends a run to the rightmost leaf below node_block
+ * @return 0 on success, 1 if the subtree is full, -1 if there are not enough free blocks
+ */
+static int node_append(file_system* fs, int node_block, uint32_t logical, int block_num, uint32_t len){
+	extent_node* node = node_of(fs, node_block);
+
+	if(node->depth == 0)
+	{
+		// Extend the last run if the blocks continue it
+		extent* last = (node->count > 0) ? &extents_of(node)[node->count - 1] : NULL;
+		if(last != NULL && last->logical + last->len == logical && last->start + last->len == block_num && last->len <= UINT32_MAX - len)
+		{
+			last->len += len;
+		}
+		else
+		{
+			if(node->count == EXTENTS_PER_NODE) return 1;
+			extents_of(node)[node->count++] = (extent){logical, block_num, len};
+		}
+		mark_data_block_dirty(fs, node_block);
+		return 0;
+	}
+
+	int ret = node_append(fs, indexes_of(node)[node->count - 1].child, logical, block_num, len);
+	if(ret != 1) return ret;
+
+	// The rightmost child is full, start a new one next to it
+	if(node->count == EXTENT_INDEXES_PER_NODE) return 1;
+	int child = new_branch(fs, node->depth - 1, logical, block_num, len);
+	if(child == -1) return -1;
+	indexes_of(node)[node->count++] = (extent_index){logical, child};
+	mark_data_block_dirty(fs, node_block);
+	return 0;
+}
+
+int extent_get_block(file_system* fs, int file, uint32_t logical){
+	inode* node = &fs->inodes[file];
+	if(logical < DIRECT_BLOCKS_COUNT) return node->direct_blocks[logical];
+	if(node->indirect_block == -1) return -1;
+
+	extent* e = find_extent(fs, node->indirect_block, logical);
+	return (e != NULL) ? e->start + (logical - e->logical) : -1;
+}
+
+uint32_t extent_get_run(file_system* fs, int file, uint32_t logical, int* start){
+	inode* node = &fs->inodes[file];
+	if(logical < DIRECT_BLOCKS_COUNT)
+	{
+		*start = node->direct_blocks[logical];
+		if(*start == -1) return 0;
+		uint32_t len = 1;
+		while(logical + len < DIRECT_BLOCKS_COUNT && node->direct_blocks[logical + len] == *start + len) len++;
+		return len;
+	}
+	if(node->indirect_block == -1) return 0;
+
+	extent* e = find_extent(fs, node->indirect_block, logical);
+	if(e == NULL) return 0;
+	*start = e->start + (logical - e->logical);
+	return e->len - (logical - e->logical);
+}
+
+uint32_t extent_count_runs(file_system* fs, int file){
+	uint32_t runs = 0;
+	uint32_t logical = 0;
+	uint32_t run_length;
+	int start;
+	int next = -1;
+	while((run_length = extent_get_run(fs, file, logical, &start)) > 0)
+	{
+		// Runs only end in the block map where the direct blocks end, count those once
+		if(start != next) runs++;
+		next = start + run_length;
+		logical += run_length;
+	}
+	return runs;
+}
+
+int extent_add_run(file_system* fs, int file, uint32_t logical, int start, uint32_t len){
+	inode* node = &fs->inodes[file];
+	mark_inode_dirty(fs, file);
+	for(; len > 0 && logical < DIRECT_BLOCKS_COUNT; logical++, start++, len--)
+	{
+		node->direct_blocks[logical] = start;
+	}
+	if(len == 0) return 0;
+
+	if(node->indirect_block == -1)
+	{
+		node->indirect_block = new_branch(fs, 0, logical, start, len);
+		return (node->indirect_block != -1) ? 0 : -1;
+	}
+
+	int ret = node_append(fs, node->indirect_block, logical, start, len);
+	if(ret != 1) return ret;
+
+	// The whole tree is full. Move the root down, so the root block and the inode stay the same
+	int moved = claim_node(fs, 0);
+	if(moved == -1) return -1;
+	memcpy(fs->data_blocks[moved].block, fs->data_blocks[node->indirect_block].block, BLOCK_SIZE);
+
+	extent_node* root = node_of(fs, node->indirect_block);
+	uint32_t first = extents_of(root)[0].logical; //same position for both kinds of entries
+	root->depth++;
+	root->count = 1;
+	indexes_of(root)[0] = (extent_index){first, moved};
+	mark_data_block_dirty(fs, node->indirect_block);
+
+	ret = node_append(fs, node->indirect_block, logical, start, len);
+	return (ret == 0) ? 0 : -1;
+}
+
+int extent_add_block(file_system* fs, int file, uint32_t logical, int block_num){
+	return extent_add_run(fs, file, logical, block_num, 1);
+}
+
+/*
+ * gives the nodes below node_block back to the allocator, the data blocks as well if with_data is set
+ */
+static void release_node(file_system* fs, int node_block, int with_data){
+	extent_node* node = node_of(fs, node_block);
+	for(uint32_t i = 0; i < node->count; i++)
+	{
+		if(node->depth == 0)
+		{
+			extent* e = &extents_of(node)[i];
+			for(uint32_t n = 0; with_data && n < e->len; n++)
+			{
+				release_block(fs, e->start + n);
+			}
+		}
+		else
+		{
+			release_node(fs, indexes_of(node)[i].child, with_data);
+		}
+	}
+	release_block(fs, node_block);
+}
+
+int extent_remap(file_system* fs, int file, uint32_t logical, uint32_t count, int start){
+	inode* node = &fs->inodes[file];
+	uint32_t direct = (logical < DIRECT_BLOCKS_COUNT) ? MIN(count, DIRECT_BLOCKS_COUNT - logical) : 0;
+	if(count > direct)
+	{
+		if(node->indirect_block == -1) return -1;
+		uint32_t tree_logical = logical + direct;
+		uint32_t tree_count = count - direct;
+		int tree_start = start + direct;
+
+		// Extents can't be split in place, so the tree is built again with the new blocks in the range
+		int old_root = node->indirect_block;
+		node->indirect_block = -1;
+		uint32_t pos = DIRECT_BLOCKS_COUNT;
+		extent* e;
+		int ret = 0;
+		while(ret == 0 && (e = find_extent(fs, old_root, pos)) != NULL)
+		{
+			int run_start = e->start + (pos - e->logical);
+			uint32_t run_len = e->len - (pos - e->logical);
+			if(pos < tree_logical)
+			{
+				run_len = MIN(run_len, tree_logical - pos);
+			}
+			else if(pos - tree_logical < tree_count)
+			{
+				run_start = tree_start + (pos - tree_logical);
+				run_len = MIN(run_len, tree_count - (pos - tree_logical));
+			}
+			ret = extent_add_run(fs, file, pos, run_start, run_len);
+			pos += run_len;
+		}
+
+		// Keep the old tree if there were not enough blocks for the new one
+		int dropped = (ret == 0) ? old_root : node->indirect_block;
+		if(ret != 0) node->indirect_block = old_root;
+		if(dropped != -1) release_node(fs, dropped, 0);
+		if(ret != 0) return -1;
+	}
+
+	for(uint32_t i = 0; i < direct; i++)
+	{
+		node->direct_blocks[logical + i] = start + i;
+	}
+	mark_inode_dirty(fs, file);
+	return 0;
+}
+
+void extent_release(file_system* fs, int file){
+	inode* node = &fs->inodes[file];
+	for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+	{
+		if(node->direct_blocks[i] != -1) release_block(fs, node->direct_blocks[i]);
+		node->direct_blocks[i] = -1;
+	}
+	if(node->indirect_block != -1) release_node(fs, node->indirect_block, 1);
+	node->indirect_block = -1;
+	mark_inode_dirty(fs, file);
+}
@@ -2,14 +2,158 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "../lib/filesystem.h"
+#include "../lib/alloc.h"
+#include "../lib/io.h"
+#include "../lib/journal.h"
+#include "../lib/dcache.h"
+#include "../lib/lock.h"
 #include "../lib/utils.h"
 #include <errno.h>
 
+static size_t align_up(size_t offset, size_t alignment){
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * offsets of the regions inside the image: superblock, free list, inodes and data blocks.
+ * The free list is padded, so the inodes and data blocks behind it are aligned for
+ * their types and fs_mount can use them in place
+ */
+static size_t free_list_offset(uint32_t num_blocks){
+	return sizeof(superblock);
+}
+
+static size_t inodes_offset(uint32_t num_blocks){
+	return align_up(free_list_offset(num_blocks) + num_blocks * sizeof(uint8_t), _Alignof(inode));
+}
+
+//the data blocks follow the inodes without a gap
+_Static_assert(sizeof(inode) % _Alignof(data_block) == 0, "data blocks behind the inodes would be misaligned");
+
+static size_t data_blocks_offset(uint32_t num_blocks){
+	return inodes_offset(num_blocks) + (size_t)num_blocks * sizeof(inode);
+}
+
+/*
+ * bytes of the free list including its padding, what the free list is allocated with
+ */
+static size_t free_list_size(uint32_t num_blocks){
+	return inodes_offset(num_blocks) - free_list_offset(num_blocks);
+}
+
+static size_t image_size(uint32_t num_blocks){
+	return data_blocks_offset(num_blocks) + (size_t)num_blocks * sizeof(data_block);
+}
+
+/*
+ * inode of the first layout, the images fs_upgrade converts
+ */
+typedef struct _legacy_inode {
+	enum node_type n_type;
+	uint16_t size;
+	char name[NAME_MAX_LENGTH];
+	int direct_blocks[DIRECT_BLOCKS_COUNT];
+	int parent;
+} legacy_inode;
+
+/*
+ * the first layout: two counters, free list, inodes and data blocks back to back
+ */
+#define LEGACY_SUPERBLOCK_SIZE (2 * sizeof(uint32_t))
+
+static size_t legacy_image_size(uint32_t num_blocks){
+	return LEGACY_SUPERBLOCK_SIZE + (size_t)num_blocks * (sizeof(uint8_t) + sizeof(legacy_inode) + sizeof(data_block));
+}
+
+/*
+ * reads the superblock of the image open as fd and checks that the image has FS_VERSION and
+ * consists of exactly the regions the superblock announces. Says what is wrong on stderr
+ * returns the length of the image, 0 if it can't be used
+ */
+static size_t read_superblock(int fd, const char* path, superblock* s_block){
+	struct stat st;
+	memset(s_block, 0, sizeof(superblock));
+	if(fstat(fd, &st) == -1 || pread(fd, s_block, sizeof(superblock), 0) == -1){
+		fprintf(stderr, "%s: can't be read\n", path);
+		return 0;
+	}
+
+	if(st.st_size >= sizeof(superblock) && s_block->magic == FS_MAGIC){
+		if(s_block->version != FS_VERSION){
+			fprintf(stderr, "%s: image version %u, this build reads version %d\n", path, s_block->version, FS_VERSION);
+			return 0;
+		}
+		if(s_block->num_blocks == 0 || image_size(s_block->num_blocks) != st.st_size){
+			fprintf(stderr, "%s: image is truncated or damaged\n", path);
+			return 0;
+		}
+		return st.st_size;
+	}
+
+	if(s_block->num_blocks != 0 && legacy_image_size(s_block->num_blocks) == st.st_size){
+		fprintf(stderr, "%s: image of the first layout, convert it with ha2 --upgrade %s\n", path, path);
+	}
+	else{
+		fprintf(stderr, "%s: not a file system image\n", path);
+	}
+	return 0;
+}
+
+static size_t dirty_page_count(file_system* fs){
+	return (image_size(fs->s_block->num_blocks) + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+}
+
+/*
+ * sets every field that only exists in memory to its default.
+ * The superblock has to be in place already
+ */
+static void init_runtime_fields(file_system* fs){
+	fs->mapping = NULL;
+	fs->mapping_size = 0;
+	fs->image_fd = -1;
+	fs->block_bitmap = NULL;
+	fs->alloc_cursor = 0;
+	fs->free_inodes = NULL;
+	fs->free_inodes_count = 0;
+	fs->alloc_hints = NULL;
+	fs->alloc_hints_count = 0;
+	//without a dirty map every checkpoint falls back to a full dump
+	fs->dirty_pages = calloc((dirty_page_count(fs) + 63) / 64, sizeof(uint64_t));
+	fs->journal = NULL;
+	fs->dcache = NULL;
+	fs->locks = NULL;
+}
+
+static int find_root_node(file_system* fs){
+	//the root is usually the first inode, so check that before scanning
+	if(fs->inodes[0].n_type==directory && strncmp(fs->inodes[0].name,"/",NAME_MAX_LENGTH)==0){
+		return 0;
+	}
+	for (int i = 1; i<fs->s_block->num_blocks; i++) {
+		if(fs->inodes[i].n_type==directory && strncmp(fs->inodes[i].name,"/",NAME_MAX_LENGTH)==0){
+			return i;
+		}
+	}
+	return 0;
+}
+
+static int image_iov(file_system* fs, size_t start, size_t end, struct iovec iov[4]);
+
 file_system* fs_load(const char* fs_file_path){
+	//finish a checkpoint that was interrupted while writing the image
+	if(journal_recover(fs_file_path) == -1){
+		exit(1);
+	}
+
 	//open file
-	FILE* fs_file = fopen(fs_file_path,"r");
-	if(fs_file == NULL){
+	int fd = open(fs_file_path, O_RDONLY);
+	if(fd == -1){
 		exit(1);
 	}
 	file_system* new_fs = malloc(sizeof(file_system));
@@ -17,35 +161,102 @@ file_system* fs_load(const char* fs_file_path){
 	new_fs->s_block = malloc(sizeof(superblock));
 
 	//read size from superblock
-	fread(new_fs->s_block, sizeof(superblock), 1, fs_file);
-
-	//allocate memory for the free list and load the free list from file
-	new_fs->free_list = malloc(new_fs->s_block->num_blocks);
-	fread(new_fs->free_list,sizeof(uint8_t), new_fs->s_block->num_blocks, fs_file);
+	if(read_superblock(fd, fs_file_path, new_fs->s_block) == 0){
+		free(new_fs->s_block);
+		free(new_fs);
+		close(fd);
+		return NULL;
+	}
 
-	//allocate memory for the inodes and read them from file
+	//allocate memory for the free list, the inodes and the data blocks
+	new_fs->free_list = malloc(free_list_size(new_fs->s_block->num_blocks));
 	new_fs->inodes = malloc(sizeof(inode) * new_fs->s_block->num_blocks);
-	fread(new_fs->inodes,sizeof(inode), new_fs->s_block->num_blocks, fs_file);
-
-	//allocate memory for the data blocks and read them from file
 	new_fs->data_blocks = malloc(sizeof(data_block)* new_fs->s_block->num_blocks);
-	fread(new_fs->data_blocks,sizeof(data_block), new_fs->s_block->num_blocks, fs_file);
 
-	//find root node
-	for (int i = 0; i<new_fs->s_block->num_blocks; i++) {
-		if(new_fs->inodes[i].n_type==directory && strncmp(new_fs->inodes[i].name,"/",NAME_MAX_LENGTH)==0){
-			new_fs->root_node = i;
-			break;
-		}
+	//read them from file in many requests at once
+	struct iovec iov[4];
+	io_batch batch;
+	io_batch_init(&batch, fd, 0);
+	int cnt = image_iov(new_fs, sizeof(superblock), image_size(new_fs->s_block->num_blocks), iov);
+	io_batch_add(&batch, iov, cnt, sizeof(superblock));
+	if(io_batch_run(&batch) == -1){
+		exit(1);
 	}
+
+	new_fs->root_node = find_root_node(new_fs);
+	init_runtime_fields(new_fs);
+	//keep the image open, checkpoints write their changes back into it
+	new_fs->image_fd = open(fs_file_path, O_RDWR);
+	close(fd);
+
+	journal_replay(new_fs, fs_file_path);
 	
 	LOG("Loaded filesystem from file\n");
 
-	fclose(fs_file);
 	return new_fs;
 }
 
-file_system* fs_create(const char* fs_file_path, uint32_t size){
+file_system* fs_mount(const char* fs_file_path){
+	if(journal_recover(fs_file_path) == -1){
+		return NULL;
+	}
+
+	int fd = open(fs_file_path, O_RDWR);
+	if(fd == -1){
+		return NULL;
+	}
+
+	superblock header;
+	size_t image_len = read_superblock(fd, fs_file_path, &header);
+	if(image_len == 0){
+		close(fd);
+		return NULL;
+	}
+
+	uint8_t* mapping = mmap(NULL, image_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mapping == MAP_FAILED){
+		close(fd);
+		return NULL;
+	}
+
+	file_system* new_fs = malloc(sizeof(file_system));
+	if(new_fs == NULL){
+		munmap(mapping, image_len);
+		close(fd);
+		return NULL;
+	}
+
+	superblock* s_block = (superblock*)mapping;
+
+	uint32_t size = s_block->num_blocks;
+	new_fs->s_block = s_block;
+	new_fs->free_list = mapping + free_list_offset(size);
+	new_fs->inodes = (inode*)(mapping + inodes_offset(size));
+	new_fs->data_blocks = (data_block*)(mapping + data_blocks_offset(size));
+	init_runtime_fields(new_fs);
+	new_fs->mapping = mapping;
+	new_fs->mapping_size = image_len;
+	new_fs->image_fd = fd;
+	new_fs->root_node = find_root_node(new_fs);
+
+	//the replay changes the image itself, so its records must not be applied a second time
+	if(journal_replay(new_fs, fs_file_path) > 0){
+		if(msync(mapping, image_len, MS_SYNC) == -1){
+			cleanup(new_fs);
+			return NULL;
+		}
+		journal_restart(new_fs, fs_file_path);
+	}
+
+	LOG("Mounted filesystem from file\n");
+
+	return new_fs;
+}
+
+/*
+ * builds an empty file system of size blocks in memory
+ */
+static file_system* fs_new(uint32_t size){
 	file_system* new_fs = malloc(sizeof(file_system));
 	if(new_fs == NULL){
 		perror("Malloc error");
@@ -60,9 +271,11 @@ file_system* fs_create(const char* fs_file_path, uint32_t size){
 	}
 	new_fs->s_block->num_blocks = size;
 	new_fs->s_block->free_blocks = size;
+	new_fs->s_block->magic = FS_MAGIC;
+	new_fs->s_block->version = FS_VERSION;
 	
 	// Create free list and set every entry to 1 (meaning that block is free);
-	new_fs->free_list = malloc(size);
+	new_fs->free_list = calloc(free_list_size(size), sizeof(uint8_t));
 	if (new_fs->free_list == NULL) {
 		perror("Malloc error");
 		exit(errno);
@@ -90,6 +303,7 @@ file_system* fs_create(const char* fs_file_path, uint32_t size){
 	new_fs->inodes[0].n_type = directory;
 	strncpy(new_fs->inodes[0].name,"/",NAME_MAX_LENGTH);
 	new_fs->root_node = 0;
+	init_runtime_fields(new_fs);
 
 	
 	new_fs->data_blocks = calloc(size,sizeof(data_block));
@@ -97,7 +311,12 @@ file_system* fs_create(const char* fs_file_path, uint32_t size){
 		perror("Calloc error");
 		exit(errno);
 	}	
-	
+
+	return new_fs;
+}
+
+file_system* fs_create(const char* fs_file_path, uint32_t size){
+	file_system* new_fs = fs_new(size);
 
 	//write the components to file
 	fs_dump(new_fs, fs_file_path);
@@ -107,47 +326,467 @@ file_system* fs_create(const char* fs_file_path, uint32_t size){
 
 }
 
-void inode_init(inode *i){
-	i->n_type=free_block;
+int fs_upgrade(const char* fs_file_path){
+	int fd = open(fs_file_path, O_RDONLY);
+	if(fd == -1){
+		perror(fs_file_path);
+		return -1;
+	}
+
+	struct stat st;
+	uint32_t counters[2];
+	if(fstat(fd, &st) == -1 || pread(fd, counters, sizeof(counters), 0) != sizeof(counters)){
+		fprintf(stderr, "%s: not a file system image\n", fs_file_path);
+		close(fd);
+		return -1;
+	}
+
+	superblock header;
+	if(st.st_size >= sizeof(superblock) && pread(fd, &header, sizeof(superblock), 0) == sizeof(superblock)
+			&& header.magic == FS_MAGIC && header.version == FS_VERSION){
+		close(fd);
+		return 0;
+	}
+	uint32_t size = counters[0];
+	if(size == 0 || legacy_image_size(size) != st.st_size){
+		fprintf(stderr, "%s: not an image of the first layout\n", fs_file_path);
+		close(fd);
+		return -1;
+	}
+
+	uint8_t* image = malloc(st.st_size);
+	if(image == NULL || pread(fd, image, st.st_size, 0) != st.st_size){
+		fprintf(stderr, "%s: can't be read\n", fs_file_path);
+		free(image);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	file_system* fs = fs_new(size);
+	uint8_t* legacy_free_list = image + LEGACY_SUPERBLOCK_SIZE;
+	uint8_t* legacy_inodes = legacy_free_list + size;
+	uint8_t* legacy_data_blocks = legacy_inodes + (size_t)size * sizeof(legacy_inode);
+
+	fs->s_block->free_blocks = counters[1];
+	memcpy(fs->free_list, legacy_free_list, size);
+	for(uint32_t i = 0; i < size; i++){
+		//the legacy inodes aren't aligned inside the image
+		legacy_inode old;
+		memcpy(&old, legacy_inodes + (size_t)i * sizeof(legacy_inode), sizeof(legacy_inode));
+		inode* new = &fs->inodes[i];
+		inode_init(new);
+		new->n_type = old.n_type;
+		new->size = old.size;
+		memcpy(new->name, old.name, NAME_MAX_LENGTH);
+		memcpy(new->direct_blocks, old.direct_blocks, sizeof(old.direct_blocks));
+		new->parent = old.parent;
+	}
+	memcpy(fs->data_blocks, legacy_data_blocks, (size_t)size * sizeof(data_block));
+	free(image);
+	fs->root_node = find_root_node(fs);
+
+	//the dump replaces the image in one rename, a crash leaves the old one behind
+	int ret = fs_dump(fs, fs_file_path);
+	cleanup(fs);
+	return ret == 0 ? 0 : -1;
+}
+
+/*
+ * resets everything but the type
+ */
+static void clear_inode(inode *i){
 	i->size=0;
 	memset(i->name,0,NAME_MAX_LENGTH);
 	for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
 		i->direct_blocks[j] = -1;
 	}
+	i->indirect_block = -1;
 	i->parent = -1; //meaning it has no parent
 }
 
+void inode_init(inode *i){
+	i->n_type=free_block;
+	clear_inode(i);
+}
+
 
-int fs_dump(file_system *fs, const char *file_path){
+/*
+ * checks if file_path refers to the image fs was loaded from, mounted from or last dumped to
+ */
+static int is_image_file(file_system* fs, const char* file_path){
+	if(fs->image_fd == -1){
+		return 0;
+	}
+	struct stat image_st, path_st;
+	if(fstat(fs->image_fd, &image_st) == -1 || stat(file_path, &path_st) == -1){
+		return 0;
+	}
+	return image_st.st_dev == path_st.st_dev && image_st.st_ino == path_st.st_ino;
+}
+
+static void mark_dirty(file_system* fs, size_t offset, size_t len){
+	if(fs->dirty_pages == NULL || len == 0){
+		return;
+	}
+	size_t first = offset / DIRTY_PAGE_SIZE;
+	size_t last = (offset + len - 1) / DIRTY_PAGE_SIZE;
+	for (size_t page = first; page <= last; page++) {
+		//threads may mark pages sharing a word at the same time
+		__atomic_fetch_or(&fs->dirty_pages[page / 64], 1ULL << (page % 64), __ATOMIC_RELAXED);
+	}
+}
+
+static void clear_dirty(file_system* fs){
+	if(fs->dirty_pages != NULL){
+		memset(fs->dirty_pages, 0, (dirty_page_count(fs) + 63) / 64 * sizeof(uint64_t));
+	}
+}
+
+static int is_dirty(file_system* fs, size_t page){
+	return (fs->dirty_pages[page / 64] >> (page % 64)) & 1;
+}
+
+void mark_superblock_dirty(file_system* fs){
+	mark_dirty(fs, 0, sizeof(superblock));
+}
+
+void mark_free_list_dirty(file_system* fs, int block_num){
+	mark_dirty(fs, free_list_offset(fs->s_block->num_blocks) + block_num, sizeof(uint8_t));
+}
+
+void mark_inode_dirty(file_system* fs, int num){
+	mark_dirty(fs, inodes_offset(fs->s_block->num_blocks) + (size_t)num * sizeof(inode), sizeof(inode));
+}
+
+void mark_data_block_dirty(file_system* fs, int block_num){
+	mark_dirty(fs, data_blocks_offset(fs->s_block->num_blocks) + (size_t)block_num * sizeof(data_block), sizeof(data_block));
+}
+
+/*
+ * points iov at the bytes [start, end) of the image. The range may span several regions,
+ * so up to 4 iovecs are needed
+ * @return the number of iovecs used
+ */
+static int image_iov(file_system* fs, size_t start, size_t end, struct iovec iov[4]){
+	uint32_t size = fs->s_block->num_blocks;
+	struct {
+		size_t offset;
+		size_t len;
+		void* mem;
+	} regions[] = {
+		{0, sizeof(superblock), fs->s_block},
+		{free_list_offset(size), free_list_size(size), fs->free_list},
+		{inodes_offset(size), size * sizeof(inode), fs->inodes},
+		{data_blocks_offset(size), size * sizeof(data_block), fs->data_blocks},
+	};
+
+	int cnt = 0;
+	for (int i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+		size_t lo = MAX(start, regions[i].offset);
+		size_t hi = MIN(end, regions[i].offset + regions[i].len);
+		if(lo < hi){
+			iov[cnt].iov_base = (uint8_t*)regions[i].mem + (lo - regions[i].offset);
+			iov[cnt].iov_len = hi - lo;
+			cnt++;
+		}
+	}
+	return cnt;
+}
+
+/*
+ * finds the next run of dirty pages at or after *page and returns its byte range in the image
+ * @return 1 if a run was found, 0 else
+ */
+static int next_dirty_range(file_system* fs, size_t* page, size_t* start, size_t* end){
+	size_t pages = dirty_page_count(fs);
+	while(*page < pages){
+		//skip clean pages a word at a time
+		if(*page % 64 == 0 && fs->dirty_pages[*page / 64] == 0){
+			*page += 64;
+			continue;
+		}
+		if(!is_dirty(fs, *page)){
+			(*page)++;
+			continue;
+		}
+
+		//merge consecutive dirty pages into one write
+		size_t first = *page;
+		while(*page < pages && is_dirty(fs, *page)){
+			(*page)++;
+		}
+		*start = first * DIRTY_PAGE_SIZE;
+		*end = MIN(*page * DIRTY_PAGE_SIZE, image_size(fs->s_block->num_blocks));
+		return 1;
+	}
+	return 0;
+}
+
+static int dump(file_system* fs, const char* file_path);
+
+static long checkpoint(file_system* fs, const char* file_path){
+	size_t total = image_size(fs->s_block->num_blocks);
+
+	//without a base image or dirty map there is nothing to compare against
+	if(fs->dirty_pages == NULL || !is_image_file(fs, file_path)){
+		if(dump(fs, file_path) == -1){
+			return -1;
+		}
+		return total;
+	}
+
+	size_t page, start, end;
+
+	//the pages go into the journal first, so an interrupted checkpoint can be finished on the next load
+	if(fs->journal != NULL){
+		page = 0;
+		while(next_dirty_range(fs, &page, &start, &end)){
+			struct iovec iov[4];
+			int cnt = image_iov(fs, start, end, iov);
+			if(journal_log_pages(fs, start, iov, cnt) == -1){
+				return -1;
+			}
+		}
+		if(journal_commit(fs) == -1){
+			return -1;
+		}
+	}
+
+	//the dirty ranges are written together, every region straight from its own memory
+	long written = 0;
+	io_batch batch;
+	io_batch_init(&batch, fs->image_fd, 1);
+	page = 0;
+	while(next_dirty_range(fs, &page, &start, &end)){
+		if(fs->mapping != NULL){
+			//msync wants the start aligned to the system's page size
+			size_t aligned = start - start % sysconf(_SC_PAGESIZE);
+			if(msync((uint8_t*)fs->mapping + aligned, end - aligned, MS_SYNC) == -1){
+				return -1;
+			}
+		}
+		else{
+			struct iovec iov[4];
+			int cnt = image_iov(fs, start, end, iov);
+			io_batch_add(&batch, iov, cnt, start);
+		}
+		written += end - start;
+	}
+	if(io_batch_run(&batch) == -1){
+		return -1;
+	}
+
+	//the journal may only be emptied once the image is on disk
+	if(fs->journal != NULL && fdatasync(fs->image_fd) == -1){
+		return -1;
+	}
+	clear_dirty(fs);
+	journal_restart(fs, file_path);
+	return written;
+}
+
+static int dump(file_system *fs, const char *file_path){
 	uint32_t size = fs->s_block->num_blocks;
 
-	FILE* fs_file = fopen(file_path,"w+b");
-	if (fs_file == NULL){
+	//a mounted image already holds every change, only the dirty pages have to be written back
+	if(fs->mapping != NULL && is_image_file(fs, file_path)){
+		return checkpoint(fs, file_path) == -1 ? -1 : 0;
+	}
+
+	//write a temporary file and replace the image with it, so a crash can't leave a torn image behind
+	char tmp_path[strlen(file_path) + sizeof(".tmp")];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", file_path);
+
+	int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1){
 		exit(1);
 	}
 
-	fwrite(fs->s_block, sizeof(superblock), 1, fs_file);
-	fwrite(fs->free_list, sizeof(uint8_t),size,fs_file);
-	fwrite(fs->inodes, sizeof(inode),size,fs_file);
-	fwrite(fs->data_blocks, sizeof(data_block),size,fs_file);
-	fclose(fs_file);
+	struct iovec iov[4];
+	io_batch batch;
+	io_batch_init(&batch, fd, 1);
+	int cnt = image_iov(fs, 0, image_size(size), iov);
+	io_batch_add(&batch, iov, cnt, 0);
+	if(io_batch_run(&batch) == -1 || fsync(fd) == -1){
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+	close(fd);
+	if(rename(tmp_path, file_path) == -1){
+		unlink(tmp_path);
+		return -1;
+	}
+
+	//the dumped file is the new base for checkpoints
+	if(fs->mapping == NULL){
+		if(!is_image_file(fs, file_path)){
+			if(fs->image_fd != -1){
+				close(fs->image_fd);
+			}
+			fs->image_fd = open(file_path, O_RDWR);
+		}
+		clear_dirty(fs);
+	}
+	journal_restart(fs, file_path);
 
 	return 0;
 
 }
 
+//both write the whole fs and empty the journal, so nothing else may run meanwhile
+long fs_checkpoint(file_system* fs, const char* file_path){
+	lock_journal(fs);
+	lock_tree_write(fs);
+	long ret = checkpoint(fs, file_path);
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return ret;
+}
 
-int find_free_inode(file_system* fs){
-	for (int i=0; i<fs->s_block->num_blocks; i++) {
+int fs_dump(file_system *fs, const char *file_path){
+	lock_journal(fs);
+	lock_tree_write(fs);
+	int ret = dump(fs, file_path);
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return ret;
+}
+
+
+/*
+ * fills the free inode stack with every free inode, highest number at the bottom
+ */
+static int build_free_inodes(file_system* fs){
+	uint32_t size = fs->s_block->num_blocks;
+	if(fs->free_inodes == NULL){
+		fs->free_inodes = malloc(sizeof(int) * size);
+		if(fs->free_inodes == NULL){
+			return -1;
+		}
+	}
+	fs->free_inodes_count = 0;
+	for (int i=size-1; i>=0; i--) {
 		if(fs->inodes[i].n_type==free_block){
-			return i;
+			fs->free_inodes[fs->free_inodes_count++] = i;
+		}
+	}
+	return 0;
+}
+
+static int next_free_inode(file_system* fs){
+	if(fs->free_inodes == NULL && build_free_inodes(fs) == -1){
+		return -1;
+	}
+	//entries are only dropped once they are taken, the caller may still decide not to use the inode
+	while (fs->free_inodes_count > 0) {
+		int num = fs->free_inodes[fs->free_inodes_count-1];
+		if(fs->inodes[num].n_type==free_block){
+			return num;
 		}
+		fs->free_inodes_count--;
 	}
 	return -1;
 }
 
+/*
+ * lock-free: finds a free inode from the calling CPU's hint on. For a type other than free_block
+ * the inode is taken with a compare-and-swap on its type, the thread that swaps it owns it
+ */
+static int search_free_inode(file_system* fs, enum node_type type){
+	uint32_t size = fs->s_block->num_blocks;
+	uint32_t* hint = &alloc_cpu_hint(fs)->inode;
+	uint32_t start = __atomic_load_n(hint, __ATOMIC_RELAXED);
+	for(uint32_t n = 0; n < size; n++){
+		uint32_t num = (start + n) % size;
+		enum node_type expected = free_block;
+		if(__atomic_load_n(&fs->inodes[num].n_type, __ATOMIC_RELAXED) != free_block){
+			continue;
+		}
+		if(type == free_block){
+			return num;
+		}
+		if(__atomic_compare_exchange_n(&fs->inodes[num].n_type, &expected, type, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			__atomic_store_n(hint, (num + 1) % size, __ATOMIC_RELAXED);
+			return num;
+		}
+	}
+	return -1;
+}
+
+int find_free_inode(file_system* fs){
+	if(fs->alloc_hints != NULL){
+		return search_free_inode(fs, free_block);
+	}
+	lock_alloc(fs);
+	int num = next_free_inode(fs);
+	unlock_alloc(fs);
+	return num;
+}
+
+int claim_inode(file_system* fs, enum node_type type){
+	if(fs->alloc_hints != NULL){
+		int num = search_free_inode(fs, type);
+		if(num != -1){
+			clear_inode(&fs->inodes[num]);
+			mark_inode_dirty(fs, num);
+		}
+		return num;
+	}
+	lock_alloc(fs);
+	int num = next_free_inode(fs);
+	if(num != -1){
+		inode_init(&fs->inodes[num]);
+		fs->inodes[num].n_type = type;
+		fs->free_inodes_count--;
+		mark_inode_dirty(fs, num);
+	}
+	unlock_alloc(fs);
+	return num;
+}
+
+void release_inode(file_system* fs, int num){
+	if(fs->alloc_hints != NULL){
+		//the inode is reset before its type says it is free, another thread may take it right after
+		clear_inode(&fs->inodes[num]);
+		dcache_invalidate(fs, num);
+		mark_inode_dirty(fs, num);
+		__atomic_store_n(&fs->inodes[num].n_type, free_block, __ATOMIC_RELEASE);
+		return;
+	}
+	inode_init(&fs->inodes[num]);
+	dcache_invalidate(fs, num);
+	mark_inode_dirty(fs, num);
+	lock_alloc(fs);
+	if(fs->free_inodes != NULL){
+		//the stack can hold stale entries. If it is full, rebuilding it gets rid of them
+		if(fs->free_inodes_count == fs->s_block->num_blocks){
+			build_free_inodes(fs);
+		}
+		else{
+			fs->free_inodes[fs->free_inodes_count++] = num;
+		}
+	}
+	unlock_alloc(fs);
+}
+
 
 void cleanup(file_system *fs){
+	lock_cleanup(fs);
+	journal_close(fs);
+	alloc_cleanup(fs);
+	dcache_cleanup(fs);
+	free(fs->free_inodes);
+	free(fs->dirty_pages);
+	if(fs->image_fd != -1){
+		close(fs->image_fd);
+	}
+	if(fs->mapping != NULL){
+		munmap(fs->mapping, fs->mapping_size);
+		free(fs);
+		return;
+	}
 	
 	free(fs->s_block);
 	free(fs->inodes);
@@ -2,8 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "../lib/filesystem.h"
+#include "../lib/journal.h"
 #include "../lib/linenoise.h"
 #include "../lib/operations.h"
 #include "../lib/utils.h"
@@ -26,7 +28,21 @@ main(int argc, const char *argv[])
 			fs = fs_create(argv[2], (uint32_t)atol(argv[3]));
 		}
 	} else if (strcmp(argv[1], "-l") == 0 || strcmp(argv[1], "--load") == 0) {
-		fs = fs_load(argv[2]);
+		if (argc < 3 || (fs = fs_load(argv[2])) == NULL) {
+			fprintf(stderr, "Could not load filesystem\n");
+			exit(1);
+		}
+	} else if (strcmp(argv[1], "-m") == 0 || strcmp(argv[1], "--mount") == 0) {
+		if (argc < 3 || (fs = fs_mount(argv[2])) == NULL) {
+			fprintf(stderr, "Could not mount filesystem\n");
+			exit(1);
+		}
+	} else if (strcmp(argv[1], "-u") == 0 || strcmp(argv[1], "--upgrade") == 0) {
+		if (argc < 3 || fs_upgrade(argv[2]) == -1) {
+			fprintf(stderr, "Could not upgrade filesystem\n");
+			exit(1);
+		}
+		exit(0);
 	} else if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
 		printhelp();
 	}
@@ -36,6 +52,11 @@ main(int argc, const char *argv[])
 		exit(1);
 	}
 
+	// Mounted images are written back by the kernel, everything else gets a journal
+	if (fs != NULL && fs->mapping == NULL && journal_open(fs, argv[2]) == -1) {
+		fprintf(stderr, "Could not open journal, changes are only kept until the next dump\n");
+	}
+
 
 	linenoiseHistorySetMaxLen(20);
 
@@ -48,7 +69,7 @@ main(int argc, const char *argv[])
 		}
 		char *command = strtok(input_buf, " \n");
 		if(command == NULL){
-			LOG("Unknown command\nValid commands:\nlist\nmkfile\nmakedir\ncp\nrm\nexport\nimport\nwritef\nreadf\ndump\n");
+			LOG("Unknown command\nValid commands:\nlist\nliststat\nmkfile\nmakedir\ncp\nrm\nexport\nexporttree\nimport\nimporttree\nwritef\nreadf\ndump\n");
 			free(input_buf);
 			continue;
 		}
@@ -68,6 +89,22 @@ main(int argc, const char *argv[])
 			char *output = fs_list(fs, strtok(NULL, " \n"));
 			printf("%s", output);
 			free(output);
+		} else if (!strcmp(command, "liststat")) {
+			LOG("Chosen liststat\n");
+			//one line per child: inode, type, size, blocks and name separated by tabs
+			char *path = strtok(NULL, " \n");
+			fs_stat stats[64];
+			fs_stat *out = stats;
+			long count = (path != NULL) ? fs_list_stat(fs, path, out, 64) : -1;
+			if (count > 64) {
+				out = malloc(count * sizeof(fs_stat));
+				count = (out != NULL) ? fs_list_stat(fs, path, out, count) : -1;
+			}
+			for (long i = 0; i < count; i++) {
+				printf("%d\t%s\t%lu\t%lu\t%.*s\n", out[i].inode, (out[i].type == directory) ? "DIR" : "FIL",
+				       (unsigned long)out[i].size, (unsigned long)out[i].blocks, NAME_MAX_LENGTH, out[i].name);
+			}
+			if (out != stats) free(out);
 		} else if (!strcmp(command, "writef")) {
 			char *path = strtok(NULL, " \n");
 			char *text = strtok(NULL, "\0");
@@ -88,19 +125,42 @@ main(int argc, const char *argv[])
 			char *ext_path = strtok(NULL, "\0");
 			fs_export(fs, int_path, ext_path);
 			LOG("Chosen export\n");
+		} else if (!strcmp(command, "exporttree")) {
+			//exporttree <int_dir> <ext_dir> [threads], one thread per core by default
+			char *int_dir = strtok(NULL, " \n");
+			char *ext_dir = strtok(NULL, " \n");
+			char *threads = strtok(NULL, " \n");
+			int nthreads = (threads != NULL) ? atoi(threads) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+			if (int_dir == NULL || ext_dir == NULL || fs_export_tree(fs, int_dir, ext_dir, nthreads) != 0) {
+				fprintf(stderr, "Not everything could be exported\n");
+			}
 		} else if (!strcmp(command, "import")) {
 			char *int_path = strtok(NULL, " \n");
 			char *ext_path = strtok(NULL, "\0");
 			fs_import(fs, int_path, ext_path);
+		} else if (!strcmp(command, "importtree")) {
+			//importtree <int_dir> <ext_dir> [threads], one thread per core by default
+			char *int_dir = strtok(NULL, " \n");
+			char *ext_dir = strtok(NULL, " \n");
+			char *threads = strtok(NULL, " \n");
+			int nthreads = (threads != NULL) ? atoi(threads) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+			if (int_dir == NULL || ext_dir == NULL || fs_import_tree(fs, int_dir, ext_dir, nthreads) != 0) {
+				fprintf(stderr, "Not everything could be imported\n");
+			}
 		} else if (!strcmp(command, "dump")) {
 			LOG("Saving filesystem to disk\n");
-			fs_dump(fs, argv[2]);
+			long written = fs_checkpoint(fs, argv[2]);
+			if (written == -1) {
+				fprintf(stderr, "Could not save filesystem\n");
+			} else {
+				printf("%ld bytes written\n", written);
+			}
 		} else if (!strcmp(command, "exit") || !strcmp(command, "quit")) {
 			cleanup(fs);
 			free(input_buf);
 			exit(0);
 		} else {
-			LOG("Unknown command\nValid commands:\nlist\nmkfile\nmakedir\ncp\nrm\nexport\nimport\nwritef\nreadf\ndump\n");
+			LOG("Unknown command\nValid commands:\nlist\nliststat\nmkfile\nmakedir\ncp\nrm\nexport\nexporttree\nimport\nimporttree\nwritef\nreadf\ndump\n");
 		}
 		free(input_buf);
 	}
@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../lib/io.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static int engine = IO_ENGINE_AUTO; //resolved on first use
+
+/*
+ * the rings of one io_uring instance, mapped from the kernel
+ */
+typedef struct _uring{
+	int fd;
+	unsigned entries;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+	void* sq_ring;
+	size_t sq_ring_len;
+	void* cq_ring; //the same as sq_ring if the kernel maps both at once
+	size_t cq_ring_len;
+	size_t sqes_len;
+} uring;
+
+static void uring_teardown(uring* ring){
+	if(ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_len);
+	if(ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_len);
+	if(ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_len);
+	close(ring->fd);
+}
+
+/*
+ * @return 0 on success, -1 if the kernel has no io_uring or doesn't allow it
+ */
+static int uring_setup(uring* ring, unsigned entries){
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if(ring->fd < 0) return -1;
+
+	ring->entries = params.sq_entries;
+	ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		ring->sq_ring_len = ring->cq_ring_len = MAX(ring->sq_ring_len, ring->cq_ring_len);
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = ring->sq_ring;
+	if(ring->sq_ring != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	}
+	ring->sqes = MAP_FAILED;
+	if(ring->cq_ring != MAP_FAILED)
+	{
+		ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	}
+	if(ring->sqes == MAP_FAILED)
+	{
+		uring_teardown(ring);
+		return -1;
+	}
+
+	uint8_t* sq = ring->sq_ring;
+	uint8_t* cq = ring->cq_ring;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return 0;
+}
+
+static int uring_available(void){
+	uring ring;
+	if(uring_setup(&ring, 1) == -1) return 0;
+	uring_teardown(&ring);
+	return 1;
+}
+
+int io_set_engine(enum io_engine new_engine){
+	if(new_engine == IO_ENGINE_URING && !uring_available()) return -1;
+	__atomic_store_n(&engine, new_engine, __ATOMIC_RELAXED);
+	return 0;
+}
+
+enum io_engine io_get_engine(void){
+	int current = __atomic_load_n(&engine, __ATOMIC_RELAXED);
+	if(current == IO_ENGINE_AUTO)
+	{
+		current = uring_available() ? IO_ENGINE_URING : IO_ENGINE_THREADS;
+		__atomic_store_n(&engine, current, __ATOMIC_RELAXED);
+	}
+	return current;
+}
+
+void io_batch_init(io_batch* batch, int fd, int write){
+	batch->fd = fd;
+	batch->write = write;
+	batch->reqs = NULL;
+	batch->count = 0;
+	batch->cap = 0;
+	batch->failed = 0;
+}
+
+int io_batch_add(io_batch* batch, const struct iovec* iov, int cnt, uint64_t offset){
+	for(int i = 0; i < cnt; i++)
+	{
+		uint8_t* buf = iov[i].iov_base;
+		size_t len = iov[i].iov_len;
+		while(len > 0)
+		{
+			if(batch->count == batch->cap)
+			{
+				size_t cap = (batch->cap == 0) ? 64 : batch->cap * 2;
+				io_req* grown = realloc(batch->reqs, cap * sizeof(io_req));
+				if(grown == NULL)
+				{
+					batch->failed = 1;
+					return -1;
+				}
+				batch->reqs = grown;
+				batch->cap = cap;
+			}
+			// Up to the next chunk boundary of the file
+			size_t part = MIN(len, IO_CHUNK_SIZE - offset % IO_CHUNK_SIZE);
+			batch->reqs[batch->count++] = (io_req){buf, part, offset};
+			buf += part;
+			len -= part;
+			offset += part;
+		}
+	}
+	return 0;
+}
+
+/*
+ * does req with pread/pwrite, a short transfer continues where it stopped
+ * returns 0 on success, -1 on an error or the end of the file
+ */
+static int transfer_sync(int fd, int write, const io_req* req){
+	size_t done = 0;
+	while(done < req->len)
+	{
+		ssize_t n = write ? pwrite(fd, req->buf + done, req->len - done, req->offset + done)
+		                  : pread(fd, req->buf + done, req->len - done, req->offset + done);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return -1;
+		done += n;
+	}
+	return 0;
+}
+
+typedef struct _io_pool{
+	io_batch* batch;
+	size_t next; //next request to take, shared by the threads
+	int failed;
+} io_pool;
+
+static void* pool_worker(void* arg){
+	io_pool* pool = arg;
+	size_t next;
+	while((next = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->batch->count)
+	{
+		if(transfer_sync(pool->batch->fd, pool->batch->write, &pool->batch->reqs[next]) == -1)
+		{
+			__atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * does the requests on up to IO_THREADS threads, the calling thread is one of them
+ */
+static int run_threads(io_batch* batch){
+	io_pool pool = {batch, 0, 0};
+	int nthreads = MIN(IO_THREADS, batch->count);
+	pthread_t threads[IO_THREADS];
+	int started = 0;
+	while(started < nthreads - 1 && pthread_create(&threads[started], NULL, pool_worker, &pool) == 0) started++;
+	pool_worker(&pool);
+	for(int i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	return pool.failed ? -1 : 0;
+}
+
+/*
+ * keeps up to IO_QUEUE_DEPTH requests in flight. What io_uring rejects or transfers only in
+ * part is finished with pread/pwrite
+ */
+static int run_uring(io_batch* batch){
+	uring ring;
+	if(uring_setup(&ring, IO_QUEUE_DEPTH) == -1) return run_threads(batch);
+
+	size_t next = 0;
+	size_t completed = 0;
+	int failed = 0;
+	unsigned tail = *ring.sq_tail;
+	while(completed < batch->count)
+	{
+		// Queue requests until the ring is full, every request in flight has a completion slot
+		while(next < batch->count && next - completed < ring.entries)
+		{
+			io_req* req = &batch->reqs[next];
+			unsigned index = tail & *ring.sq_mask;
+			struct io_uring_sqe* sqe = &ring.sqes[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = batch->write ? IORING_OP_WRITE : IORING_OP_READ;
+			sqe->fd = batch->fd;
+			sqe->addr = (uint64_t)(uintptr_t)req->buf;
+			sqe->len = req->len;
+			sqe->off = req->offset;
+			sqe->user_data = next;
+			ring.sq_array[index] = index;
+			tail++;
+			next++;
+		}
+		__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+		unsigned to_submit = tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+		if(syscall(__NR_io_uring_enter, ring.fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+		{
+			// Doing a request twice writes or reads the same bytes again, so all of them can be redone
+			uring_teardown(&ring);
+			return run_threads(batch);
+		}
+
+		unsigned head = *ring.cq_head;
+		unsigned cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		while(head != cq_tail)
+		{
+			struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+			io_req* req = &batch->reqs[cqe->user_data];
+			if(cqe->res < 0 || (size_t)cqe->res < req->len)
+			{
+				size_t done = (cqe->res > 0) ? cqe->res : 0;
+				io_req rest = {req->buf + done, req->len - done, req->offset + done};
+				if(transfer_sync(batch->fd, batch->write, &rest) == -1) failed = 1;
+			}
+			head++;
+			completed++;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	uring_teardown(&ring);
+	return failed ? -1 : 0;
+}
+
+int io_batch_run(io_batch* batch){
+	int ret = batch->failed ? -1 : 0;
+	if(ret == 0 && batch->count > 0)
+	{
+		ret = (io_get_engine() == IO_ENGINE_URING) ? run_uring(batch) : run_threads(batch);
+	}
+	io_batch_free(batch);
+	return ret;
+}
+
+void io_batch_free(io_batch* batch){
+	free(batch->reqs);
+	batch->reqs = NULL;
+	batch->count = 0;
+	batch->cap = 0;
+	batch->failed = 0;
+}
+
+int io_write_all(int fd, struct iovec* iov, int cnt){
+	while(cnt > 0)
+	{
+		int batch = MIN(cnt, IOV_MAX);
+		ssize_t written = writev(fd, iov, batch);
+		if(written < 0 && errno == EINTR) continue;
+		if(written < 0) return -1;
+
+		// Skip what has been written, a short write continues in the middle of an iovec
+		while(batch > 0 && written >= iov->iov_len)
+		{
+			written -= iov->iov_len;
+			iov++;
+			cnt--;
+			batch--;
+		}
+		if(batch > 0)
+		{
+			iov->iov_base = (uint8_t*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
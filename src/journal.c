@@ -0,0 +1,415 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../lib/io.h"
+#include "../lib/journal.h"
+#include "../lib/operations.h"
+
+static void build_journal_path(char* buffer, const char* image_path){
+	strcpy(buffer, image_path);
+	strcat(buffer, JOURNAL_SUFFIX);
+}
+
+// FNV-1a, good enough to detect a torn record
+static uint32_t checksum_add(uint32_t sum, const void* data, size_t len){
+	const uint8_t* bytes = data;
+	for(size_t i = 0; i < len; i++)
+	{
+		sum ^= bytes[i];
+		sum *= 16777619u;
+	}
+	return sum;
+}
+
+#define CHECKSUM_INIT 2166136261u
+
+/*
+ * appends one record: header followed by the payload parts
+ */
+static int append_record(journal* j, enum journal_op op, struct iovec* payload, int payload_cnt){
+	journal_header header = {JOURNAL_MAGIC, op, 0, CHECKSUM_INIT};
+	for(int i = 0; i < payload_cnt; i++)
+	{
+		header.len += payload[i].iov_len;
+		header.checksum = checksum_add(header.checksum, payload[i].iov_base, payload[i].iov_len);
+	}
+
+	// An imported file has one part per block, so the list can be too big for the stack
+	struct iovec* iov = malloc((payload_cnt + 1) * sizeof(struct iovec));
+	if(iov == NULL) return -1;
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	for(int i = 0; i < payload_cnt; i++)
+	{
+		iov[i + 1] = payload[i];
+	}
+	int ret = io_write_all(j->fd, iov, payload_cnt + 1);
+	free(iov);
+	return ret;
+}
+
+int journal_open(file_system* fs, const char* image_path){
+	if(fs->mapping != NULL) return -1;
+
+	char path[strlen(image_path) + sizeof(JOURNAL_SUFFIX)];
+	build_journal_path(path, image_path);
+
+	journal* j = calloc(1, sizeof(journal));
+	if(j == NULL) return -1;
+	j->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if(j->fd == -1)
+	{
+		free(j);
+		return -1;
+	}
+
+	journal_close(fs);
+	fs->journal = j;
+	return 0;
+}
+
+void journal_close(file_system* fs){
+	if(fs->journal == NULL) return;
+	if(fs->journal->fd != -1) close(fs->journal->fd);
+	free(fs->journal->allocs);
+	free(fs->journal);
+	fs->journal = NULL;
+}
+
+void journal_fail(file_system* fs){
+	journal* j = fs->journal;
+	if(j == NULL || j->fd == -1) return;
+	if(!j->failed) fprintf(stderr, "journal: a record couldn't be written, logging stops until the next dump\n");
+	j->failed = 1;
+	j->allocs_count = 0;
+}
+
+int journal_log(file_system* fs, enum journal_op op, const char* path, const char* path2, const struct iovec* data, int data_cnt){
+	journal* j = fs->journal;
+	if(j == NULL || j->fd == -1 || path == NULL) return 0;
+	if(j->failed) return -1;
+
+	struct iovec* payload = malloc((data_cnt + 4) * sizeof(struct iovec));
+	if(payload == NULL)
+	{
+		journal_fail(fs);
+		return -1;
+	}
+	int cnt = 0;
+	payload[cnt++] = (struct iovec){&j->allocs_count, sizeof(uint32_t)};
+	payload[cnt++] = (struct iovec){j->allocs, j->allocs_count * sizeof(int)};
+	payload[cnt++] = (struct iovec){(char*)path, strlen(path) + 1};
+	if(op == j_cp) payload[cnt++] = (struct iovec){(char*)(path2 ? path2 : ""), (path2 ? strlen(path2) : 0) + 1};
+	for(int i = 0; i < data_cnt; i++)
+	{
+		payload[cnt++] = data[i];
+	}
+
+	int ret = append_record(j, op, payload, cnt);
+	free(payload);
+	j->allocs_count = 0;
+	if(ret == -1) journal_fail(fs);
+	return ret;
+}
+
+void journal_note_alloc(file_system* fs, int block_num){
+	journal* j = fs->journal;
+	if(j == NULL || j->fd == -1 || j->failed) return;
+
+	if(j->allocs_count == j->allocs_cap)
+	{
+		uint32_t cap = j->allocs_cap ? j->allocs_cap * 2 : 16;
+		int* allocs = realloc(j->allocs, cap * sizeof(int));
+		if(allocs == NULL)
+		{
+			journal_fail(fs);
+			return;
+		}
+		j->allocs = allocs;
+		j->allocs_cap = cap;
+	}
+	j->allocs[j->allocs_count++] = block_num;
+}
+
+void journal_drop_allocs(file_system* fs){
+	if(fs->journal != NULL) fs->journal->allocs_count = 0;
+}
+
+int journal_replay_alloc(file_system* fs){
+	journal* j = fs->journal;
+	if(j == NULL || j->fd != -1 || j->replay_pos >= j->allocs_count) return -1;
+	return j->allocs[j->replay_pos++];
+}
+
+uint32_t journal_replay_alloc_run(file_system* fs, uint32_t want, int* start){
+	journal* j = fs->journal;
+	if(j == NULL || j->fd != -1 || j->replay_pos >= j->allocs_count) return 0;
+
+	*start = j->allocs[j->replay_pos++];
+	uint32_t len = 1;
+	while(len < want && j->replay_pos < j->allocs_count && j->allocs[j->replay_pos] == *start + len)
+	{
+		j->replay_pos++;
+		len++;
+	}
+	return len;
+}
+
+int journal_log_pages(file_system* fs, size_t offset, const struct iovec* pages, int pages_cnt){
+	journal* j = fs->journal;
+	if(j == NULL || j->fd == -1) return 0;
+
+	uint64_t off = offset;
+	struct iovec payload[pages_cnt + 1];
+	payload[0] = (struct iovec){&off, sizeof(off)};
+	memcpy(payload + 1, pages, sizeof(struct iovec) * pages_cnt);
+	return append_record(j, j_pages, payload, pages_cnt + 1);
+}
+
+int journal_commit(file_system* fs){
+	journal* j = fs->journal;
+	if(j == NULL || j->fd == -1) return 0;
+
+	if(append_record(j, j_commit, NULL, 0) == -1) return -1;
+	return fdatasync(j->fd);
+}
+
+void journal_restart(file_system* fs, const char* image_path){
+	char path[strlen(image_path) + sizeof(JOURNAL_SUFFIX)];
+	build_journal_path(path, image_path);
+
+	journal* j = fs->journal;
+	if(j == NULL || j->fd == -1)
+	{
+		// Nobody writes to this journal, but it may still be left over from an earlier session
+		unlink(path);
+		return;
+	}
+
+	int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644);
+	if(fd == -1) return;
+	close(j->fd);
+	j->fd = fd;
+	j->allocs_count = 0;
+	j->failed = 0;
+}
+
+/*
+ * reads the whole journal. Returns the length of the valid records,
+ * everything behind it is torn or garbage
+ */
+static size_t read_journal(int fd, uint8_t** buffer, size_t* file_len){
+	struct stat st;
+	*buffer = NULL;
+	*file_len = 0;
+	if(fstat(fd, &st) == -1 || st.st_size == 0) return 0;
+
+	uint8_t* data = malloc(st.st_size);
+	if(data == NULL) return 0;
+	size_t got = 0;
+	while(got < st.st_size)
+	{
+		ssize_t n = pread(fd, data + got, st.st_size - got, got);
+		if(n <= 0) break;
+		got += n;
+	}
+
+	size_t pos = 0;
+	while(pos + sizeof(journal_header) <= got)
+	{
+		journal_header header;
+		memcpy(&header, data + pos, sizeof(header));
+		if(header.magic != JOURNAL_MAGIC || header.len > got - pos - sizeof(header)) break;
+		if(checksum_add(CHECKSUM_INIT, data + pos + sizeof(header), header.len) != header.checksum) break;
+		pos += sizeof(header) + header.len;
+	}
+
+	*buffer = data;
+	*file_len = got;
+	return pos;
+}
+
+int journal_recover(const char* image_path){
+	char path[strlen(image_path) + sizeof(JOURNAL_SUFFIX)];
+	build_journal_path(path, image_path);
+
+	int fd = open(path, O_RDWR);
+	if(fd == -1) return 0;
+
+	uint8_t* data;
+	size_t file_len;
+	size_t valid = read_journal(fd, &data, &file_len);
+
+	// Find the last commit record. The pages written right in front of it belong to it
+	size_t pages_start = 0, commit_start = 0, commit = 0;
+	int committed = 0;
+	for(size_t pos = 0; pos < valid;)
+	{
+		journal_header header;
+		memcpy(&header, data + pos, sizeof(header));
+		size_t next = pos + sizeof(header) + header.len;
+		if(header.op == j_commit)
+		{
+			commit_start = pages_start;
+			commit = pos;
+			committed = 1;
+		}
+		if(header.op != j_pages) pages_start = next;
+		pos = next;
+	}
+
+	int ret = 0;
+	if(committed)
+	{
+		int image_fd = open(image_path, O_RDWR);
+		if(image_fd == -1) ret = -1;
+		for(size_t pos = commit_start; ret == 0 && pos < commit;)
+		{
+			journal_header header;
+			memcpy(&header, data + pos, sizeof(header));
+			if(header.op == j_pages)
+			{
+				uint64_t offset;
+				memcpy(&offset, data + pos + sizeof(header), sizeof(offset));
+				size_t len = header.len - sizeof(offset);
+				if(pwrite(image_fd, data + pos + sizeof(header) + sizeof(offset), len, offset) != len) ret = -1;
+			}
+			pos += sizeof(header) + header.len;
+		}
+		if(image_fd != -1)
+		{
+			if(ret == 0 && fsync(image_fd) == -1) ret = -1;
+			close(image_fd);
+		}
+		// The image has every change now, the logical records are obsolete
+		if(ret == 0 && ftruncate(fd, 0) == -1) ret = -1;
+	}
+
+	free(data);
+	close(fd);
+	return ret;
+}
+
+/*
+ * executes one logical record on fs
+ */
+static void replay_record(file_system* fs, journal_header* header, uint8_t* payload){
+	journal* j = fs->journal;
+	uint8_t* end = payload + header->len;
+
+	uint32_t allocs_count;
+	memcpy(&allocs_count, payload, sizeof(uint32_t));
+	payload += sizeof(uint32_t);
+	if(allocs_count > (end - payload) / sizeof(int)) return;
+	if(allocs_count > j->allocs_cap)
+	{
+		int* allocs = realloc(j->allocs, allocs_count * sizeof(int));
+		if(allocs == NULL) return;
+		j->allocs = allocs;
+		j->allocs_cap = allocs_count;
+	}
+	memcpy(j->allocs, payload, allocs_count * sizeof(int));
+	j->allocs_count = allocs_count;
+	j->replay_pos = 0;
+	payload += allocs_count * sizeof(int);
+
+	char* path = (char*)payload;
+	char* path_end = memchr(path, '\0', end - payload);
+	if(path_end == NULL) return;
+	payload = (uint8_t*)path_end + 1;
+
+	switch(header->op)
+	{
+		case j_mkdir:
+			fs_mkdir(fs, path);
+			break;
+		case j_mkfile:
+			fs_mkfile(fs, path);
+			break;
+		case j_writef:
+			// the text was logged with its terminating zero
+			if(payload < end && end[-1] == '\0') fs_writef(fs, path, (char*)payload);
+			break;
+		case j_rm:
+			fs_rm(fs, path);
+			break;
+		case j_cp:
+			if(memchr(payload, '\0', end - payload) != NULL) fs_cp(fs, path, (char*)payload);
+			break;
+		case j_import:
+		{
+			FILE* content = (end > payload) ? fmemopen(payload, end - payload, "rb") : fopen("/dev/null", "rb");
+			if(content == NULL) break;
+			fs_import_file(fs, path, content);
+			fclose(content);
+			break;
+		}
+		case j_pwrite:
+		{
+			uint64_t offset;
+			if((size_t)(end - payload) < sizeof(offset)) break;
+			memcpy(&offset, payload, sizeof(offset));
+			payload += sizeof(offset);
+			fs_pwrite(fs, path, offset, payload, end - payload);
+			break;
+		}
+		case j_writev:
+		{
+			struct iovec data = {payload, end - payload};
+			fs_writev(fs, path, &data, 1);
+			break;
+		}
+		default:
+			break;
+	}
+	j->allocs_count = 0;
+}
+
+int journal_replay(file_system* fs, const char* image_path){
+	char path[strlen(image_path) + sizeof(JOURNAL_SUFFIX)];
+	build_journal_path(path, image_path);
+
+	int fd = open(path, O_RDWR);
+	if(fd == -1) return 0;
+
+	uint8_t* data;
+	size_t file_len;
+	size_t valid = read_journal(fd, &data, &file_len);
+
+	// Cut off a torn record, new records are appended behind the valid ones
+	if(valid < file_len && ftruncate(fd, valid) == -1)
+	{
+		free(data);
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	// Replay with a journal that only hands out the recorded blocks and logs nothing
+	journal* saved = fs->journal;
+	journal replay = {-1, NULL, 0, 0, 0, 0};
+	fs->journal = &replay;
+
+	int applied = 0;
+	for(size_t pos = 0; pos < valid;)
+	{
+		journal_header header;
+		memcpy(&header, data + pos, sizeof(header));
+		if(((header.op >= j_mkdir && header.op <= j_import) || header.op == j_pwrite || header.op == j_writev) && header.len >= sizeof(uint32_t))
+		{
+			replay_record(fs, &header, data + pos + sizeof(header));
+			applied++;
+		}
+		pos += sizeof(header) + header.len;
+	}
+
+	fs->journal = saved;
+	free(replay.allocs);
+	free(data);
+	return applied;
+}
@@ -0,0 +1,108 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include "../lib/lock.h"
+
+int fs_threads_enable(file_system* fs){
+	if(fs->locks != NULL) return 0;
+
+	uint32_t num_inodes = fs->s_block->num_blocks;
+	fs_locks* locks = malloc(sizeof(fs_locks));
+	if(locks == NULL) return -1;
+	locks->inodes = malloc(num_inodes * sizeof(pthread_rwlock_t));
+	if(locks->inodes == NULL)
+	{
+		free(locks);
+		return -1;
+	}
+
+	// rm and dumps would wait forever behind a steady stream of readers otherwise.
+	// No thread takes the tree lock twice, so preferring writers can't deadlock
+	pthread_rwlockattr_t tree_attr;
+	pthread_rwlockattr_init(&tree_attr);
+#ifdef __GLIBC__
+	pthread_rwlockattr_setkind_np(&tree_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	pthread_mutex_init(&locks->journal, NULL);
+	pthread_rwlock_init(&locks->tree, &tree_attr);
+	pthread_rwlockattr_destroy(&tree_attr);
+	for(uint32_t i = 0; i < num_inodes; i++)
+	{
+		pthread_rwlock_init(&locks->inodes[i], NULL);
+	}
+	pthread_mutex_init(&locks->alloc, NULL);
+	pthread_rwlock_init(&locks->dcache, NULL);
+
+	fs->locks = locks;
+	return 0;
+}
+
+void lock_cleanup(file_system* fs){
+	fs_locks* locks = fs->locks;
+	if(locks == NULL) return;
+
+	pthread_mutex_destroy(&locks->journal);
+	pthread_rwlock_destroy(&locks->tree);
+	for(uint32_t i = 0; i < fs->s_block->num_blocks; i++)
+	{
+		pthread_rwlock_destroy(&locks->inodes[i]);
+	}
+	pthread_mutex_destroy(&locks->alloc);
+	pthread_rwlock_destroy(&locks->dcache);
+	free(locks->inodes);
+	free(locks);
+	fs->locks = NULL;
+}
+
+// Nothing to keep in order without a journal
+void lock_journal(file_system* fs){
+	if(fs->locks != NULL && fs->journal != NULL) pthread_mutex_lock(&fs->locks->journal);
+}
+
+void unlock_journal(file_system* fs){
+	if(fs->locks != NULL && fs->journal != NULL) pthread_mutex_unlock(&fs->locks->journal);
+}
+
+void lock_tree_read(file_system* fs){
+	if(fs->locks != NULL) pthread_rwlock_rdlock(&fs->locks->tree);
+}
+
+void lock_tree_write(file_system* fs){
+	if(fs->locks != NULL) pthread_rwlock_wrlock(&fs->locks->tree);
+}
+
+void unlock_tree(file_system* fs){
+	if(fs->locks != NULL) pthread_rwlock_unlock(&fs->locks->tree);
+}
+
+void lock_inode_read(file_system* fs, int num){
+	if(fs->locks != NULL) pthread_rwlock_rdlock(&fs->locks->inodes[num]);
+}
+
+void lock_inode_write(file_system* fs, int num){
+	if(fs->locks != NULL) pthread_rwlock_wrlock(&fs->locks->inodes[num]);
+}
+
+void unlock_inode(file_system* fs, int num){
+	if(fs->locks != NULL) pthread_rwlock_unlock(&fs->locks->inodes[num]);
+}
+
+void lock_alloc(file_system* fs){
+	if(fs->locks != NULL) pthread_mutex_lock(&fs->locks->alloc);
+}
+
+void unlock_alloc(file_system* fs){
+	if(fs->locks != NULL) pthread_mutex_unlock(&fs->locks->alloc);
+}
+
+void lock_dcache_read(file_system* fs){
+	if(fs->locks != NULL) pthread_rwlock_rdlock(&fs->locks->dcache);
+}
+
+void lock_dcache_write(file_system* fs){
+	if(fs->locks != NULL) pthread_rwlock_wrlock(&fs->locks->dcache);
+}
+
+void unlock_dcache(file_system* fs){
+	if(fs->locks != NULL) pthread_rwlock_unlock(&fs->locks->dcache);
+}
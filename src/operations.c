@@ -1,802 +1,1998 @@
 #include "../lib/operations.h"
+#include "../lib/alloc.h"
+#include "../lib/dir.h"
+#include "../lib/extent.h"
+#include "../lib/io.h"
+#include "../lib/journal.h"
+#include "../lib/lock.h"
+#include "../lib/path.h"
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
 
 inode* inode_ptr_at_num(file_system* fs, int num){
 	return &fs->inodes[num];
 }
 
-int find_child_with_name(file_system* fs, inode* parent, const char* name)
+/*
+ * creates a new empty directory or file under the given path
+ * returns 0 on success, -1 if the path is invalid, -2 if it already exists
+ */
+int create_node(file_system *fs, char *path, enum node_type type)
 {
-	// Check if parent is a directory
-	if(parent->n_type != directory) return -1;
+	// Get parent inode and check for dupe
+	path_lookup lookup;
+	if(resolve_path(fs, path, strlen(path), &lookup) == 0) return (lookup.parent != -1) ? -2 : -1;
+	if(lookup.parent == -1) return -1;
+	inode* parent_inode_ptr = inode_ptr_at_num(fs, lookup.parent);
+	if (parent_inode_ptr->n_type != directory) return -1;
+	if(lookup.name_len == 0 || lookup.name_len >= NAME_MAX_LENGTH) return -1;
 
-	for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+	// Another thread may have created the same name since it was looked up
+	lock_inode_write(fs, lookup.parent);
+	if(fs->locks != NULL && dir_lookup(fs, lookup.parent, lookup.name, lookup.name_len) != -1)
 	{
-		int child_inode_num = parent->direct_blocks[i];
-
-		// Check other child if no children at this block
-		if(child_inode_num == -1) continue;
-
-		inode* child = inode_ptr_at_num(fs, child_inode_num);
-		if(child == NULL) continue;
+		unlock_inode(fs, lookup.parent);
+		return -2;
+	}
 
-		// Return child number if name matches
-		if(child->n_type != free_block && strcmp(child->name, name) == 0)
+	// Create child inode
+	int ret = -1;
+	int child_inode_num = claim_inode(fs, type);
+	if(child_inode_num != -1)
+	{
+		// Write info to child inode
+		inode* child_inode_ptr = inode_ptr_at_num(fs, child_inode_num);
+		memcpy(child_inode_ptr->name, lookup.name, lookup.name_len);
+		child_inode_ptr->name[lookup.name_len] = '\0';
+		child_inode_ptr->parent = lookup.parent;
+
+		// The directory needs a name for the child to add it
+		if(dir_add(fs, lookup.parent, child_inode_num) == -1)
+		{
+			release_inode(fs, child_inode_num);
+		}
+		else
 		{
-			return child_inode_num;
+			mark_inode_dirty(fs, child_inode_num);
+			ret = 0;
 		}
 	}
+	unlock_inode(fs, lookup.parent);
 
-	return -1;
+	return ret;
 }
 
-int traverse_path(file_system *fs, const char *path, size_t size_of_path)
+int
+fs_mkdir(file_system *fs, char *path)
 {
-	// Check if path exists or in correct format
-	if(path == NULL || path[0] != '/') return -1;
-
-	char *substr = strstr(path, "//");
-	if(substr != NULL) return -1;
-
-	int inode_num = fs->root_node;
-	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
-
-	char path_copy[size_of_path + 1];
-	strcpy(path_copy, path);
-
-	char* token = strtok(path_copy, "/");
-
-	while (token != NULL)
-	{
-		inode_num = find_child_with_name(fs, inode_ptr, token);
-		if(inode_num == -1) return -1;
-		inode_ptr = inode_ptr_at_num(fs, inode_num);
-		token = strtok(NULL, "/");
-	}
-	
-	return inode_num;
+	lock_journal(fs);
+	lock_tree_read(fs);
+	int ret = create_node(fs, path, directory);
+	journal_log(fs, j_mkdir, path, NULL, NULL, 0);
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return (ret == 0) ? 0 : -1;
 }
 
-int traverse_path_parent(file_system *fs, const char *path, size_t size_of_path)
+int
+fs_mkfile(file_system *fs, char *path_and_name)
 {
-	// Check if path exists or in correct format
-	if(path == NULL || path[0] != '/') return -1;
-
-	char *substr = strstr(path, "//");
-	if(substr != NULL) return -1;
-
-	// Copy path
-	char path_copy[size_of_path + 1];
-    strcpy(path_copy, path);
-	
-	char *token = strtok(path_copy, "/");
-	// If path like "/" return -1 bc no parent
-	if(token == NULL) return -1;
-	token = strtok(NULL, "/");
-	if(token == NULL) return 0;
-
-	// Inode used to traverse
-	strcpy(path_copy, path);
-	token = strtok(path_copy, "/");
-	int inode_num = fs->root_node;
-	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
-
-	char last_token[NAME_MAX_LENGTH];
-	last_token[0] = '\0';
-
-	char before_last_token[NAME_MAX_LENGTH];
-	before_last_token[0] = '\0';
-
-	while (token != NULL)
-	{
-		strcpy(before_last_token, last_token);
-		strcpy(last_token, token);
-		token = strtok(NULL, "/");
-		inode_num = (before_last_token[0] != '\0') ? find_child_with_name(fs, inode_ptr, before_last_token) : 0;
-		// inode_num = find_child_with_name(fs, inode_ptr, last_token);
-		if(inode_num == -1) return -1;
-		inode_ptr = inode_ptr_at_num(fs, inode_num);
-	}
-	
-	return inode_num;
+	lock_journal(fs);
+	lock_tree_read(fs);
+	int ret = create_node(fs, path_and_name, reg_file);
+	journal_log(fs, j_mkfile, path_and_name, NULL, NULL, 0);
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return ret;
 }
 
-char* get_name(const char* path, size_t size_of_path)
+data_block* data_block_at_num(file_system* fs, int num)
 {
-	char path_copy[size_of_path + 1];
-    strcpy(path_copy, path);
-
-	char* token = strtok(path_copy, "/");
-	if (token == NULL) return NULL;
-    char* last = token;
-
-	while (token != NULL)
-	{
-		last = token;
-		token = strtok(NULL, "/");
-	}
-
-	char* result = malloc(strlen(last) + 1);
-	if(result == NULL) return NULL;
-    strcpy(result, last);
-    return result;
+	return &fs->data_blocks[num];
 }
 
-int find_direct_block_with_val(file_system* fs, inode* inode, int val){
-	for (int i=0; i<DIRECT_BLOCKS_COUNT; i++) {
-		if(inode->direct_blocks[i] == val){
+/*
+ * maps up to count new blocks behind block logical-1 of the file, as one run if possible.
+ * The run continues the last block of the file if the block behind it is free
+ * returns the number of mapped blocks with start set to the first one, 0 if the file system is full
+ */
+uint32_t append_run(file_system *fs, int inode_num, uint32_t logical, uint32_t count, int *start)
+{
+	int goal = (logical > 0) ? extent_get_block(fs, inode_num, logical - 1) : -1;
+	uint32_t run_length = alloc_run(fs, (goal != -1) ? goal + 1 : -1, count, start);
+	for(uint32_t i = 0; i < run_length; i++)
+	{
+		// The block map may need a block as well
+		if(extent_add_block(fs, inode_num, logical + i, *start + i) == -1)
+		{
+			for(uint32_t n = i; n < run_length; n++)
+			{
+				release_block(fs, *start + n);
+			}
 			return i;
 		}
+		data_block_at_num(fs, *start + i)->size = 0;
 	}
-	return -1;
+	return run_length;
 }
 
-int
-fs_mkdir(file_system *fs, char *path)
+/*
+ * gives the file private copies of the blocks first..last-1 it shares with other files,
+ * so they can be changed (copy-on-write). Consecutive shared blocks are copied as one run
+ * returns 0 on success, -1 if the file system is full
+ */
+int unshare_range(file_system *fs, int inode_num, uint32_t first, uint32_t last)
 {
-	size_t size_of_path = strlen(path);
-	
-	// Get parent inode
-	int parent_inode_num = traverse_path_parent(fs, path, size_of_path);
-	if(parent_inode_num == -1) return -1;
-	inode* parent_inode_ptr = inode_ptr_at_num(fs, parent_inode_num);
-	if (parent_inode_ptr->n_type != directory) return -1;
-	
-	// Create child inode
-	char* name = get_name(path, size_of_path);
-	if(name == NULL || name[0] == '\0') return -1;
-
-	int check_child = find_child_with_name(fs, parent_inode_ptr, name);
-	if(check_child != -1)
-	{
-		free(name);
-		return -1;
-	}
-
-
-	int child_inode_num = find_free_inode(fs);
-	if(child_inode_num == -1)
-	{
-		free(name);
-		return -1;
-	} 
-	inode* child_inode_ptr = inode_ptr_at_num(fs, child_inode_num);
-
-	// Write info to child inode
-	inode_init(child_inode_ptr);
-	child_inode_ptr->n_type = directory;
-	strcpy(child_inode_ptr->name, name);
-	child_inode_ptr->parent = parent_inode_num;
-
-	int free_direct_block = find_direct_block_with_val(fs, parent_inode_ptr, -1);
-	if(free_direct_block == -1)
+	uint32_t logical = first;
+	uint32_t run_length;
+	int run_start;
+	while(logical < last && (run_length = extent_get_run(fs, inode_num, logical, &run_start)) > 0)
 	{
-		free(name);
-		return -1;
-	} 
-
-	parent_inode_ptr->direct_blocks[free_direct_block] = child_inode_num;
+		run_length = MIN(run_length, last - logical);
+		for(uint32_t i = 0; i < run_length;)
+		{
+			if(!block_is_shared(fs, run_start + i))
+			{
+				i++;
+				continue;
+			}
+			uint32_t shared = 1;
+			while(i + shared < run_length && block_is_shared(fs, run_start + i + shared)) shared++;
 
-	free(name);
+			for(uint32_t done = 0; done < shared;)
+			{
+				int goal = (logical + i + done > 0) ? extent_get_block(fs, inode_num, logical + i + done - 1) : -1;
+				int copy_start;
+				uint32_t copied = alloc_run(fs, (goal != -1) ? goal + 1 : -1, shared - done, &copy_start);
+				if(copied == 0) return -1;
+
+				int old_start = run_start + i + done;
+				for(uint32_t n = 0; n < copied; n++)
+				{
+					data_block* old_block = data_block_at_num(fs, old_start + n);
+					data_block* new_block = data_block_at_num(fs, copy_start + n);
+					new_block->size = old_block->size;
+					memcpy(new_block->block, old_block->block, BLOCK_SIZE);
+					mark_data_block_dirty(fs, copy_start + n);
+				}
+				if(extent_remap(fs, inode_num, logical + i + done, copied, copy_start) == -1)
+				{
+					for(uint32_t n = 0; n < copied; n++)
+					{
+						release_block(fs, copy_start + n);
+					}
+					return -1;
+				}
+
+				// The other files keep the old blocks
+				for(uint32_t n = 0; n < copied; n++)
+				{
+					release_block(fs, old_start + n);
+				}
+				done += copied;
+			}
+			i += shared;
+		}
+		logical += run_length;
+	}
 	return 0;
 }
 
-int
-fs_mkfile(file_system *fs, char *path_and_name)
-{
-	size_t size_of_path = strlen(path_and_name);
-	
-	// Get parent inode
-	int parent_inode_num = traverse_path_parent(fs, path_and_name, size_of_path);
-	if(parent_inode_num == -1) return -1;
-	inode* parent_inode_ptr = inode_ptr_at_num(fs, parent_inode_num);
-	if(parent_inode_ptr->n_type != directory) return -1;
-	
-	// Create child inode
-	char* name = get_name(path_and_name, size_of_path);
-	if(name == NULL || name[0] == '\0') return -1;
-	int check_child = find_child_with_name(fs, parent_inode_ptr, name);
-	if(check_child != -1)
-	{
-		free(name);
-		return -2;
-	} 
-
-	int child_inode_num = find_free_inode(fs);
-	if(child_inode_num == -1)
-	{
-		free(name);
-		return -1;
-	} 
-	inode* child_inode_ptr = inode_ptr_at_num(fs, child_inode_num);
-
-	// Write info to child inode
-	inode_init(child_inode_ptr);
-	child_inode_ptr->n_type = reg_file;
-	strcpy(child_inode_ptr->name, name);
-	child_inode_ptr->parent = parent_inode_num;
-
-	int free_direct_block = find_direct_block_with_val(fs, parent_inode_ptr, -1);
-	if(free_direct_block == -1)
-	{
-		free(name);
-		return -1;
-	} 
-	parent_inode_ptr->direct_blocks[free_direct_block] = child_inode_num;
-
-	free(name);
-	return 0;
-}
+typedef struct _tree_entry {
+	int num;
+	int parent; //index of the parent's entry, -1 for the top
+} tree_entry;
 
-int count_direct_block(inode* inode)
+/*
+ * unlocks the first count nodes of a list collect_tree locked
+ */
+void unlock_tree_entries(file_system *fs, tree_entry *entries, size_t count)
 {
-	if(inode->n_type == free_block) return -1;
-
-	int count = 0;
-	for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+	for(size_t i = 0; i < count; i++)
 	{
-		if(inode->direct_blocks[i] != -1) count++;
+		unlock_inode(fs, entries[i].num);
 	}
-	return count;
 }
 
-int find_free_block(file_system* fs)
+/*
+ * lists inode_num and every node below it, each once and every parent before its children.
+ * The list is its own work queue, so the depth of the tree doesn't matter. With lock set every
+ * node is read-locked before it is listed and stays locked until unlock_tree_entries
+ * returns the number of entries with *entries set to the malloc'ed list, -1 if there is no memory
+ */
+long collect_tree(file_system *fs, int inode_num, int lock, tree_entry **entries)
 {
-	int num_blocks = fs->s_block->num_blocks;
-	if(num_blocks == 0) return -1;
-	for(int i = 0; i < num_blocks; i++)
+	size_t cap = 16;
+	size_t count = 0;
+	tree_entry* list = malloc(cap * sizeof(tree_entry));
+	if(list == NULL) return -1;
+	list[count++] = (tree_entry){inode_num, -1};
+
+	for(size_t next = 0; next < count; next++)
 	{
-		if(fs->free_list[i] == 1) return i;
+		if(lock) lock_inode_read(fs, list[next].num);
+		if(inode_ptr_at_num(fs, list[next].num)->n_type != directory) continue;
+
+		dir_iter iter;
+		dir_iter_init(&iter, list[next].num);
+		int child_num;
+		while((child_num = dir_iter_next(fs, &iter)) != -1)
+		{
+			if(count == cap)
+			{
+				tree_entry* grown = realloc(list, cap * 2 * sizeof(tree_entry));
+				if(grown == NULL)
+				{
+					if(lock) unlock_tree_entries(fs, list, next + 1);
+					free(list);
+					return -1;
+				}
+				list = grown;
+				cap *= 2;
+			}
+			list[count++] = (tree_entry){child_num, next};
+		}
 	}
-	return -1;
-}
 
-data_block* data_block_at_num(file_system* fs, int num)
-{
-	return &fs->data_blocks[num];
+	*entries = list;
+	return count;
 }
 
-int
-fs_cp(file_system *fs, char *src_path, char *dst_path_and_name)
-{
-	// Get size of paths
-	size_t size_of_src_path = strlen(src_path);
-	size_t size_of_dst_path = strlen(dst_path_and_name);
-
-	// Get src item
-	int src_inode_num = traverse_path(fs, src_path, size_of_src_path);
-	if(src_inode_num == -1) return -1;
-
-	inode* src_inode = inode_ptr_at_num(fs, src_inode_num);
-	
-	// Get dst parent
-	int dst_parent_inode_num = traverse_path_parent(fs, dst_path_and_name, size_of_dst_path);
-	if(dst_parent_inode_num == -1) return -1;
-	inode* dst_parent_inode = inode_ptr_at_num(fs, dst_parent_inode_num);
-
-	// Get new name and check for dupe in new parent
-	char* new_name = get_name(dst_path_and_name, size_of_dst_path);
-	if (new_name == NULL) return -1;
+int remove_node(file_system *fs, int parent_num, int inode_num);
 
-	if(find_child_with_name(fs, dst_parent_inode, new_name) != -1)
-	{
-		free(new_name);
-		return -2;
-	} 
+/*
+ * creates a copy of the node src_num without its children in the directory parent_num,
+ * -1 leaves the copy unlinked for the caller to add it.
+ * The data blocks of a file are shared with the source, they are copied once either side
+ * changes them. Only a block that has run out of references is copied right away
+ * returns the new inode number or -1
+ */
+int copy_node(file_system *fs, int src_num, int parent_num, const char *name, size_t name_len)
+{
+	inode* src_inode = inode_ptr_at_num(fs, src_num);
 
 	// Create new inode
-	int new_inode_num = find_free_inode(fs);
-	if(new_inode_num == -1)
-	{
-		free(new_name);
-		return -1;
-	} 
+	int new_inode_num = claim_inode(fs, src_inode->n_type);
+	if(new_inode_num == -1) return -1;
 
 	inode* new_inode = inode_ptr_at_num(fs, new_inode_num);
-	inode_init(new_inode);
-
-
-	new_inode->n_type = src_inode->n_type;
 	new_inode->size = src_inode->size;
-	strcpy(new_inode->name, new_name);
-	new_inode->parent = dst_parent_inode_num;
-
-	// Add new inode to parent's direct block
-	dst_parent_inode->direct_blocks[find_direct_block_with_val(fs, dst_parent_inode, -1)] = new_inode_num;
+	memcpy(new_inode->name, name, name_len);
+	new_inode->name[name_len] = '\0';
+	new_inode->parent = parent_num;
 
-	if(new_inode->n_type == reg_file)
+	// Add new inode to parent
+	if(parent_num != -1 && dir_add(fs, parent_num, new_inode_num) == -1)
 	{
-		int used_blocks = count_direct_block(src_inode);
-		if(used_blocks > fs->s_block->free_blocks) {
-
-			free(new_name);
-			return -1;
-		}
+		release_inode(fs, new_inode_num);
+		return -1;
+	}
+	mark_inode_dirty(fs, new_inode_num);
+	if(new_inode->n_type != reg_file) return new_inode_num;
 
-		for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+	uint32_t logical = 0;
+	uint32_t run_length;
+	int run_start;
+	while((run_length = extent_get_run(fs, src_num, logical, &run_start)) > 0)
+	{
+		for(uint32_t i = 0; i < run_length; i++, logical++)
 		{
-			if(src_inode->direct_blocks[i] == -1) break;
-
-			int free_block_num = find_free_block(fs);
-			if(free_block_num == -1) 
-			{
-				memset(new_inode->name, 0, NAME_MAX_LENGTH);
-				new_inode->n_type = free_block;
-				free(new_name);
-				return -1;
-			}
-			new_inode->direct_blocks[i] = free_block_num;
-
-			data_block* new_data_block = data_block_at_num(fs, free_block_num);
-			data_block* src_data_block = data_block_at_num(fs, src_inode->direct_blocks[i]);
-
+			data_block* src_data_block = data_block_at_num(fs, run_start + i);
 			if(src_data_block->size > BLOCK_SIZE)
 			{
-				memset(new_inode->name, 0, NAME_MAX_LENGTH);
-				new_inode->n_type = free_block;
-				free(new_name);
+				remove_node(fs, parent_num, new_inode_num);
 				return -1;
 			} 
-			fs->s_block->free_blocks--;
-			new_data_block->size = src_data_block->size;
-			memcpy(new_data_block->block, src_data_block->block, new_data_block->size);
-			fs->free_list[free_block_num] = 0;
-		}
-	} 
-	else if(new_inode->n_type == directory)
-	{
-		for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
-		{
-			if(src_inode->direct_blocks[i] == -1) continue;
-			inode* child = inode_ptr_at_num(fs, src_inode->direct_blocks[i]);
-
-			char child_src_path[256];
-			snprintf(child_src_path, sizeof(child_src_path), "%s/%s", src_path, child->name);
 
-			char child_dst_path[256];
-			snprintf(child_dst_path, sizeof(child_dst_path), "%s/%s", dst_path_and_name, child->name);
+			int block_num = run_start + i;
+			if(share_block(fs, block_num) == -1)
+			{
+				if(alloc_run(fs, -1, 1, &block_num) == 0)
+				{
+					remove_node(fs, parent_num, new_inode_num);
+					return -1;
+				}
+				data_block* new_data_block = data_block_at_num(fs, block_num);
+				new_data_block->size = src_data_block->size;
+				memcpy(new_data_block->block, src_data_block->block, new_data_block->size);
+				mark_data_block_dirty(fs, block_num);
+			}
 
-			if (fs_cp(fs, child_src_path, child_dst_path) == -1) 
+			if(extent_add_block(fs, new_inode_num, logical, block_num) == -1)
 			{
-				memset(new_inode->name, 0, NAME_MAX_LENGTH);
-				new_inode->n_type = free_block;
-    			free(new_name);
-    			return -1;
+				release_block(fs, block_num);
+				remove_node(fs, parent_num, new_inode_num);
+				return -1;
 			}
 		}
 	}
-	
-	free(new_name);
-	return 0;
+	return new_inode_num;
 }
 
-typedef struct _queue_object {
-	int num;
-	struct _queue_object *next;
-} queue_object;
-
-int queue_add(int num, queue_object *queue)
+int copy_path(file_system *fs, char *src_path, char *dst_path_and_name)
 {
-	if(queue == NULL) return -1;
+	// Get src item
+	int src_inode_num = traverse_path(fs, src_path, strlen(src_path));
+	if(src_inode_num == -1) return -1;
 	
-	queue_object* new = malloc(sizeof(queue_object));
-	if(new == NULL) return -1;
+	// Get dst parent, new name and check for dupe in new parent
+	path_lookup dst;
+	if(resolve_path(fs, dst_path_and_name, strlen(dst_path_and_name), &dst) == 0) return (dst.parent != -1) ? -2 : -1;
+	if(dst.parent == -1 || dst.name_len == 0 || dst.name_len >= NAME_MAX_LENGTH) return -1;
+	if(inode_ptr_at_num(fs, dst.parent)->n_type != directory) return -1;
+
+	// The source tree is listed and read-locked before anything is copied, so the copy is a snapshot
+	// and a directory copied into itself stays finite
+	tree_entry* entries;
+	long count = collect_tree(fs, src_inode_num, 1, &entries);
+	if(count == -1) return -1;
+	int* copies = malloc(count * sizeof(int));
+	int ret = (copies != NULL) ? 0 : -1;
+
+	// Parents come first, so the directory for every copy exists already. The copy stays unlinked
+	// until it is complete, nobody else can reach it meanwhile
+	for(long i = 0; ret == 0 && i < count; i++)
+	{
+		const char* name = (i == 0) ? dst.name : inode_ptr_at_num(fs, entries[i].num)->name;
+		size_t name_len = (i == 0) ? dst.name_len : strlen(name);
+		int parent_num = (i == 0) ? -1 : copies[entries[i].parent];
+		copies[i] = copy_node(fs, entries[i].num, parent_num, name, name_len);
+		if(copies[i] == -1)
+		{
+			if(i > 0) remove_node(fs, -1, copies[0]);
+			ret = -1;
+		}
+	}
+	unlock_tree_entries(fs, entries, count);
 
-	new->num = num;
-	new->next = queue->next;
-	queue->next = new;
-	return 0;
-}
+	// The source locks are gone before the destination is locked, it may lie inside the source
+	if(ret == 0)
+	{
+		lock_inode_write(fs, dst.parent);
+		// Another thread may have created the same name since it was looked up
+		if(fs->locks != NULL && dir_lookup(fs, dst.parent, dst.name, dst.name_len) != -1) ret = -2;
+		else
+		{
+			inode_ptr_at_num(fs, copies[0])->parent = dst.parent;
+			ret = dir_add(fs, dst.parent, copies[0]);
+		}
+		if(ret == 0) mark_inode_dirty(fs, copies[0]);
+		else remove_node(fs, -1, copies[0]);
+		unlock_inode(fs, dst.parent);
+	}
 
-int sort_add(int n, queue_object* queue)
-{
-	queue_object* num_to_check = queue;
-    while(num_to_check->next != NULL &&
-          (num_to_check->next->num < n))
-    {
-        num_to_check = num_to_check->next;
-    }
-    return queue_add(n, num_to_check);
+	free(copies);
+	free(entries);
+	return ret;
 }
 
-queue_object* queue_poll(queue_object *queue)
+int
+fs_cp(file_system *fs, char *src_path, char *dst_path_and_name)
 {
-	// TODO
-	if(queue->next == NULL || queue == NULL) return NULL;
-
-	queue_object* first = queue->next;
-	if(first->next == NULL) queue->next = NULL;
-	else queue->next = first->next;
-	return first;
+	// Only adds nodes, the source and destination are locked node by node
+	lock_journal(fs);
+	lock_tree_read(fs);
+	int ret = copy_path(fs, src_path, dst_path_and_name);
+	journal_log(fs, j_cp, src_path, dst_path_and_name, NULL, 0);
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return ret;
 }
 
-queue_object *new_queue()
+static int compare_inode_nums(const void *a, const void *b)
 {
-	queue_object* queue = malloc(sizeof(queue_object));
-	if(queue == NULL) return NULL;
-	queue->num = -1;
-	queue->next = NULL;
-	return queue;
+	int x = *(const int*)a;
+	int y = *(const int*)b;
+	return (x > y) - (x < y);
 }
 
-void free_queue(queue_object *queue)
+/*
+ * opens the directory inode_num for fs_dir_next
+ * returns 0 on success, -1 if there is no memory
+ */
+int dir_open_inode(file_system *fs, int inode_num, fs_dir *dir)
 {
-	if(queue == NULL) return;
-	queue_object* item_to_free = queue;
-	while (item_to_free->next != NULL)
+	uint32_t count = dir_count(fs, inode_num);
+	dir->children = NULL;
+	int *children = dir->inline_children;
+	if(count > DIRECT_BLOCKS_COUNT)
+	{
+		children = dir->children = malloc(count * sizeof(int));
+		if(children == NULL) return -1;
+	}
+
+	dir_iter iter;
+	dir_iter_init(&iter, inode_num);
+	int child_num;
+	dir->count = 0;
+	while(dir->count < count && (child_num = dir_iter_next(fs, &iter)) != -1)
 	{
-		queue = queue->next;
-		free(item_to_free);
-		item_to_free = queue;
+		children[dir->count++] = child_num;
 	}
-	free(item_to_free);
+	qsort(children, dir->count, sizeof(int), compare_inode_nums);
+
+	dir->dir = inode_num;
+	dir->pos = 0;
+	return 0;
 }
 
-void string_from_item(queue_object* queue_item, file_system* fs, char* buffer, size_t buffer_size)
+/*
+ * opens the directory pointed to by path for dir_next, the caller holds the tree lock
+ * returns 0 on success, -1 if the path is not a directory or there is no memory
+ */
+int dir_open_path(file_system *fs, char *path, fs_dir *dir)
 {
-	if (queue_item == NULL) return;
+	int inode_num = traverse_path(fs, path, strlen(path));
+	if(inode_num == -1) return -1;
 
-	int inode_num = queue_item->num;
-	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
+	lock_inode_read(fs, inode_num);
+	int ret = (inode_ptr_at_num(fs, inode_num)->n_type == directory) ? dir_open_inode(fs, inode_num, dir) : -1;
+	unlock_inode(fs, inode_num);
+	return ret;
+}
 
-	char line[NAME_MAX_LENGTH + 6];
+int
+fs_dir_open(file_system *fs, char *path, fs_dir *dir)
+{
+	lock_tree_read(fs);
+	int ret = dir_open_path(fs, path, dir);
+	unlock_tree(fs);
+	return ret;
+}
 
-	if(inode_ptr->n_type == directory)
-	{
-		snprintf(line, sizeof(line), "DIR %s\n", inode_ptr->name);
-	}
-	else if(inode_ptr->n_type == reg_file)
+/*
+ * fs_dir_next without locking, the caller holds the tree lock and the directory
+ */
+fs_dirent *dir_next(file_system *fs, fs_dir *dir)
+{
+	const int *children = dir->children != NULL ? dir->children : dir->inline_children;
+	while(dir->pos < dir->count)
 	{
-		snprintf(line, sizeof(line), "FIL %s\n", inode_ptr->name);
+		int child_num = children[dir->pos++];
+		inode* child = inode_ptr_at_num(fs, child_num);
+		if(child->n_type == free_block || child->parent != dir->dir) continue;
+
+		dir->entry.inode = child_num;
+		dir->entry.type = child->n_type;
+		dir->entry.name = child->name;
+		return &dir->entry;
 	}
-
-	strncat(buffer, line, buffer_size - strlen(buffer) - 1);
+	return NULL;
 }
 
-void string_from_queue(queue_object* queue, file_system* fs, char* buffer, size_t buffer_size)
+fs_dirent *
+fs_dir_next(file_system *fs, fs_dir *dir)
 {
-	if(queue == NULL || queue->next == NULL) return;
-	queue_object* item = queue_poll(queue);
+	// Children are added under the directory's lock and only removed under the tree lock
+	lock_tree_read(fs);
+	lock_inode_read(fs, dir->dir);
+	fs_dirent* entry = dir_next(fs, dir);
+	unlock_inode(fs, dir->dir);
+	unlock_tree(fs);
+	return entry;
+}
 
-	while (item != NULL)
-	{
-		string_from_item(item, fs, buffer, buffer_size);
-		free(item);
-		item = queue_poll(queue);
-	}
+void
+fs_dir_close(fs_dir *dir)
+{
+	free(dir->children);
+	dir->children = NULL;
+	dir->count = 0;
 }
 
 char *
 fs_list(file_system *fs, char *path)
-{                 
-	char *result = malloc(4096);
-	if (result == NULL) return NULL;
-	result[0] = '\0';
-
-	queue_object* queue = new_queue();
-	if (queue == NULL)
-	{
-		free(result);
-		return NULL;
-	} 
-	
-	int inode_num = traverse_path(fs, path, strlen(path));
-	if(inode_num == -1) 
+{
+	lock_tree_read(fs);
+	fs_dir dir;
+	if(dir_open_path(fs, path, &dir) == -1)
 	{
-		free(result);
-		free_queue(queue);
+		unlock_tree(fs);
 		return NULL;
 	}
 
-	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
-
-	for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+	size_t cap = 256;
+	size_t len = 0;
+	char *result = malloc(cap);
+	fs_dirent* entry;
+	lock_inode_read(fs, dir.dir);
+	while(result != NULL && (entry = dir_next(fs, &dir)) != NULL)
 	{
-		if(inode_ptr->direct_blocks[i] == -1) continue;
-		if(sort_add(inode_ptr->direct_blocks[i], queue) == -1)
+		if(entry->type != directory && entry->type != reg_file) continue;
+
+		// "DIR " or "FIL ", the name and a newline, the buffer doubles as needed
+		size_t line_len = 4 + strlen(entry->name) + 1;
+		if(len + line_len + 1 > cap)
 		{
-			free(result);
-			free_queue(queue);
-			return NULL;
+			while(len + line_len + 1 > cap) cap *= 2;
+			char *grown = realloc(result, cap);
+			if(grown == NULL) free(result);
+			result = grown;
+			if(result == NULL) break;
 		}
+		len += sprintf(result + len, "%s %s\n", (entry->type == directory) ? "DIR" : "FIL", entry->name);
 	}
-	if(queue->next == NULL)
+	unlock_inode(fs, dir.dir);
+	unlock_tree(fs);
+	fs_dir_close(&dir);
+
+	// An empty directory has no listing
+	if(result != NULL && len == 0)
 	{
 		free(result);
-		free_queue(queue);
 		return NULL;
 	}
-
-	string_from_queue(queue, fs, result, 4096);
-	free_queue(queue);
 	return result;
 }
 
-int
-fs_writef(file_system *fs, char *filename, char *text)
+typedef struct _walk_frame {
+	fs_dir dir;
+	size_t path_len; //length of the directory's path in the path buffer
+	int depth;
+} walk_frame;
+
+/*
+ * makes sure the path buffer can hold len bytes
+ * returns 0 on success, -1 if there is no memory
+ */
+int reserve_path(char **path, size_t *cap, size_t len)
 {
-	// Get inode number
-	int inode_num = traverse_path(fs, filename, strlen(filename));
-	if(inode_num == -1) return -1;
+	if(len <= *cap) return 0;
+	size_t new_cap = *cap;
+	while(new_cap < len) new_cap *= 2;
+	char* grown = realloc(*path, new_cap);
+	if(grown == NULL) return -1;
+	*path = grown;
+	*cap = new_cap;
+	return 0;
+}
 
-	// Get inode pointer and check if inode is a file
-	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
-	if(inode_ptr->n_type != reg_file) return -1;
+/*
+ * opens node for the walk if it is a directory. No lock is held while the callback runs,
+ * so the callback may change the fs
+ * returns 1 if the directory was opened, 0 if node is no directory, -1 if there is no memory
+ */
+int walk_open(file_system *fs, int node, fs_dir *dir)
+{
+	lock_tree_read(fs);
+	lock_inode_read(fs, node);
+	int ret = (inode_ptr_at_num(fs, node)->n_type == directory) ? 1 : 0;
+	if(ret == 1 && dir_open_inode(fs, node, dir) == -1) ret = -1;
+	unlock_inode(fs, node);
+	unlock_tree(fs);
+	return ret;
+}
 
-	// Variables for writing
-	int text_length = strlen(text);
-	int current_size = inode_ptr->size;						// How big the file currently is
-	int last_block_index = current_size / BLOCK_SIZE;		// Index of the last written in data_block
-	int offset_in_last_block = current_size % BLOCK_SIZE;	// Offset in last written in block
+int
+fs_walk(file_system *fs, char *root, int flags, fs_walk_fn callback, void *ctx)
+{
+	lock_tree_read(fs);
+	int root_num = traverse_path(fs, root, strlen(root));
+	unlock_tree(fs);
+	if(root_num == -1) return -1;
+	int post = flags & FS_WALK_POST;
+	int max_depth = (flags >> FS_WALK_DEPTH_SHIFT) - 1; //-1 without a limit
+
+	// One path buffer for the whole walk, each level appends "/<name>" behind its parent
+	size_t path_len = strlen(root);
+	while(path_len > 1 && root[path_len - 1] == '/') path_len--;
+	size_t path_cap = 256;
+	char* path = malloc(path_cap);
+	if(path == NULL || reserve_path(&path, &path_cap, path_len + 1) == -1)
+	{
+		free(path);
+		return -1;
+	}
+	memcpy(path, root, path_len);
+	path[path_len] = '\0';
 
-	int written = 0; // How much data has been written
+	size_t frames_cap = 16;
+	size_t frames_count = 0;
+	walk_frame* frames = malloc(frames_cap * sizeof(walk_frame));
 
-	// If there has already been data in inode
-	if(current_size > 0 && offset_in_last_block != 0)
+	int ret = (frames != NULL) ? 0 : -1;
+	int node = root_num;
+	int depth = 0;
+	while(ret == 0)
 	{
-		// Get last written data block and its index in fs
-		int block_num = inode_ptr->direct_blocks[last_block_index];
-		data_block* block = data_block_at_num(fs, block_num);
+		// Enter node, its path is in the buffer
+		int action = post ? FS_WALK_CONTINUE : callback(fs, node, path, depth, ctx);
+		if(action == FS_WALK_STOP)
+		{
+			ret = 1;
+			break;
+		}
+		int descend = 0;
+		if(action != FS_WALK_PRUNE && (max_depth < 0 || depth < max_depth))
+		{
+			if(frames_count == frames_cap)
+			{
+				walk_frame* grown = realloc(frames, frames_cap * 2 * sizeof(walk_frame));
+				if(grown == NULL)
+				{
+					ret = -1;
+					break;
+				}
+				frames = grown;
+				frames_cap *= 2;
+			}
+			walk_frame* frame = &frames[frames_count];
+			descend = walk_open(fs, node, &frame->dir);
+			if(descend == -1)
+			{
+				ret = -1;
+				break;
+			}
+			if(descend)
+			{
+				frame->path_len = (path_len == 1) ? 0 : path_len; //the root is "/", not "" plus "/"
+				frame->depth = depth;
+				frames_count++;
+			}
+		}
+		if(!descend && post && callback(fs, node, path, depth, ctx) == FS_WALK_STOP)
+		{
+			ret = 1;
+			break;
+		}
 
-		// Check for space left in data block and how much data fits there
-		int space_left = BLOCK_SIZE - offset_in_last_block;
-		int copy_size = (text_length < space_left) ? text_length : space_left;
-		
-		// Copy data to data block
-		memcpy(block->block + offset_in_last_block, text, copy_size);
-		
-		// Mark data block as used in fs
-		// fs->free_list[last_block_index] = 0;
+		// Find the next node, leaving every directory that is done
+		node = -1;
+		while(node == -1 && frames_count > 0)
+		{
+			walk_frame* frame = &frames[frames_count - 1];
+			fs_dirent* entry = fs_dir_next(fs, &frame->dir);
+			if(entry != NULL)
+			{
+				size_t name_len = strlen(entry->name);
+				if(reserve_path(&path, &path_cap, frame->path_len + name_len + 2) == -1)
+				{
+					ret = -1;
+					break;
+				}
+				path[frame->path_len] = '/';
+				memcpy(path + frame->path_len + 1, entry->name, name_len + 1);
+				path_len = frame->path_len + 1 + name_len;
+				node = entry->inode;
+				depth = frame->depth + 1;
+				continue;
+			}
 
-		// Get data block index in inode's direct block
-		int direct_block_num = find_direct_block_with_val(fs, inode_ptr, last_block_index);
-		if(direct_block_num == -1) direct_block_num = find_direct_block_with_val(fs, inode_ptr, -1);
+			fs_dir_close(&frame->dir);
+			frames_count--;
+			path_len = (frame->path_len == 0) ? 1 : frame->path_len;
+			path[path_len] = '\0';
+			if(post && callback(fs, frame->dir.dir, path, frame->depth, ctx) == FS_WALK_STOP)
+			{
+				ret = 1;
+				break;
+			}
+		}
+		if(node == -1) break;
+	}
 
-		// Assign data block to inode
-		inode_ptr->direct_blocks[direct_block_num] = last_block_index;
+	// A stopped walk leaves directories open
+	while(frames_count > 0)
+	{
+		fs_dir_close(&frames[--frames_count].dir);
+	}
+	free(frames);
+	free(path);
+	return ret;
+}
 
-		// Save how much data has been written
-		inode_ptr->size += copy_size;
-		block->size += copy_size;
-		written += copy_size;
+long
+fs_list_stat(file_system *fs, char *path, fs_stat *out, size_t cap)
+{
+	lock_tree_read(fs);
+	fs_dir dir;
+	if(dir_open_path(fs, path, &dir) == -1)
+	{
+		unlock_tree(fs);
+		return -1;
 	}
 
-	// Write the rest data in new data block if theres any
-	while (written < text_length)
+	long count = 0;
+	fs_dirent* entry;
+	lock_inode_read(fs, dir.dir);
+	while((entry = dir_next(fs, &dir)) != NULL)
 	{
-		// Get free data block with smallest index
-		int free_block_num = find_free_block(fs);
-		if(free_block_num == -1) return -2;
-		data_block* new_block = data_block_at_num(fs, free_block_num);
+		if(count < cap)
+		{
+			// The child's content may be written meanwhile
+			lock_inode_read(fs, entry->inode);
+			inode* child = inode_ptr_at_num(fs, entry->inode);
+			fs_stat* stat = &out[count];
+			stat->inode = entry->inode;
+			stat->type = entry->type;
+			stat->size = child->size;
+			// Files have no holes, so their size tells the number of blocks
+			stat->blocks = (entry->type == directory) ? dir_block_count(fs, entry->inode) : (child->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			memcpy(stat->name, child->name, NAME_MAX_LENGTH);
+			unlock_inode(fs, entry->inode);
+		}
+		count++;
+	}
+	unlock_inode(fs, dir.dir);
+	unlock_tree(fs);
+	fs_dir_close(&dir);
+	return count;
+}
+
+/*
+ * writes len bytes of buf at offset into the file inode_num. Existing blocks are overwritten
+ * in place, blocks are only allocated behind the end of the file. A gap between the end
+ * of the file and offset is filled with zeros
+ * returns the number of written bytes or -2 if the file system is full
+ */
+long write_at(file_system *fs, int inode_num, uint64_t offset, const uint8_t *buf, size_t len)
+{
+	if(len == 0) return 0;
+	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
+	mark_inode_dirty(fs, inode_num);
 
-		// Mark data block as used in fs
-		fs->free_list[free_block_num] = 0;
-		fs->s_block->free_blocks--;
+	uint64_t end = offset + len;
+	uint64_t pos = MIN(offset, inode_ptr->size); // The gap has to be written as well
 
-		// Get data block index in inode's direct block
-		int new_block_num = inode_ptr->size / BLOCK_SIZE;
-		// If data too big return -1
-		if(new_block_num >= DIRECT_BLOCKS_COUNT) return -2;
-		// Assign data block to inode
-		inode_ptr->direct_blocks[new_block_num] = free_block_num;
+	// Blocks shared with a copy are replaced by private ones before they are changed
+	uint64_t touched_end = MIN(end, inode_ptr->size);
+	if(unshare_range(fs, inode_num, pos / BLOCK_SIZE, (touched_end + BLOCK_SIZE - 1) / BLOCK_SIZE) == -1) return -2;
+	while(pos < end)
+	{
+		// Take the run of existing blocks at pos or append a new block
+		uint32_t logical = pos / BLOCK_SIZE;
+		int run_start;
+		uint32_t run_length = (pos < inode_ptr->size || pos % BLOCK_SIZE != 0) ? extent_get_run(fs, inode_num, logical, &run_start) : 0;
+		if(run_length == 0)
+		{
+			// Ask for all blocks up to the end at once
+			run_length = append_run(fs, inode_num, logical, (end + BLOCK_SIZE - 1) / BLOCK_SIZE - logical, &run_start);
+			if(run_length == 0) return -2;
+		}
 
-		// Copy data to data block
-		int copy_size = (text_length - written < BLOCK_SIZE) ? text_length - written : BLOCK_SIZE;
-		memcpy(new_block->block, text + written, copy_size);
+		for(uint32_t i = 0; i < run_length && pos < end; i++)
+		{
+			data_block* block = data_block_at_num(fs, run_start + i);
+			uint64_t block_start = (uint64_t)(logical + i) * BLOCK_SIZE;
+			uint64_t block_end = MIN(block_start + BLOCK_SIZE, end);
 
-		// Save how much data has been written
-		new_block->size = copy_size;
-		written += copy_size;
+			// Zeros up to offset, then the data
+			if(pos < offset)
+			{
+				uint64_t gap_end = MIN(offset, block_end);
+				memset(block->block + (pos - block_start), 0, gap_end - pos);
+				pos = gap_end;
+			}
+			if(pos < block_end)
+			{
+				memcpy(block->block + (pos - block_start), buf + (pos - offset), block_end - pos);
+				pos = block_end;
+			}
 
-		// Change inode size
-		inode_ptr->size += copy_size;
+			// Keep the sizes of block and inode up to date, they only grow
+			block->size = MAX(block->size, block_end - block_start);
+			inode_ptr->size = MAX(inode_ptr->size, block_end);
+			mark_data_block_dirty(fs, run_start + i);
+		}
 	}
 
-	return written;
+	return len;
 }
 
-uint8_t *
-fs_readf(file_system *fs, char *filename, int *file_size)
+int write_text(file_system *fs, char *filename, char *text)
 {
+	// Get inode number
 	int inode_num = traverse_path(fs, filename, strlen(filename));
-	if(inode_num == -1) return NULL;
+	if(inode_num == -1) return -1;
+
+	// Get inode pointer and check if inode is a file
+	lock_inode_write(fs, inode_num);
+	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
+	int ret = -1;
+
+	// Append
+	if(inode_ptr->n_type == reg_file) ret = write_at(fs, inode_num, inode_ptr->size, (uint8_t*)text, strlen(text));
+	unlock_inode(fs, inode_num);
+	return ret;
+}
+
+int
+fs_writef(file_system *fs, char *filename, char *text)
+{
+	lock_journal(fs);
+	lock_tree_read(fs);
+	int ret = write_text(fs, filename, text);
+	if(text != NULL)
+	{
+		struct iovec data = {text, strlen(text) + 1};
+		journal_log(fs, j_writef, filename, NULL, &data, 1);
+	}
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return ret;
+}
+
+long
+fs_pwrite(file_system *fs, char *path, uint64_t offset, const uint8_t *buf, size_t len)
+{
+	lock_journal(fs);
+	lock_tree_read(fs);
+	int inode_num = traverse_path(fs, path, strlen(path));
+	long ret = -1;
+	if(inode_num != -1)
+	{
+		lock_inode_write(fs, inode_num);
+		inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
+		if(inode_ptr->n_type == reg_file && offset + len >= offset)
+		{
+			// A write far behind the end would fill the image with its gap, fail before taking any block
+			uint64_t have = (inode_ptr->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			uint64_t reach = offset / BLOCK_SIZE + 1;
+			ret = (len > 0 && reach > have && reach - have > free_block_count(fs)) ? -2 : write_at(fs, inode_num, offset, buf, len);
+		}
+		unlock_inode(fs, inode_num);
+	}
+
+	struct iovec data[2] = {{&offset, sizeof(offset)}, {(uint8_t*)buf, len}};
+	journal_log(fs, j_pwrite, path, NULL, data, 2);
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return ret;
+}
+
+/*
+ * copies the iovcnt buffers of iov, total bytes together, behind the end of the file inode_num.
+ * The blocks behind the last partial block are reserved run by run first, then everything is
+ * filled front to back
+ * returns the number of written bytes or -2 if the file system is full
+ */
+long append_iovecs(file_system *fs, int inode_num, const struct iovec *iov, int iovcnt, uint64_t total)
+{
+	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
+	mark_inode_dirty(fs, inode_num);
+
+	// Reserve the tail, what fits is written even if not everything does
+	uint64_t size = inode_ptr->size;
+	uint64_t first_new = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	uint64_t last = (size + total + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if(total > 0 && unshare_range(fs, inode_num, size / BLOCK_SIZE, first_new) == -1) return -2;
+	uint64_t reserved = first_new;
+	while(reserved < last)
+	{
+		int run_start;
+		uint32_t run_length = append_run(fs, inode_num, reserved, last - reserved, &run_start);
+		if(run_length == 0) break;
+		reserved += run_length;
+	}
+	uint64_t end = MIN(size + total, reserved * BLOCK_SIZE);
+
+	// Fill run by run, taking the bytes from the buffers in order
+	uint64_t pos = size;
+	int cur = 0;
+	size_t cur_done = 0;
+	while(pos < end)
+	{
+		int run_start;
+		uint32_t run_length = extent_get_run(fs, inode_num, pos / BLOCK_SIZE, &run_start);
+		for(uint32_t i = 0; i < run_length && pos < end; i++)
+		{
+			data_block* block = data_block_at_num(fs, run_start + i);
+			uint64_t block_start = pos - pos % BLOCK_SIZE;
+			uint64_t block_end = MIN(block_start + BLOCK_SIZE, end);
+			while(pos < block_end && cur < iovcnt)
+			{
+				size_t copy_size = MIN(iov[cur].iov_len - cur_done, block_end - pos);
+				memcpy(block->block + (pos - block_start), (uint8_t*)iov[cur].iov_base + cur_done, copy_size);
+				pos += copy_size;
+				cur_done += copy_size;
+				if(cur_done == iov[cur].iov_len)
+				{
+					cur++;
+					cur_done = 0;
+				}
+			}
+			block->size = block_end - block_start;
+			mark_data_block_dirty(fs, run_start + i);
+		}
+	}
+
+	inode_ptr->size = end;
+	return (end == size + total) ? (long)total : -2;
+}
+
+long
+fs_writev(file_system *fs, char *path, const struct iovec *iov, int iovcnt)
+{
+	lock_journal(fs);
+	lock_tree_read(fs);
+	int inode_num = traverse_path(fs, path, strlen(path));
+	long ret = -1;
+	if(inode_num != -1)
+	{
+		lock_inode_write(fs, inode_num);
+		if(inode_ptr_at_num(fs, inode_num)->n_type == reg_file && iovcnt >= 0)
+		{
+			uint64_t total = 0;
+			for(int i = 0; i < iovcnt; i++)
+			{
+				total += iov[i].iov_len;
+			}
+			if(total <= LONG_MAX) ret = append_iovecs(fs, inode_num, iov, iovcnt, total);
+		}
+		unlock_inode(fs, inode_num);
+	}
+
+	// Logged like a single buffer, the replay appends them as one
+	journal_log(fs, j_writev, path, NULL, iov, MAX(iovcnt, 0));
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return ret;
+}
+
+/*
+ * fs_readf on the file inode_num, the caller holds its lock
+ */
+uint8_t *read_file(file_system *fs, int inode_num, int *file_size)
+{
 	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
 	if(inode_ptr->n_type != reg_file) return NULL;
 	
 	*file_size = 0;
-	int size = inode_ptr->size;
-	if(size > BLOCK_SIZE * DIRECT_BLOCKS_COUNT || size == 0) return NULL;
+	uint64_t size = inode_ptr->size;
+	if(size > INT_MAX || size == 0) return NULL;
 	*file_size = size;
 
 	uint8_t *result = malloc(size);
 	if(result == NULL) return NULL;
 
-	int copied = 0;
-	for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+	uint64_t copied = 0;
+	uint32_t logical = 0;
+	uint32_t run_length;
+	int run_start;
+	while(copied < size && (run_length = extent_get_run(fs, inode_num, logical, &run_start)) > 0)
 	{
-		int data_block_index = inode_ptr->direct_blocks[i];
-		if(data_block_index == -1) break;
-
-		data_block* data_block = data_block_at_num(fs, data_block_index);
-		int to_copy = (size - copied < BLOCK_SIZE) ? size - copied : BLOCK_SIZE;
-		memcpy(result + copied, data_block->block, to_copy);
-		copied += to_copy;
+		// The blocks of a run lie next to each other, so they are copied without another lookup
+		for(uint32_t i = 0; i < run_length && copied < size; i++)
+		{
+			data_block* data_block = data_block_at_num(fs, run_start + i);
+			uint64_t to_copy = MIN(size - copied, BLOCK_SIZE);
+			memcpy(result + copied, data_block->block, to_copy);
+			copied += to_copy;
+		}
+		logical += run_length;
 	}
 
 	return result;
 }
 
+uint8_t *
+fs_readf(file_system *fs, char *filename, int *file_size)
+{
+	lock_tree_read(fs);
+	int inode_num = traverse_path(fs, filename, strlen(filename));
+	uint8_t *result = NULL;
+	if(inode_num != -1)
+	{
+		lock_inode_read(fs, inode_num);
+		result = read_file(fs, inode_num, file_size);
+		unlock_inode(fs, inode_num);
+	}
+	unlock_tree(fs);
+	return result;
+}
 
-int
-fs_rm(file_system *fs, char *path)
+
+/*
+ * fs_pread on the file inode_num, the caller holds its lock
+ */
+long read_range(file_system *fs, int inode_num, uint64_t offset, size_t len, uint8_t *buf)
 {
-	int parent_inode_num = traverse_path_parent(fs, path, strlen(path));
-	if(parent_inode_num == -1) return -1;
-	
-	inode* parent_inode_ptr = inode_ptr_at_num(fs, parent_inode_num);
-	
+	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
+	if(inode_ptr->n_type != reg_file) return -1;
+
+	// Nothing behind the end of the file
+	if(offset >= inode_ptr->size) return 0;
+	len = MIN(MIN(len, inode_ptr->size - offset), LONG_MAX);
+
+	// Only the blocks covering the range are touched
+	size_t copied = 0;
+	uint32_t logical = offset / BLOCK_SIZE;
+	size_t in_block = offset % BLOCK_SIZE;
+	uint32_t run_length;
+	int run_start;
+	while(copied < len && (run_length = extent_get_run(fs, inode_num, logical, &run_start)) > 0)
+	{
+		for(uint32_t i = 0; i < run_length && copied < len; i++)
+		{
+			data_block* block = data_block_at_num(fs, run_start + i);
+			size_t to_copy = MIN(len - copied, BLOCK_SIZE - in_block);
+			memcpy(buf + copied, block->block + in_block, to_copy);
+			copied += to_copy;
+			in_block = 0;
+		}
+		logical += run_length;
+	}
+
+	return copied;
+}
+
+long
+fs_pread(file_system *fs, char *path, uint64_t offset, size_t len, uint8_t *buf)
+{
+	lock_tree_read(fs);
 	int inode_num = traverse_path(fs, path, strlen(path));
-	if(inode_num == -1) return -1;
+	long ret = -1;
+	if(inode_num != -1)
+	{
+		lock_inode_read(fs, inode_num);
+		ret = read_range(fs, inode_num, offset, len, buf);
+		unlock_inode(fs, inode_num);
+	}
+	unlock_tree(fs);
+	return ret;
+}
 
-	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
+/*
+ * points view at the bytes [offset, offset + len) of the file inode_num, one span per block.
+ * The range has to lie inside the file. With pin set the view takes a reference to every
+ * block, else the spans are only valid while the caller holds the file's lock
+ * returns 0 on success, -1 if there is no memory for the spans or a block can't be shared
+ */
+int view_inode(file_system *fs, int inode_num, uint64_t offset, size_t len, int pin, read_view *view)
+{
+	view->spans = NULL;
+	view->count = 0;
+	view->len = len;
+	view->fs = fs;
+	view->blocks = NULL;
+	if(len == 0) return 0;
+
+	size_t in_block = offset % BLOCK_SIZE;
+	uint64_t blocks = (in_block + len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	view->spans = malloc(blocks * sizeof(struct iovec));
+	if(pin) view->blocks = malloc(blocks * sizeof(int));
+	if(view->spans == NULL || (pin && view->blocks == NULL))
+	{
+		fs_release_view(view);
+		return -1;
+	}
 
-	if(inode_ptr->n_type == reg_file)
+	size_t queued = 0;
+	uint32_t logical = offset / BLOCK_SIZE;
+	uint32_t run_length;
+	int run_start;
+	while(queued < len && (run_length = extent_get_run(fs, inode_num, logical, &run_start)) > 0)
 	{
-		// Free direct blocks
-		for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+		for(uint32_t i = 0; i < run_length && queued < len; i++)
 		{
-			// Get block index
-			int block_index = inode_ptr->direct_blocks[i];
-			if(block_index == -1) continue;
+			if(pin && share_block(fs, run_start + i) == -1)
+			{
+				fs_release_view(view);
+				return -1;
+			}
+			if(pin) view->blocks[view->count] = run_start + i;
+			data_block* block = data_block_at_num(fs, run_start + i);
+			struct iovec* span = &view->spans[view->count++];
+			span->iov_base = block->block + in_block;
+			span->iov_len = MIN(len - queued, BLOCK_SIZE - in_block);
+			queued += span->iov_len;
+			in_block = 0;
+		}
+		logical += run_length;
+	}
+	view->len = queued;
+	return 0;
+}
+
+int
+fs_read_view(file_system *fs, char *path, uint64_t offset, size_t len, read_view *view)
+{
+	view->spans = NULL;
+	view->count = 0;
+	view->len = 0;
+	view->fs = fs;
+	view->blocks = NULL;
 
-			// Get block and reset block's data
-			data_block* block = data_block_at_num(fs, block_index);
-			block->size = 0;
-			memset(block->block, 0, BLOCK_SIZE);
-			
-			// Mark block as free in free_list and remove reference from inode
-			fs->free_list[block_index] = 1;
-			fs->s_block->free_blocks++;
-			inode_ptr->direct_blocks[i] = -1;
+	lock_tree_read(fs);
+	int inode_num = traverse_path(fs, path, strlen(path));
+	int ret = -1;
+	if(inode_num != -1)
+	{
+		// The spans outlive this call, the references keep the blocks as they are once the lock is gone
+		lock_inode_read(fs, inode_num);
+		inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
+		if(inode_ptr->n_type == reg_file)
+		{
+			ret = (offset < inode_ptr->size) ? view_inode(fs, inode_num, offset, MIN(len, inode_ptr->size - offset), 1, view) : 0;
 		}
+		unlock_inode(fs, inode_num);
 	}
-	else if (inode_ptr->n_type == directory)
+	unlock_tree(fs);
+	return ret;
+}
+
+void
+fs_release_view(read_view *view)
+{
+	for(int i = 0; view->blocks != NULL && i < view->count; i++)
 	{
-		for(int i = 0; i < DIRECT_BLOCKS_COUNT; i++)
+		release_block(view->fs, view->blocks[i]);
+	}
+	free(view->blocks);
+	free(view->spans);
+	view->spans = NULL;
+	view->blocks = NULL;
+	view->count = 0;
+	view->len = 0;
+}
+
+/*
+ * unlinks the node inode_num from the directory parent_num (-1 if it isn't linked) and
+ * gives it and everything below it back
+ * returns 0 on success, -1 if there is no memory to list the nodes, nothing is changed then
+ */
+int remove_node(file_system *fs, int parent_num, int inode_num)
+{
+	tree_entry* entries;
+	long count = collect_tree(fs, inode_num, 0, &entries);
+	if(count == -1) return -1;
+
+	// Remove reference from parent while the node still has its name
+	if(parent_num != -1) dir_remove(fs, parent_num, inode_num);
+
+	// Every node is on the list, so directories are dropped as a whole. Going backwards releases
+	// children before their parents, the top node's inode is reused first
+	for(long n = count - 1; n >= 0; n--)
+	{
+		int num = entries[n].num;
+		inode* inode_ptr = inode_ptr_at_num(fs, num);
+		if(inode_ptr->n_type == reg_file)
 		{
-			// Get child inode
-			if(inode_ptr->direct_blocks[i] == -1) continue;
-			inode* child = inode_ptr_at_num(fs, inode_ptr->direct_blocks[i]);
-			
-			// Build path for rm -r
-			char child_path[256];
-			snprintf(child_path, sizeof(child_path), "%s/%s", path, child->name);
+			uint32_t logical = 0;
+			uint32_t run_length;
+			int run_start;
+			while((run_length = extent_get_run(fs, num, logical, &run_start)) > 0)
+			{
+				for(uint32_t i = 0; i < run_length; i++)
+				{
+					// Get block and reset block's data, unless a copy still uses it
+					if(block_is_shared(fs, run_start + i)) continue;
+					data_block* block = data_block_at_num(fs, run_start + i);
+					block->size = 0;
+					memset(block->block, 0, BLOCK_SIZE);
+					mark_data_block_dirty(fs, run_start + i);
+				}
+				logical += run_length;
+			}
 
-			// Remove children recursively
-			if (fs_rm(fs, child_path) == -1) return -1;
-			inode_ptr->direct_blocks[i] = -1;
+			// Drop the references to the blocks, free them in free_list and remove them from the inode
+			extent_release(fs, num);
+		}
+		else if(inode_ptr->n_type == directory)
+		{
+			dir_clear(fs, num);
 		}
-	}
-	
-	// Reset inode's info
-	inode_ptr->n_type = free_block;
-	inode_ptr->size = 0;
-	memset(inode_ptr->name, 0, NAME_MAX_LENGTH);
-	inode_ptr->parent = -1;
 
-	// Remove reference from parent
-	int parent_direct_block_index = find_direct_block_with_val(fs, parent_inode_ptr, inode_num);
-	parent_inode_ptr->direct_blocks[parent_direct_block_index] = -1;
+		// Reset inode's info and give it back
+		release_inode(fs, num);
+	}
 
+	free(entries);
 	return 0;
 }
 
+int remove_path(file_system *fs, char *path)
+{
+	path_lookup lookup;
+	if(resolve_path(fs, path, strlen(path), &lookup) == -1 || lookup.parent == -1) return -1;
+	return remove_node(fs, lookup.parent, lookup.inode);
+}
+
 int
-fs_import(file_system *fs, char *int_path, char *ext_path)
+fs_rm(file_system *fs, char *path)
 {
-	FILE *ext_file = fopen(ext_path, "rb");
-    if (ext_file == NULL) return -1;
+	// Nobody may be inside the removed tree
+	lock_journal(fs);
+	lock_tree_write(fs);
+	int ret = remove_path(fs, path);
+	journal_log(fs, j_rm, path, NULL, NULL, 0);
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return ret;
+}
 
-	char buffer[BLOCK_SIZE];
-	size_t bytes_read; 
+/*
+ * logs the content of a file after it was imported
+ */
+void journal_log_import(file_system *fs, char *int_path, int inode_num)
+{
+	if(fs->journal == NULL) return;
 
-	int int_inode_num = traverse_path(fs, int_path, strlen(int_path));
-	if(int_inode_num == -1)
-	{
-		fclose(ext_file);
-		return -1;
-	} 
-	inode* int_inode = inode_ptr_at_num(fs, int_inode_num);
-	if(int_inode->n_type != reg_file)
+	read_view view;
+	if(view_inode(fs, inode_num, 0, inode_ptr_at_num(fs, inode_num)->size, 0, &view) == -1)
 	{
-		fclose(ext_file);
-		return -1;
-	} 
-
-	for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int direct_block = int_inode->direct_blocks[i];
-        if (direct_block != -1) {
-            fs->free_list[direct_block] = 1;
-			fs->s_block->free_blocks++;
-            int_inode->direct_blocks[i] = -1;
-        }
-    }
-    int_inode->size = 0;
-	
+		journal_fail(fs);
+		return;
+	}
+	journal_log(fs, j_import, int_path, NULL, view.spans, view.count);
+	fs_release_view(&view);
+}
+
+#define IMPORT_IOVECS 64 //blocks per readv
 
-	int block_index = 0;
-    while ((bytes_read = fread(buffer, 1, BLOCK_SIZE, ext_file) ) > 0) {
-		if(block_index >= DIRECT_BLOCKS_COUNT)
+/*
+ * takes an unused inode to build the new content of a file in, so the file stays
+ * untouched until the import is complete
+ * returns the inode number or -1 if there is no free inode
+ */
+int import_begin(file_system *fs)
+{
+	return claim_inode(fs, reg_file);
+}
+
+/*
+ * gives the new content to the file and the old one back to the allocator
+ */
+void import_commit(file_system *fs, int inode_num, int scratch)
+{
+	inode* file = inode_ptr_at_num(fs, inode_num);
+	inode* new_content = inode_ptr_at_num(fs, scratch);
+
+	int direct_blocks[DIRECT_BLOCKS_COUNT];
+	memcpy(direct_blocks, file->direct_blocks, sizeof(direct_blocks));
+	memcpy(file->direct_blocks, new_content->direct_blocks, sizeof(direct_blocks));
+	memcpy(new_content->direct_blocks, direct_blocks, sizeof(direct_blocks));
+	int indirect_block = file->indirect_block;
+	file->indirect_block = new_content->indirect_block;
+	new_content->indirect_block = indirect_block;
+	file->size = new_content->size;
+	mark_inode_dirty(fs, inode_num);
+
+	extent_release(fs, scratch);
+	release_inode(fs, scratch);
+}
+
+/*
+ * drops everything a failed import allocated
+ */
+void import_abort(file_system *fs, int scratch)
+{
+	extent_release(fs, scratch);
+	release_inode(fs, scratch);
+}
+
+/*
+ * reads size bytes from fd straight into the blocks of the file scratch, IMPORT_IOVECS blocks per system call
+ * returns 0 on success, -1 if fd ended early or can't be read
+ */
+int read_into_blocks(file_system *fs, int scratch, int fd, uint64_t size)
+{
+	struct iovec iov[IMPORT_IOVECS];
+	uint64_t done = 0;
+	uint32_t logical = 0;
+	uint32_t run_length;
+	int run_start;
+	while(done < size && (run_length = extent_get_run(fs, scratch, logical, &run_start)) > 0)
+	{
+		for(uint32_t i = 0; i < run_length;)
 		{
-			fclose(ext_file);
-			return -1;
+			// Queue as many blocks of the run as fit
+			int cnt = 0;
+			uint64_t queued = 0;
+			for(; i < run_length && cnt < IMPORT_IOVECS && done + queued < size; i++, cnt++)
+			{
+				data_block* block = data_block_at_num(fs, run_start + i);
+				block->size = MIN(size - done - queued, BLOCK_SIZE);
+				iov[cnt].iov_base = block->block;
+				iov[cnt].iov_len = block->size;
+				queued += block->size;
+				mark_data_block_dirty(fs, run_start + i);
+			}
+
+			// readv may stop early, continue where it did
+			struct iovec* next = iov;
+			while(cnt > 0)
+			{
+				ssize_t got = readv(fd, next, cnt);
+				if(got <= 0) return -1;
+				done += got;
+				while(cnt > 0 && got >= next->iov_len)
+				{
+					got -= next->iov_len;
+					next++;
+					cnt--;
+				}
+				if(cnt > 0)
+				{
+					next->iov_base = (uint8_t*)next->iov_base + got;
+					next->iov_len -= got;
+				}
+			}
+			if(done >= size) break;
 		}
+		logical += run_length;
+	}
+	return (done == size) ? 0 : -1;
+}
 
-		int free_block = find_free_block(fs);
+/*
+ * replaces the content of the file int_inode_num with the size bytes of fd
+ * returns 0 on success, -1 if the file doesn't fit or fd ends early
+ */
+int import_fd(file_system *fs, int int_inode_num, int fd, uint64_t size)
+{
+	// Reserve every block first, so a full image is noticed before anything is read
+	uint64_t blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int scratch = (blocks <= free_block_count(fs)) ? import_begin(fs) : -1;
+	int ret = (scratch != -1) ? 0 : -1;
+	for(uint64_t i = 0; ret == 0 && i < blocks;)
+	{
+		int run_start;
+		uint32_t run_length = append_run(fs, scratch, i, blocks - i, &run_start);
+		if(run_length == 0) ret = -1;
+		i += run_length;
+	}
+	if(ret == 0) ret = read_into_blocks(fs, scratch, fd, size);
+
+	if(ret == 0)
+	{
+		inode_ptr_at_num(fs, scratch)->size = size;
+		import_commit(fs, int_inode_num, scratch);
+	}
+	else if(scratch != -1)
+	{
+		import_abort(fs, scratch);
+	}
+	return ret;
+}
+
+/*
+ * replaces the content of the file int_inode_num with everything left in ext_file
+ * returns 0 on success, -1 if it doesn't fit
+ */
+int import_stream(file_system *fs, int int_inode_num, FILE *ext_file)
+{
+	int scratch = import_begin(fs);
+	if(scratch == -1) return -1;
+	inode* scratch_inode = inode_ptr_at_num(fs, scratch);
+
+	// The size is unknown, so every block is read straight into a new block until the stream ends
+	int ret = 0;
+	uint32_t block_index = 0;
+	while(1)
+	{
+		int free_block = alloc_block(fs);
 		if(free_block == -1)
 		{
-			fclose(ext_file);
-			return -1;
+			// Only a problem if there is something left to read
+			if(fgetc(ext_file) != EOF) ret = -1;
+			break;
 		}
 
-		fs->free_list[free_block] = 0;
-		fs->s_block->free_blocks--;
-		int_inode->direct_blocks[block_index] = free_block;
-
 		data_block* block = data_block_at_num(fs, free_block);
-		memcpy(block->block, buffer, bytes_read);
-		block->size = bytes_read;
+		size_t bytes_read = fread(block->block, 1, BLOCK_SIZE, ext_file);
+		if(bytes_read == 0)
+		{
+			release_block(fs, free_block);
+			break;
+		}
 
-		int_inode->size += bytes_read;
+		if(extent_add_block(fs, scratch, block_index, free_block) == -1)
+		{
+			release_block(fs, free_block);
+			ret = -1;
+			break;
+		}
+		block->size = bytes_read;
+		mark_data_block_dirty(fs, free_block);
+		scratch_inode->size += bytes_read;
 		block_index++;
-    }
+	}
+
+	if(ret == 0) import_commit(fs, int_inode_num, scratch);
+	else import_abort(fs, scratch);
+	return ret;
+}
+
+/*
+ * imports from fd if size is known, else from ext_file into the file pointed to by int_path
+ * returns 0 on success, -1 if the file wasn't found or the content doesn't fit
+ */
+int import_path(file_system *fs, char *int_path, int fd, uint64_t size, FILE *ext_file)
+{
+	lock_journal(fs);
+	lock_tree_read(fs);
+	int ret = -1;
+	int int_inode_num = traverse_path(fs, int_path, strlen(int_path));
+	if(int_inode_num != -1)
+	{
+		lock_inode_write(fs, int_inode_num);
+		if(inode_ptr_at_num(fs, int_inode_num)->n_type == reg_file)
+		{
+			ret = (ext_file != NULL) ? import_stream(fs, int_inode_num, ext_file) : import_fd(fs, int_inode_num, fd, size);
 
-    fclose(ext_file);
-    return 0;
+			// The external file may be gone when the journal is replayed, so log what ended up in the fs
+			journal_log_import(fs, int_path, int_inode_num);
+		}
+		unlock_inode(fs, int_inode_num);
+	}
+	unlock_tree(fs);
+	unlock_journal(fs);
+	return ret;
 }
 
 int
-fs_export(file_system *fs, char *int_path, char *ext_path)
+fs_import(file_system *fs, char *int_path, char *ext_path)
 {
+	int fd = open(ext_path, O_RDONLY);
+	if (fd == -1) return -1;
+
+	// Only regular files tell their size in advance, everything else is streamed
+	struct stat st;
+	if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+	{
+		FILE *ext_file = fdopen(fd, "rb");
+		if(ext_file == NULL)
+		{
+			close(fd);
+			return -1;
+		}
+		int ret = import_path(fs, int_path, -1, 0, ext_file);
+		fclose(ext_file);
+		return ret;
+	}
+
+	int ret = import_path(fs, int_path, fd, st.st_size, NULL);
+	close(fd);
+	return ret;
+}
+
+int
+fs_import_file(file_system *fs, char *int_path, FILE *ext_file)
+{
+	return import_path(fs, int_path, -1, 0, ext_file);
+}
+
+#define IMPORT_CACHE_BLOCKS 256 //blocks a worker of fs_import_tree takes from the allocator at once
+
+/*
+ * a file that fs_import_tree or fs_export_tree hands to a worker
+ */
+typedef struct _tree_job {
+	int inode;
+	char *int_path; //NULL for an export
+	char *ext_path;
+} tree_job;
+
+typedef struct _tree_jobs {
+	file_system *fs;
+	tree_job *jobs;
+	size_t count;
+	size_t cap;
+	size_t next; //next job to take, shared by the workers
+	int failed; //entries that weren't imported or exported
+	uint32_t batch; //blocks an import worker takes from the allocator at once
+} tree_jobs;
+
+/*
+ * free blocks a worker took from the allocator and hasn't used yet
+ */
+typedef struct _block_cache {
+	int start;
+	uint32_t len;
+} block_cache;
+
+/*
+ * returns "dir/name" in a new buffer or NULL if there is no memory
+ */
+char *join_path(const char *dir, const char *name)
+{
+	size_t dir_len = strlen(dir);
+	while(dir_len > 0 && dir[dir_len - 1] == '/') dir_len--;
+	size_t name_len = strlen(name);
+	char *path = malloc(dir_len + name_len + 2);
+	if(path == NULL) return NULL;
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	memcpy(path + dir_len + 1, name, name_len + 1);
+	return path;
+}
+
+/*
+ * appends job to the array jobs, which grows as needed
+ * returns 0 on success, -1 if there is no memory
+ */
+int push_job(tree_job **jobs, size_t *count, size_t *cap, tree_job job)
+{
+	if(*count == *cap)
+	{
+		size_t new_cap = (*cap == 0) ? 64 : *cap * 2;
+		tree_job *grown = realloc(*jobs, new_cap * sizeof(tree_job));
+		if(grown == NULL) return -1;
+		*jobs = grown;
+		*cap = new_cap;
+	}
+	(*jobs)[(*count)++] = job;
+	return 0;
+}
+
+/*
+ * runs worker on nthreads threads until the jobs are done. The calling thread is one of them,
+ * so the jobs are still done if no thread can be started
+ */
+void run_workers(tree_jobs *tree, int nthreads, void *(*worker)(void *))
+{
+	pthread_t *threads = malloc((nthreads - 1) * sizeof(pthread_t));
+	int started = 0;
+	while(threads != NULL && started < nthreads - 1 && pthread_create(&threads[started], NULL, worker, tree) == 0) started++;
+	worker(tree);
+	for(int i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+}
+
+/*
+ * frees the paths of all jobs and the array
+ */
+void free_jobs(tree_jobs *tree)
+{
+	for(size_t i = 0; i < tree->count; i++)
+	{
+		free(tree->jobs[i].int_path);
+		free(tree->jobs[i].ext_path);
+	}
+	free(tree->jobs);
+}
+
+/*
+ * creates the node int_path of the given type or finds the one that is there already.
+ * Runs before the workers start, holding the journal and the tree lock
+ * returns the inode number or -1 if the node can't be created or has the other type
+ */
+int import_node(file_system *fs, char *int_path, enum node_type type)
+{
+	int ret = create_node(fs, int_path, type);
+	if(ret == -1) return -1;
+	if(ret == 0) journal_log(fs, (type == directory) ? j_mkdir : j_mkfile, int_path, NULL, NULL, 0);
+
 	int inode_num = traverse_path(fs, int_path, strlen(int_path));
-	if(inode_num == -1) return -1;
-	inode* inode_ptr = inode_ptr_at_num(fs, inode_num);
-	if(inode_ptr->n_type != reg_file) return -1;
+	if(inode_num == -1 || inode_ptr_at_num(fs, inode_num)->n_type != type) return -1;
+	return inode_num;
+}
 
-	int size = inode_ptr->size;
-	if(size > 0)
+/*
+ * recreates the directories below ext_dir under int_dir and creates a file for every regular
+ * file, which is queued as a job. The directories to visit are kept on a stack, so the depth
+ * of the host tree doesn't matter. Entries that can't be created are counted in tree->failed
+ * returns 0 on success, -1 if ext_dir can't be read or there is no memory
+ */
+int scan_host_tree(tree_jobs *tree, char *int_dir, char *ext_dir)
+{
+	size_t stack_cap = 16;
+	size_t stack_count = 0;
+	char **stack = malloc(stack_cap * 2 * sizeof(char*)); //pairs of internal and host path
+	int ret = (stack != NULL) ? 0 : -1;
+	if(ret == 0)
 	{
-		uint8_t* buffer = malloc(size);
-		if(buffer == NULL) return -1;
+		stack[0] = strdup(int_dir);
+		stack[1] = strdup(ext_dir);
+		stack_count = 1;
+		if(stack[0] == NULL || stack[1] == NULL) ret = -1;
+	}
 
-		int copied = 0;
-		for(int i = 0; i < DIRECT_BLOCKS_COUNT && copied < size; i++)
+	int top = 1;
+	while(ret == 0 && stack_count > 0)
+	{
+		stack_count--;
+		char *int_path = stack[stack_count * 2];
+		char *ext_path = stack[stack_count * 2 + 1];
+		DIR *host_dir = opendir(ext_path);
+		if(host_dir == NULL)
 		{
-			int direct_block_num = inode_ptr->direct_blocks[i];
-			if(direct_block_num == -1) break;
-			data_block* direct_block = data_block_at_num(fs, direct_block_num);
+			if(top) ret = -1;
+			else tree->failed++;
+		}
+		top = 0;
 
-			int to_copy =  (size - copied < BLOCK_SIZE) ? size - copied : BLOCK_SIZE;
+		struct dirent *host_entry;
+		while(ret == 0 && host_dir != NULL && (host_entry = readdir(host_dir)) != NULL)
+		{
+			char *name = host_entry->d_name;
+			if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
 
-			memcpy(buffer + copied, direct_block->block, to_copy);
-			copied += to_copy;
+			char *ext_child = join_path(ext_path, name);
+			char *int_child = join_path(int_path, name);
+			if(ext_child == NULL || int_child == NULL)
+			{
+				free(ext_child);
+				free(int_child);
+				ret = -1;
+				break;
+			}
+			// Only ask for the type if readdir doesn't know it
+			unsigned char d_type = host_entry->d_type;
+			struct stat st;
+			if(d_type == DT_UNKNOWN)
+			{
+				// An entry that vanished or can't be looked at is skipped like one that doesn't fit
+				if(lstat(ext_child, &st) == 0) d_type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+				else tree->failed++;
+			}
+
+			int inode_num = -1;
+			if(d_type == DT_DIR || d_type == DT_REG)
+			{
+				inode_num = (strlen(name) < NAME_MAX_LENGTH) ? import_node(tree->fs, int_child, (d_type == DT_DIR) ? directory : reg_file) : -1;
+				if(inode_num == -1) tree->failed++;
+			}
+
+			if(inode_num != -1 && d_type == DT_DIR)
+			{
+				if(stack_count == stack_cap)
+				{
+					char **grown = realloc(stack, stack_cap * 4 * sizeof(char*));
+					if(grown == NULL) ret = -1;
+					else
+					{
+						stack = grown;
+						stack_cap *= 2;
+					}
+				}
+				if(ret == 0)
+				{
+					stack[stack_count * 2] = int_child;
+					stack[stack_count * 2 + 1] = ext_child;
+					stack_count++;
+					continue;
+				}
+			}
+			else if(inode_num != -1)
+			{
+				ret = push_job(&tree->jobs, &tree->count, &tree->cap, (tree_job){inode_num, int_child, ext_child});
+				if(ret == 0) continue;
+			}
+			free(ext_child);
+			free(int_child);
 		}
+		if(host_dir != NULL) closedir(host_dir);
+		free(int_path);
+		free(ext_path);
+	}
 
-		FILE* ext_file = fopen(ext_path, "wb");
-		if(ext_file == NULL)
+	// Left over after an error
+	while(stack_count > 0)
+	{
+		stack_count--;
+		free(stack[stack_count * 2]);
+		free(stack[stack_count * 2 + 1]);
+	}
+	free(stack);
+	return ret;
+}
+
+/*
+ * maps count blocks behind the end of the file inode_num, taking them from the worker's cache.
+ * An empty cache is refilled with a run of at least batch blocks
+ * returns 0 on success, -1 if the file system is full. The blocks mapped until then belong
+ * to the file, import_abort releases them with its extents
+ */
+int map_cached_blocks(file_system *fs, int inode_num, uint32_t count, block_cache *cache, uint32_t batch)
+{
+	uint32_t logical = 0;
+	while(logical < count)
+	{
+		if(cache->len == 0)
 		{
-			free(buffer);
+			cache->len = alloc_run(fs, -1, MAX(batch, count - logical), &cache->start);
+			if(cache->len == 0) return -1;
+		}
+		uint32_t take = MIN(cache->len, count - logical);
+		int start = cache->start;
+		cache->start += take;
+		cache->len -= take;
+		if(extent_add_run(fs, inode_num, logical, start, take) == -1)
+		{
+			// A run can be mapped in part, only the rest is given back here
+			for(uint32_t i = 0; i < take; i++)
+			{
+				if(extent_get_block(fs, inode_num, logical + i) != start + i) release_block(fs, start + i);
+			}
 			return -1;
 		}
+		logical += take;
+	}
+	return 0;
+}
 
-		fwrite(buffer, 1, size, ext_file);
-		fclose(ext_file);
-		free(buffer);
+/*
+ * fills the file of a job with the content of its host file. The content is built in a
+ * scratch inode only the worker sees and swapped in once it is complete, so a file that was
+ * there before keeps its old content if the import fails
+ * returns 0 on success, -1 if the host file can't be read or doesn't fit
+ */
+int import_job_blocks(file_system *fs, tree_job *job, block_cache *cache, uint32_t batch)
+{
+	int fd = open(job->ext_path, O_RDONLY);
+	if(fd == -1) return -1;
+	struct stat st;
+	int ret = (fstat(fd, &st) == 0) ? 0 : -1;
+	uint64_t size = (ret == 0) ? st.st_size : 0;
+
+	int scratch = (ret == 0) ? import_begin(fs) : -1;
+	if(scratch == -1) ret = -1;
+	if(ret == 0) ret = map_cached_blocks(fs, scratch, (size + BLOCK_SIZE - 1) / BLOCK_SIZE, cache, batch);
+	if(ret == 0) ret = read_into_blocks(fs, scratch, fd, size);
+	close(fd);
+
+	if(ret == 0)
+	{
+		inode_ptr_at_num(fs, scratch)->size = size;
+		lock_inode_write(fs, job->inode);
+		import_commit(fs, job->inode, scratch);
+		unlock_inode(fs, job->inode);
+	}
+	else if(scratch != -1)
+	{
+		import_abort(fs, scratch);
 	}
+	return ret;
+}
 
-	return 0;
+/*
+ * takes jobs until there are none left. The tree lock is held by fs_import_tree for all workers
+ */
+void *import_worker(void *arg)
+{
+	tree_jobs *tree = arg;
+	block_cache cache = {0, 0};
+	size_t next;
+	while((next = __atomic_fetch_add(&tree->next, 1, __ATOMIC_RELAXED)) < tree->count)
+	{
+		if(import_job_blocks(tree->fs, &tree->jobs[next], &cache, tree->batch) == -1)
+		{
+			__atomic_fetch_add(&tree->failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	// What is left in the cache goes back
+	for(uint32_t i = 0; i < cache.len; i++)
+	{
+		release_block(tree->fs, cache.start + i);
+	}
+	return NULL;
+}
+
+int
+fs_import_tree(file_system *fs, char *int_dir, char *ext_dir, int nthreads)
+{
+	// A single thread doesn't need the locks. A caller that didn't enable them has the fs to
+	// itself, so they are only switched on for the workers
+	int own_locks = 0;
+	if(nthreads > 1 && fs->locks == NULL)
+	{
+		if(fs_threads_enable(fs) == 0) own_locks = 1;
+		else nthreads = 1;
+	}
+	nthreads = MAX(nthreads, 1);
+
+	lock_journal(fs);
+	lock_tree_read(fs);
+	tree_jobs tree = {fs, NULL, 0, 0, 0, 0, 0};
+	int root = traverse_path(fs, int_dir, strlen(int_dir));
+	int ret = (root != -1 && inode_ptr_at_num(fs, root)->n_type == directory) ? scan_host_tree(&tree, int_dir, ext_dir) : -1;
+	if(ret == 0)
+	{
+		// Small enough that no worker runs dry while the others still hold free blocks
+		tree.batch = MAX(MIN(IMPORT_CACHE_BLOCKS, free_block_count(fs) / (2 * nthreads)), 1);
+
+		run_workers(&tree, nthreads, import_worker);
+
+		// The workers allocated side by side, so the replay places the files on its own
+		journal_drop_allocs(fs);
+		for(size_t i = 0; i < tree.count; i++)
+		{
+			journal_log_import(fs, tree.jobs[i].int_path, tree.jobs[i].inode);
+		}
+		ret = (tree.failed > 0) ? -2 : 0;
+	}
+	unlock_tree(fs);
+	unlock_journal(fs);
+	free_jobs(&tree);
+	if(own_locks) lock_cleanup(fs);
+	return ret;
+}
+
+#define EXPORT_SPANS 256 //blocks an export hands to one writev
+
+/*
+ * writes the content of the file inode_num to fd straight from the data blocks, EXPORT_SPANS
+ * blocks per writev, so nothing is allocated whatever the size of the file
+ * returns 0 on success, -1 else
+ */
+int write_content(file_system *fs, int inode_num, int fd)
+{
+	uint64_t size = inode_ptr_at_num(fs, inode_num)->size;
+	struct iovec spans[EXPORT_SPANS];
+	int count = 0;
+	uint64_t queued = 0;
+	uint32_t logical = 0;
+	uint32_t run_length;
+	int run_start;
+	while(queued < size && (run_length = extent_get_run(fs, inode_num, logical, &run_start)) > 0)
+	{
+		for(uint32_t i = 0; i < run_length && queued < size; i++)
+		{
+			spans[count].iov_base = data_block_at_num(fs, run_start + i)->block;
+			spans[count].iov_len = MIN(size - queued, BLOCK_SIZE);
+			queued += spans[count].iov_len;
+			if(++count == EXPORT_SPANS)
+			{
+				if(io_write_all(fd, spans, count) == -1) return -1;
+				count = 0;
+			}
+		}
+		logical += run_length;
+	}
+	if(queued < size) return -1;
+	return io_write_all(fd, spans, count);
+}
+
+/*
+ * fs_export on the file inode_num, the caller holds its lock
+ */
+int export_inode(file_system *fs, int inode_num, char *ext_path)
+{
+	if(inode_ptr_at_num(fs, inode_num)->n_type != reg_file) return -1;
+
+	int fd = open(ext_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(fd == -1) return -1;
+	int ret = write_content(fs, inode_num, fd);
+	if(close(fd) == -1) ret = -1;
+	return ret;
+}
+
+int
+fs_export(file_system *fs, char *int_path, char *ext_path)
+{
+	lock_tree_read(fs);
+	int inode_num = traverse_path(fs, int_path, strlen(int_path));
+	int ret = -1;
+	if(inode_num != -1)
+	{
+		lock_inode_read(fs, inode_num);
+		ret = export_inode(fs, inode_num, ext_path);
+		unlock_inode(fs, inode_num);
+	}
+	unlock_tree(fs);
+	return ret;
+}
+
+/*
+ * creates the host directory path, one that is there already is fine
+ * returns 0 on success, -1 else
+ */
+int make_host_dir(const char *path)
+{
+	if(mkdir(path, 0777) == 0) return 0;
+	struct stat st;
+	return (errno == EEXIST && stat(path, &st) == 0 && S_ISDIR(st.st_mode)) ? 0 : -1;
+}
+
+/*
+ * writes the file of a job to the host, a failure is counted in tree->failed
+ */
+void export_job(tree_jobs *tree, tree_job *job)
+{
+	lock_inode_read(tree->fs, job->inode);
+	int ret = export_inode(tree->fs, job->inode, job->ext_path);
+	unlock_inode(tree->fs, job->inode);
+	if(ret == -1) __atomic_fetch_add(&tree->failed, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * recreates the directory root and the directories below it under ext_dir on the host and
+ * queues a job for every file, with export_now set the files are written right away instead.
+ * The caller holds the tree lock, each directory is read under its own lock. A directory
+ * that can't be created is counted in tree->failed and skipped with everything below it
+ * returns 0 on success, -1 if ext_dir can't be created or there is no memory
+ */
+int scan_fs_tree(tree_jobs *tree, int root, char *ext_dir, int export_now)
+{
+	file_system *fs = tree->fs;
+	tree_job *stack = NULL; //directories still to visit
+	size_t stack_count = 0;
+	size_t stack_cap = 0;
+	char *root_path = strdup(ext_dir);
+	int ret = (root_path != NULL) ? push_job(&stack, &stack_count, &stack_cap, (tree_job){root, NULL, root_path}) : -1;
+	if(ret == -1) free(root_path);
+
+	int top = 1;
+	while(ret == 0 && stack_count > 0)
+	{
+		tree_job dir_job = stack[--stack_count];
+		if(make_host_dir(dir_job.ext_path) == -1)
+		{
+			if(top) ret = -1;
+			else tree->failed++;
+		}
+		else
+		{
+			lock_inode_read(fs, dir_job.inode);
+			fs_dir dir;
+			ret = dir_open_inode(fs, dir_job.inode, &dir);
+			fs_dirent *entry;
+			while(ret == 0 && (entry = dir_next(fs, &dir)) != NULL)
+			{
+				tree_job job = {entry->inode, NULL, join_path(dir_job.ext_path, entry->name)};
+				if(job.ext_path == NULL) ret = -1;
+				else if(entry->type == directory) ret = push_job(&stack, &stack_count, &stack_cap, job);
+				else if(!export_now) ret = push_job(&tree->jobs, &tree->count, &tree->cap, job);
+				else
+				{
+					export_job(tree, &job);
+					free(job.ext_path);
+				}
+				if(ret == -1) free(job.ext_path);
+			}
+			fs_dir_close(&dir);
+			unlock_inode(fs, dir_job.inode);
+		}
+		top = 0;
+		free(dir_job.ext_path);
+	}
+
+	// Left over after an error
+	while(stack_count > 0)
+	{
+		free(stack[--stack_count].ext_path);
+	}
+	free(stack);
+	return ret;
+}
+
+/*
+ * takes jobs of fs_export_tree until there are none left. The tree lock is held by
+ * fs_export_tree for all workers
+ */
+void *export_worker(void *arg)
+{
+	tree_jobs *tree = arg;
+	size_t next;
+	while((next = __atomic_fetch_add(&tree->next, 1, __ATOMIC_RELAXED)) < tree->count)
+	{
+		export_job(tree, &tree->jobs[next]);
+	}
+	return NULL;
+}
+
+int
+fs_export_tree(file_system *fs, char *int_dir, char *ext_dir, int nthreads)
+{
+	// The workers only read the fs, they need no locks among themselves.
+	// A single thread writes every file as soon as it is found, there is nothing to queue for
+	lock_tree_read(fs);
+	tree_jobs tree = {fs, NULL, 0, 0, 0, 0, 0};
+	int root = traverse_path(fs, int_dir, strlen(int_dir));
+	int ret = (root != -1 && inode_ptr_at_num(fs, root)->n_type == directory) ? scan_fs_tree(&tree, root, ext_dir, nthreads <= 1) : -1;
+	if(ret == 0)
+	{
+		if(nthreads > 1) run_workers(&tree, nthreads, export_worker);
+		ret = (tree.failed > 0) ? -2 : 0;
+	}
+	unlock_tree(fs);
+	free_jobs(&tree);
+	return ret;
 }
@@ -0,0 +1,106 @@
+#include <string.h>
+#include "../lib/path.h"
+#include "../lib/dcache.h"
+#include "../lib/dir.h"
+#include "../lib/lock.h"
+
+/*
+ * dir_lookup through the dentry cache. The directory may be getting a child meanwhile
+ */
+static int lookup_child(file_system* fs, int parent_num, const char* name, size_t name_len)
+{
+	int child = dcache_lookup_name(fs, parent_num, name, name_len);
+	if(child != -1) return child;
+
+	lock_inode_read(fs, parent_num);
+	child = dir_lookup(fs, parent_num, name, name_len);
+	unlock_inode(fs, parent_num);
+	if(child != -1) dcache_add_name(fs, parent_num, name, name_len, child);
+	return child;
+}
+
+/*
+ * walks the path from the root. Checks the format on the way
+ */
+static int walk_path(file_system* fs, const char* path, size_t size_of_path, path_lookup* result)
+{
+	int inode_num = fs->root_node;
+	size_t pos = 1;
+	while(pos < size_of_path)
+	{
+		const char* name = path + pos;
+		size_t name_len = 0;
+		while(pos + name_len < size_of_path && name[name_len] != '/') name_len++;
+		// Empty component, the path contains "//"
+		if(name_len == 0) return -1;
+		pos += name_len + 1;
+
+		// The last component may be followed by a single slash
+		if(pos >= size_of_path)
+		{
+			result->parent = inode_num;
+			result->inode = lookup_child(fs, inode_num, name, name_len);
+			return (result->inode != -1) ? 0 : -1;
+		}
+
+		inode_num = lookup_child(fs, inode_num, name, name_len);
+		if(inode_num == -1) return -1;
+	}
+
+	// Only "/"
+	result->inode = inode_num;
+	return 0;
+}
+
+int resolve_path(file_system* fs, const char* path, size_t size_of_path, path_lookup* result)
+{
+	result->parent = -1;
+	result->inode = -1;
+	result->name = path;
+	result->name_len = 0;
+
+	// Check if path exists or in correct format
+	if(path == NULL || size_of_path == 0 || path[0] != '/') return -1;
+
+	// Find the leaf from the end, it is usually short
+	size_t end = size_of_path;
+	if(end > 1 && path[end - 1] == '/') end--;
+	size_t start = end;
+	while(path[start - 1] != '/') start--;
+	result->name = path + start;
+	result->name_len = end - start;
+	if(result->name_len == 0 && size_of_path > 1) return -1;
+
+	// Only paths that resolved before are cached, so a hit is well formed
+	int inode_num = dcache_lookup_path(fs, path, size_of_path);
+	if(inode_num != -1)
+	{
+		result->inode = inode_num;
+		result->parent = (inode_num != fs->root_node) ? fs->inodes[inode_num].parent : -1;
+		return 0;
+	}
+
+	// Then the parent, the leaf may be about to be created
+	int parent_num = (start > 1) ? dcache_lookup_path(fs, path, start - 1) : -1;
+	if(parent_num != -1)
+	{
+		result->parent = parent_num;
+		result->inode = lookup_child(fs, parent_num, result->name, result->name_len);
+	}
+	else
+	{
+		walk_path(fs, path, size_of_path, result);
+		if(result->parent != -1 && start > 1) dcache_add_path(fs, path, start - 1, result->parent);
+	}
+
+	if(result->inode == -1) return -1;
+	dcache_add_path(fs, path, size_of_path, result->inode);
+	return 0;
+}
+
+int traverse_path(file_system* fs, const char* path, size_t size_of_path)
+{
+	path_lookup lookup;
+	resolve_path(fs, path, size_of_path, &lookup);
+	return lookup.inode;
+}
@@ -3,6 +3,8 @@
 void printhelp(){
 	printf("Usage:\n"
 	"-l, --load <filename>\n\tLoads an existing filesystem\n"
+	"-m, --mount <filename>\n\tMaps an existing filesystem into memory instead of loading it\n"
+	"-u, --upgrade <filename>\n\tConverts a filesystem of the first layout to the current one\n"
 	"-c, --create <filename> <size>\n\tCreates a new filesystem with given filename and size (amount of INodes/Blocks)\n"
 	"-h, --help\n\tPrint this help\n");
 }
@@ -0,0 +1,108 @@
+import ctypes
+from wrappers import *
+
+class Test_Alloc:
+    # Allocating every block of a fresh filesystem hands them out in order, then fails
+    # Expected outcome:
+    #  * block numbers 0..n-1, then -1
+    #  * free list and superblock are kept up to date
+    def test_alloc_fill(self):
+        fs = setup(70)
+        for i in range(70):
+            assert libc.alloc_block(ctypes.byref(fs)) == i
+            assert fs.free_list[i] == 0
+        assert libc.alloc_block(ctypes.byref(fs)) == -1
+        assert fs.s_block.contents.free_blocks == 0
+
+    # Released blocks are only reused after the cursor wrapped around (next-fit)
+    def test_alloc_next_fit(self):
+        fs = setup(5)
+        for i in range(3):
+            libc.alloc_block(ctypes.byref(fs))
+        libc.release_block(ctypes.byref(fs), 0)
+        assert fs.free_list[0] == 1
+        assert libc.alloc_block(ctypes.byref(fs)) == 3
+        assert libc.alloc_block(ctypes.byref(fs)) == 4
+        assert libc.alloc_block(ctypes.byref(fs)) == 0
+        assert libc.alloc_block(ctypes.byref(fs)) == -1
+
+    # Blocks marked as used directly in the free list are skipped
+    def test_alloc_respects_free_list(self):
+        fs = setup(5)
+        assert libc.alloc_block(ctypes.byref(fs)) == 0
+        fs.free_list[1] = 0
+        assert libc.alloc_block(ctypes.byref(fs)) == 2
+
+    # Free inodes are handed out lowest first, inodes taken directly are skipped
+    def test_alloc_inode_order(self):
+        fs = setup(5)
+        fs = set_dir(name="newDir",inode=1,parent=0,parent_block=0,fs=fs)
+        assert libc.find_free_inode(ctypes.byref(fs)) == 2
+        assert libc.find_free_inode(ctypes.byref(fs)) == 2 # not taken yet, so it is handed out again
+
+    # Removed inodes are reused first
+    def test_alloc_inode_reuse(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil2","UTF-8")))
+        libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        assert libc.find_free_inode(ctypes.byref(fs)) == 1
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil3","UTF-8")))
+        assert fs.inodes[1].name.decode("utf-8") == "fil3"
+        assert libc.find_free_inode(ctypes.byref(fs)) == 3
+
+    # An inode table without free inodes
+    def test_alloc_inode_full(self):
+        fs = setup(3)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil2","UTF-8")))
+        assert libc.find_free_inode(ctypes.byref(fs)) == -1
+        assert libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil3","UTF-8"))) == -1
+
+    # A run is taken from the first hole that is long enough, not the first free block
+    # Expected outcome:
+    #  * the short holes are skipped
+    #  * with no hole long enough the longest one is taken
+    def test_alloc_run_fits(self):
+        fs = setup(20)
+        for i in range(20):
+            libc.alloc_block(ctypes.byref(fs))
+        for i in [1, 2, 5, 6, 7, 8, 12, 13, 14]:
+            libc.release_block(ctypes.byref(fs), i)
+        start = ctypes.c_int(-1)
+        assert libc.alloc_run(ctypes.byref(fs), -1, 3, ctypes.byref(start)) == 3
+        assert start.value == 5
+        assert libc.alloc_run(ctypes.byref(fs), -1, 5, ctypes.byref(start)) == 3
+        assert start.value == 12
+        assert fs.s_block.contents.free_blocks == 3
+
+    # A free goal block starts the run, even if it is shorter than asked for
+    def test_alloc_run_goal(self):
+        fs = setup(10)
+        for i in range(10):
+            libc.alloc_block(ctypes.byref(fs))
+        for i in [3, 4, 6, 7, 8, 9]:
+            libc.release_block(ctypes.byref(fs), i)
+        start = ctypes.c_int(-1)
+        assert libc.alloc_run(ctypes.byref(fs), 3, 4, ctypes.byref(start)) == 2
+        assert start.value == 3
+        assert libc.alloc_run(ctypes.byref(fs), 0, 4, ctypes.byref(start)) == 4
+        assert start.value == 6
+        assert libc.alloc_run(ctypes.byref(fs), -1, 1, ctypes.byref(start)) == 0
+
+    # New files are written in one run, even if the free space in front is fragmented
+    def test_alloc_run_file_layout(self):
+        fs = setup(40)
+        for i in range(8):
+            libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/small%d" % i,"UTF-8")))
+            libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/small%d" % i,"UTF-8")), ctypes.c_char_p(b"s" * 1500))
+        for i in range(0, 8, 2):
+            libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/small%d" % i,"UTF-8")))
+        fs.alloc_cursor = 0
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/large","UTF-8")))
+        assert libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/large","UTF-8")), ctypes.c_char_p(b"l" * 5000)) == 5000
+        large = libc.traverse_path(ctypes.byref(fs), ctypes.c_char_p(bytes("/large","UTF-8")), 6)
+        assert libc.extent_count_runs(ctypes.byref(fs), large) == 1
+        assert libc.fs_cp(ctypes.byref(fs), ctypes.c_char_p(bytes("/large","UTF-8")), ctypes.c_char_p(bytes("/copy","UTF-8"))) == 0
+        copy = libc.traverse_path(ctypes.byref(fs), ctypes.c_char_p(bytes("/copy","UTF-8")), 5)
+        assert libc.extent_count_runs(ctypes.byref(fs), copy) == 1
@@ -0,0 +1,121 @@
+import ctypes
+from wrappers import *
+
+# ctypes drops the GIL during the calls, so the threads really allocate at once
+lockfree = libc["alloc_lockfree_enable"]
+lockfree.argtypes = [ctypes.c_void_p]
+alloc_block = libc["alloc_block"]
+alloc_block.argtypes = [ctypes.c_void_p]
+alloc_run = libc["alloc_run"]
+alloc_run.restype = ctypes.c_uint32
+alloc_run.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_uint32, ctypes.POINTER(ctypes.c_int)]
+release_block = libc["release_block"]
+release_block.argtypes = [ctypes.c_void_p, ctypes.c_int]
+share_block = libc["share_block"]
+share_block.argtypes = [ctypes.c_void_p, ctypes.c_int]
+claim_inode = libc["claim_inode"]
+claim_inode.argtypes = [ctypes.c_void_p, ctypes.c_int]
+release_inode = libc["release_inode"]
+release_inode.argtypes = [ctypes.c_void_p, ctypes.c_int]
+
+class Test_Alloc_Lockfree:
+    # All threads take single blocks until the fs is full, then give them back
+    # Expected outcome:
+    #  * every block is handed out exactly once
+    #  * afterwards every block is free again
+    def test_lockfree_blocks(self):
+        fs = setup(2000)
+        assert lockfree(ctypes.addressof(fs)) == 0
+        assert lockfree(ctypes.addressof(fs)) == 0
+        taken = [[] for t in range(THREADS)]
+        def take(t):
+            while True:
+                block = alloc_block(ctypes.addressof(fs))
+                if block == -1:
+                    break
+                taken[t].append(block)
+        run_threads(take)
+        blocks = sorted(b for t in taken for b in t)
+        assert blocks == list(range(2000))
+        assert fs.s_block.contents.free_blocks == 0
+        check_free_blocks(fs)
+        run_threads(lambda t: [release_block(ctypes.addressof(fs), b) for b in taken[t]])
+        assert fs.s_block.contents.free_blocks == 2000
+        check_free_blocks(fs)
+
+    # All threads take runs of different lengths until the fs is full
+    # Expected outcome:
+    #  * the runs don't overlap and cover every block
+    def test_lockfree_runs(self):
+        fs = setup(3000)
+        assert lockfree(ctypes.addressof(fs)) == 0
+        runs = [[] for t in range(THREADS)]
+        def take(t):
+            start = ctypes.c_int()
+            while True:
+                length = alloc_run(ctypes.addressof(fs), -1, 1 + t * 9, ctypes.byref(start))
+                if length == 0:
+                    break
+                runs[t].append((start.value, length))
+        run_threads(take)
+        blocks = sorted(s + i for t in runs for s, l in t for i in range(l))
+        assert blocks == list(range(3000))
+        check_free_blocks(fs)
+
+    # Blocks shared by all threads lose their references in parallel
+    # Expected outcome:
+    #  * a block is free once the last reference is dropped, not earlier
+    def test_lockfree_shared(self):
+        fs = setup(100)
+        assert lockfree(ctypes.addressof(fs)) == 0
+        blocks = [alloc_block(ctypes.addressof(fs)) for i in range(50)]
+        for b in blocks:
+            for t in range(THREADS - 1):
+                assert share_block(ctypes.addressof(fs), b) == 0
+            assert fs.free_list[b] == THREADS
+        run_threads(lambda t: [release_block(ctypes.addressof(fs), b) for b in blocks])
+        assert fs.s_block.contents.free_blocks == 100
+        check_free_blocks(fs)
+
+    # All threads claim inodes until there are none left, then release them
+    # Expected outcome:
+    #  * every inode but the root is claimed exactly once with the requested type
+    def test_lockfree_inodes(self):
+        fs = setup(500)
+        assert lockfree(ctypes.addressof(fs)) == 0
+        claimed = [[] for t in range(THREADS)]
+        def take(t):
+            while True:
+                num = claim_inode(ctypes.addressof(fs), NodeType.reg_file)
+                if num == -1:
+                    break
+                claimed[t].append(num)
+        run_threads(take)
+        nums = sorted(n for t in claimed for n in t)
+        assert nums == list(range(1, 500))
+        assert all(fs.inodes[n].n_type == NodeType.reg_file and fs.inodes[n].parent == -1 for n in nums)
+        run_threads(lambda t: [release_inode(ctypes.addressof(fs), n) for n in claimed[t]])
+        assert all(fs.inodes[n].n_type == NodeType.free_block for n in nums)
+
+    # Threads create, write and remove their own directories through the fs
+    # Expected outcome:
+    #  * the files hold what was written, removed ones give back all blocks and inodes
+    def test_lockfree_fs_ops(self):
+        fs = setup(600)
+        assert lockfree(ctypes.addressof(fs)) == 0
+        content = bytes(LONG_DATA * 2,"UTF-8")
+        free_before = fs.s_block.contents.free_blocks
+        def work(t):
+            d = bytes("/d%d" % t,"UTF-8")
+            for i in range(20):
+                assert mkdir(ctypes.addressof(fs), d) == 0
+                assert mkfile(ctypes.addressof(fs), d + b"/f") == 0
+                assert pwrite(ctypes.addressof(fs), d + b"/f", 0, content, len(content)) == len(content)
+                buf = ctypes.create_string_buffer(len(content))
+                assert pread(ctypes.addressof(fs), d + b"/f", 0, len(content), buf) == len(content)
+                assert buf.raw == content
+                assert rm(ctypes.addressof(fs), d) == 0
+        run_threads(work)
+        assert fs.s_block.contents.free_blocks == free_before
+        assert all(fs.inodes[n].n_type == NodeType.free_block for n in range(1, 600))
+        check_free_blocks(fs)
@@ -0,0 +1,53 @@
+import ctypes
+from wrappers import *
+
+libc.fs_checkpoint.restype = ctypes.c_long
+libc.fs_load.restype = ctypes.POINTER(FileSystem)
+
+TEST_IMAGE = "./mypyfiles.fs" # the image setup() creates
+OTHER_IMAGE = "./checkpoint_test.fs"
+PAGE_SIZE = 4096
+
+def image_size(num_blocks):
+    # the free list is padded to the alignment of the inodes behind it
+    align = ctypes.alignment(Inode)
+    free_list = (ctypes.sizeof(Superblock) + num_blocks + align - 1) // align * align - ctypes.sizeof(Superblock)
+    return ctypes.sizeof(Superblock) + free_list + num_blocks * (ctypes.sizeof(Inode) + ctypes.sizeof(DataBlock))
+
+class Test_Checkpoint:
+    # Nothing changed since the filesystem was created, nothing has to be written
+    def test_checkpoint_clean(self):
+        fs = setup(100)
+        assert libc.fs_checkpoint(ctypes.byref(fs), ctypes.c_char_p(bytes(TEST_IMAGE,"UTF-8"))) == 0
+
+    # Only the pages holding the changed inodes, free list and data block are written
+    # Expected outcome:
+    #  * less than the whole image is written, in whole pages
+    #  * the image on disk contains the change
+    #  * a second checkpoint writes nothing
+    def test_checkpoint_writef(self):
+        fs = setup(100)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")), ctypes.c_char_p(bytes(SHORT_DATA,"UTF-8")))
+        written = libc.fs_checkpoint(ctypes.byref(fs), ctypes.c_char_p(bytes(TEST_IMAGE,"UTF-8")))
+        assert 0 < written < image_size(100)
+        assert written % PAGE_SIZE == 0
+        assert libc.fs_checkpoint(ctypes.byref(fs), ctypes.c_char_p(bytes(TEST_IMAGE,"UTF-8"))) == 0
+
+        loaded = libc.fs_load(ctypes.c_char_p(bytes(TEST_IMAGE,"UTF-8"))).contents
+        assert loaded.inodes[1].name.decode("utf-8") == "fil1"
+        assert loaded.inodes[1].size == len(SHORT_DATA)
+        assert loaded.free_list[0] == 0
+        outstring = ctypes.c_char_p(ctypes.addressof(loaded.data_blocks[0].block)).value
+        assert outstring.decode("utf-8") == SHORT_DATA
+
+    # A checkpoint into a file that isn't the image of the filesystem writes everything
+    def test_checkpoint_other_file(self):
+        fs = setup(100)
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/newDir","UTF-8")))
+        written = libc.fs_checkpoint(ctypes.byref(fs), ctypes.c_char_p(bytes(OTHER_IMAGE,"UTF-8")))
+        assert written == image_size(100)
+
+        loaded = libc.fs_load(ctypes.c_char_p(bytes(OTHER_IMAGE,"UTF-8"))).contents
+        assert loaded.inodes[1].name.decode("utf-8") == "newDir"
+        delete_temp_file(OTHER_IMAGE)
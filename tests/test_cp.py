@@ -1,6 +1,18 @@
 import ctypes
 from wrappers import *
 
+# a private handle, so the restype doesn't change for the other tests
+readf = libc["fs_readf"]
+readf.restype = ctypes.c_void_p
+
+def path(p):
+    return ctypes.c_char_p(bytes(p,"UTF-8"))
+
+def read(fs, p):
+    size = ctypes.c_int(0)
+    ptr = readf(ctypes.byref(fs), path(p), ctypes.byref(size))
+    return ctypes.string_at(ptr, size.value) if ptr else b""
+
 class Test_Cp:
     # successful mkdir operation on a fresh filesystem
     # * valid path
@@ -71,3 +83,108 @@ class Test_Cp:
         assert fs.inodes[4].n_type == 2 # meaning it is marked as directory
         assert fs.inodes[3].direct_blocks[0] == 4 #fs.inodes[0] is the root node. its first direct block should point to the 1st inode (where the new dir is located)
         assert fs.inodes[4].parent == 3
+
+    # A copied file shares the data blocks of its source
+    # Expected outcome:
+    #  * no data block is allocated, both files map the same blocks
+    #  * the free list counts two references per block
+    def test_cp_shares_blocks(self):
+        fs = setup(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/src"))
+        libc.fs_writef(ctypes.byref(fs), path("/src"), path(LONG_DATA))
+        free = fs.s_block.contents.free_blocks
+        assert libc.fs_cp(ctypes.byref(fs), path("/src"), path("/copy")) == 0
+        assert fs.s_block.contents.free_blocks == free
+        assert [fs.inodes[2].direct_blocks[i] for i in range(2)] == [fs.inodes[1].direct_blocks[i] for i in range(2)]
+        assert fs.free_list[fs.inodes[1].direct_blocks[0]] == 2
+        assert read(fs, "/copy") == bytes(LONG_DATA,"UTF-8")
+
+    # Writing to either side copies only the blocks it changes
+    # Expected outcome:
+    #  * the other file keeps its content
+    #  * the untouched blocks stay shared
+    def test_cp_copy_on_write(self):
+        fs = setup(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/src"))
+        libc.fs_writef(ctypes.byref(fs), path("/src"), path(LONG_DATA))
+        libc.fs_cp(ctypes.byref(fs), path("/src"), path("/copy"))
+        shared = fs.inodes[1].direct_blocks[0]
+
+        assert libc.fs_writef(ctypes.byref(fs), path("/copy"), path("tail")) == 4
+        assert read(fs, "/src") == bytes(LONG_DATA,"UTF-8")
+        assert read(fs, "/copy") == bytes(LONG_DATA + "tail","UTF-8")
+        assert fs.inodes[2].direct_blocks[0] == shared
+        assert fs.inodes[2].direct_blocks[1] != fs.inodes[1].direct_blocks[1]
+        assert fs.free_list[fs.inodes[1].direct_blocks[1]] == 0
+
+        libc.fs_pwrite.restype = ctypes.c_long
+        assert libc.fs_pwrite(ctypes.byref(fs), path("/src"), ctypes.c_uint64(0), ctypes.c_char_p(b"XY"), ctypes.c_size_t(2)) == 2
+        assert read(fs, "/src") == bytes("XY" + LONG_DATA[2:],"UTF-8")
+        assert read(fs, "/copy") == bytes(LONG_DATA + "tail","UTF-8")
+        assert fs.free_list[shared] == 0
+
+    # Blocks behind the direct blocks are copied on write as well
+    def test_cp_copy_on_write_extents(self):
+        data = bytes(LONG_DATA,"UTF-8") * 20
+        fs = setup(100)
+        libc.fs_mkfile(ctypes.byref(fs), path("/src"))
+        libc.fs_writef(ctypes.byref(fs), path("/src"), ctypes.c_char_p(data))
+        libc.fs_cp(ctypes.byref(fs), path("/src"), path("/copy"))
+        libc.fs_pwrite.restype = ctypes.c_long
+        assert libc.fs_pwrite(ctypes.byref(fs), path("/copy"), ctypes.c_uint64(15 * BLOCK_SIZE), ctypes.c_char_p(b"z" * 3000), ctypes.c_size_t(3000)) == 3000
+        assert read(fs, "/src") == data
+        assert read(fs, "/copy") == data[:15 * BLOCK_SIZE] + b"z" * 3000 + data[15 * BLOCK_SIZE + 3000:]
+
+    # Removing one side keeps the blocks for the other, the last one frees them
+    def test_cp_rm_shared(self):
+        fs = setup(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/src"))
+        libc.fs_writef(ctypes.byref(fs), path("/src"), path(LONG_DATA))
+        libc.fs_cp(ctypes.byref(fs), path("/src"), path("/copy"))
+        assert libc.fs_rm(ctypes.byref(fs), path("/src")) == 0
+        assert read(fs, "/copy") == bytes(LONG_DATA,"UTF-8")
+        assert fs.s_block.contents.free_blocks == 8
+        assert libc.fs_rm(ctypes.byref(fs), path("/copy")) == 0
+        assert fs.s_block.contents.free_blocks == 10
+
+    # Importing over a copy replaces its blocks and leaves the source alone
+    def test_cp_import_over_copy(self):
+        create_temp_file()
+        fs = setup(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/src"))
+        libc.fs_writef(ctypes.byref(fs), path("/src"), path(LONG_DATA))
+        libc.fs_cp(ctypes.byref(fs), path("/src"), path("/copy"))
+        assert libc.fs_import(ctypes.byref(fs), path("/copy"), path(DEFAULT_TEST_FILE_NAME)) == 0
+        assert read(fs, "/copy") == bytes(SHORT_DATA,"UTF-8")
+        assert read(fs, "/src") == bytes(LONG_DATA,"UTF-8")
+        assert fs.free_list[fs.inodes[1].direct_blocks[0]] == 0
+        delete_temp_file()
+
+    # Trees deeper than any path buffer are copied and removed node by node
+    # Expected outcome:
+    #  * the copy has the file at the bottom, reachable by its long path
+    #  * removing both trees gives every inode and block back
+    def test_cp_rm_deep_tree(self):
+        fs = setup(200)
+        deep = "".join("/dir%06d" % i for i in range(60))
+        for i in range(1, 61):
+            assert libc.fs_mkdir(ctypes.byref(fs), path(deep[:i * 10])) == 0
+        libc.fs_mkfile(ctypes.byref(fs), path(deep + "/fil"))
+        libc.fs_writef(ctypes.byref(fs), path(deep + "/fil"), path(LONG_DATA))
+
+        assert libc.fs_cp(ctypes.byref(fs), path("/dir000000"), path("/copy")) == 0
+        assert read(fs, "/copy" + deep[10:] + "/fil") == bytes(LONG_DATA,"UTF-8")
+        assert libc.fs_rm(ctypes.byref(fs), path("/dir000000")) == 0
+        assert read(fs, "/copy" + deep[10:] + "/fil") == bytes(LONG_DATA,"UTF-8")
+        assert libc.fs_rm(ctypes.byref(fs), path("/copy")) == 0
+        assert fs.s_block.contents.free_blocks == 200
+        assert all(fs.inodes[i].n_type == 3 for i in range(1, 200))
+
+    # A directory copied into itself gets the content it had before the copy
+    def test_cp_into_itself(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/a"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/a/f"))
+        assert libc.fs_cp(ctypes.byref(fs), path("/a"), path("/a/b")) == 0
+        assert libc.traverse_path(ctypes.byref(fs), path("/a/b/f"), 6) != -1
+        assert libc.traverse_path(ctypes.byref(fs), path("/a/b/b"), 6) == -1
@@ -0,0 +1,93 @@
+import ctypes
+from wrappers import *
+
+class DcacheStats(ctypes.Structure):
+    _fields_ = [
+        ("path_hits", ctypes.c_uint64),
+        ("path_misses", ctypes.c_uint64),
+        ("name_hits", ctypes.c_uint64),
+        ("name_misses", ctypes.c_uint64)
+    ]
+
+def path(p):
+    return ctypes.c_char_p(bytes(p,"UTF-8"))
+
+def stats(fs):
+    s = DcacheStats()
+    libc.dcache_get_stats(ctypes.byref(fs), ctypes.byref(s))
+    return s
+
+class Test_Dcache:
+    # Resolving the same deep path again takes a single probe of the path table
+    # Expected outcome:
+    #  * the second write is a path hit and doesn't look at any component
+    def test_dcache_path_hit(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/a"))
+        libc.fs_mkdir(ctypes.byref(fs), path("/a/b"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/a/b/fil"))
+        assert libc.fs_writef(ctypes.byref(fs), path("/a/b/fil"), path("x")) == 1
+
+        before = stats(fs)
+        assert libc.fs_writef(ctypes.byref(fs), path("/a/b/fil"), path("y")) == 1
+        after = stats(fs)
+        assert after.path_hits == before.path_hits + 1
+        assert after.name_hits + after.name_misses == before.name_hits + before.name_misses
+
+    # Removing a file drops its entries, a new file with the same name is found instead
+    def test_dcache_rm(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/a"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/a/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/a/fil"), path("old"))
+        assert libc.fs_rm(ctypes.byref(fs), path("/a/fil")) == 0
+        assert libc.fs_writef(ctypes.byref(fs), path("/a/fil"), path("old")) == -1
+
+        # Take another inode first, so the new file doesn't reuse the old one
+        libc.fs_mkdir(ctypes.byref(fs), path("/b"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/a/fil"))
+        assert libc.fs_writef(ctypes.byref(fs), path("/a/fil"), path("new")) == 3
+        assert fs.inodes[3].name.decode("utf-8") == "fil"
+        assert fs.inodes[3].size == 3
+
+    # Removing a directory drops the entries of everything below it
+    def test_dcache_rm_dir(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/a"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/a/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/a/fil"), path("x"))
+        assert libc.fs_rm(ctypes.byref(fs), path("/a")) == 0
+        assert libc.fs_writef(ctypes.byref(fs), path("/a/fil"), path("x")) == -1
+
+        libc.fs_mkfile(ctypes.byref(fs), path("/a"))
+        assert libc.fs_writef(ctypes.byref(fs), path("/a/fil"), path("x")) == -1
+        assert libc.fs_writef(ctypes.byref(fs), path("/a"), path("x")) == 1
+
+    # Cached entries are checked against the inodes, changing them directly is noticed
+    def test_dcache_changed_inode(self):
+        fs = setup(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/fil"), path("x"))
+        fs.inodes[1].name = bytes("other","utf-8")
+        assert libc.fs_writef(ctypes.byref(fs), path("/fil"), path("x")) == -1
+        assert libc.fs_writef(ctypes.byref(fs), path("/other"), path("x")) == 1
+
+    # Many threads read the same cached path at once
+    # Expected outcome:
+    #  * every read sees the file and every lookup is counted once
+    def test_dcache_threads(self):
+        fs = setup(10)
+        assert libc.fs_threads_enable(ctypes.byref(fs)) == 0
+        libc.fs_mkdir(ctypes.byref(fs), path("/a"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/a/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/a/fil"), path("x"))
+        assert read_all(fs, "/a/fil") == b"x"
+
+        before = stats(fs)
+        def work(t):
+            for i in range(200):
+                assert read_all(fs, "/a/fil") == b"x"
+        run_threads(work)
+        after = stats(fs)
+        assert after.path_hits == before.path_hits + THREADS * 200
+        assert after.path_misses == before.path_misses
@@ -0,0 +1,70 @@
+import ctypes
+from wrappers import *
+
+def path(p):
+    return ctypes.c_char_p(bytes(p,"UTF-8"))
+
+def count(fs, dir):
+    libc.dir_count.restype = ctypes.c_uint32
+    return libc.dir_count(ctypes.byref(fs), dir)
+
+class Test_Dir:
+    # A directory with more children than direct blocks moves them into a hash table
+    # Expected outcome:
+    #  * every child can be created and found again
+    #  * the direct blocks are empty, the table lives in data blocks
+    def test_dir_many_children(self):
+        fs = setup(2000)
+        libc.fs_mkdir(ctypes.byref(fs), path("/d"))
+        for i in range(1500):
+            assert libc.fs_mkfile(ctypes.byref(fs), path(f"/d/f{i}")) == 0
+        assert libc.fs_mkfile(ctypes.byref(fs), path("/d/f700")) == -2
+        assert count(fs, 1) == 1500
+        assert fs.inodes[1].indirect_block != -1
+        assert all(fs.inodes[1].direct_blocks[i] == -1 for i in range(DIRECT_BLOCKS_COUNT))
+        for i in range(0, 1500, 7):
+            assert libc.fs_writef(ctypes.byref(fs), path(f"/d/f{i}"), path("x")) == 1
+
+    # Removing children leaves the others reachable and a small table moves back inline
+    # Expected outcome:
+    #  * removed children are gone, the rest is still found
+    #  * all blocks of the table are free again
+    def test_dir_remove_children(self):
+        fs = setup(200)
+        libc.fs_mkdir(ctypes.byref(fs), path("/d"))
+        for i in range(40):
+            libc.fs_mkdir(ctypes.byref(fs), path(f"/d/s{i}"))
+        assert fs.s_block.contents.free_blocks < 200
+
+        for i in range(35):
+            assert libc.fs_rm(ctypes.byref(fs), path(f"/d/s{i}")) == 0
+            assert libc.fs_mkfile(ctypes.byref(fs), path(f"/d/s{i}/f")) == -1
+            for j in range(i + 1, 40):
+                assert libc.fs_mkdir(ctypes.byref(fs), path(f"/d/s{j}")) == -1
+        assert count(fs, 1) == 5
+        assert fs.inodes[1].indirect_block == -1
+        assert fs.s_block.contents.free_blocks == 200
+
+    # Removing a big directory frees its table as well
+    def test_dir_rm_big(self):
+        fs = setup(500)
+        libc.fs_mkdir(ctypes.byref(fs), path("/d"))
+        for i in range(300):
+            libc.fs_mkfile(ctypes.byref(fs), path(f"/d/f{i}"))
+        assert libc.fs_rm(ctypes.byref(fs), path("/d")) == 0
+        assert fs.s_block.contents.free_blocks == 500
+        assert libc.fs_mkdir(ctypes.byref(fs), path("/d")) == 0
+        assert count(fs, fs.inodes[0].direct_blocks[0]) == 0
+
+    # A hashed directory can be copied and listed, the listing is sorted by inode number
+    def test_dir_cp_list(self):
+        fs = setup(200)
+        libc.fs_mkdir(ctypes.byref(fs), path("/d"))
+        for i in range(20):
+            libc.fs_mkfile(ctypes.byref(fs), path(f"/d/f{i}"))
+        assert libc.fs_cp(ctypes.byref(fs), path("/d"), path("/e")) == 0
+        libc.fs_list.restype = ctypes.c_char_p
+        listing = libc.fs_list(ctypes.byref(fs), path("/d")).decode("utf-8")
+        assert listing == "".join(f"FIL f{i}\n" for i in range(20))
+        copy = libc.fs_list(ctypes.byref(fs), path("/e")).decode("utf-8")
+        assert sorted(copy.splitlines()) == sorted(listing.splitlines())
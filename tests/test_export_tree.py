@@ -0,0 +1,90 @@
+import ctypes
+from wrappers import *
+
+export_tree = libc["fs_export_tree"]
+export_tree.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int]
+
+def run_export(fs, int_dir, ext_dir, nthreads):
+    return export_tree(ctypes.addressof(fs), bytes(int_dir,"UTF-8"), bytes(str(ext_dir),"UTF-8"), nthreads)
+
+def make_fs_tree(fs, root=""):
+    files = {}
+    for d in range(4):
+        assert mkdir(ctypes.addressof(fs), bytes("%s/dir%d" % (root, d),"UTF-8")) == 0
+        assert mkdir(ctypes.addressof(fs), bytes("%s/dir%d/inner" % (root, d),"UTF-8")) == 0
+        for f in range(5):
+            files["/dir%d/f%d" % (d, f)] = bytes([97 + d]) * (f * 700)
+        files["/dir%d/inner/deep" % d] = b"deep" * d
+    # Larger than what one writev takes
+    files["/big"] = bytes(range(256)) * (300 * BLOCK_SIZE // 256)
+    for p, content in files.items():
+        full = bytes(root + p,"UTF-8")
+        assert mkfile(ctypes.addressof(fs), full) == 0
+        assert pwrite(ctypes.addressof(fs), full, 0, content, len(content)) == len(content)
+    return files
+
+def host_files(root):
+    return {"/" + str(p.relative_to(root)): p.read_bytes() for p in root.rglob("*") if p.is_file()}
+
+class Test_Export_Tree:
+    # Exports nested directories, empty files and a file of 300 blocks on several threads
+    # Expected outcome:
+    #  * every directory and file is on the host with its content, empty files too
+    def test_export_tree_threads(self, tmp_path):
+        fs = setup(500)
+        files = make_fs_tree(fs)
+        assert run_export(fs, "/", tmp_path / "out", 4) == 0
+        assert host_files(tmp_path / "out") == files
+        assert sorted(p.name for p in (tmp_path / "out").iterdir()) == ["big", "dir0", "dir1", "dir2", "dir3"]
+        assert (tmp_path / "out" / "dir0" / "inner").is_dir()
+
+    # Exports a subdirectory into a host directory that already holds some of its entries
+    # Expected outcome:
+    #  * existing files are overwritten, longer ones are cut, other host files stay
+    #  * a single thread gives the same result
+    def test_export_tree_merge(self, tmp_path):
+        fs = setup(500)
+        assert mkdir(ctypes.addressof(fs), b"/data") == 0
+        files = make_fs_tree(fs, "/data")
+        (tmp_path / "dir1").mkdir()
+        (tmp_path / "dir1" / "f1").write_bytes(b"x" * 5000)
+        (tmp_path / "keep").write_bytes(b"keep")
+        assert run_export(fs, "/data", tmp_path, 1) == 0
+        files["/keep"] = b"keep"
+        assert host_files(tmp_path) == files
+
+    # The host has a file where the fs has a directory
+    # Expected outcome:
+    #  * -2, the directory is skipped with everything below it and the rest is exported
+    def test_export_tree_partial(self, tmp_path):
+        fs = setup(500)
+        files = make_fs_tree(fs)
+        (tmp_path / "dir2").write_bytes(b"in the way")
+        assert run_export(fs, "/", tmp_path, 3) == -2
+        expected = {p: c for p, c in files.items() if not p.startswith("/dir2/")}
+        expected["/dir2"] = b"in the way"
+        assert host_files(tmp_path) == expected
+
+    # Exports a tree and imports it into a new file system
+    # Expected outcome:
+    #  * the new file system holds the same files
+    def test_export_tree_roundtrip(self, tmp_path):
+        fs = setup(500)
+        files = make_fs_tree(fs)
+        assert run_export(fs, "/", tmp_path, 2) == 0
+        copy = setup(500)
+        assert import_tree(ctypes.addressof(copy), b"/", bytes(str(tmp_path),"UTF-8"), 2) == 0
+        buf = ctypes.create_string_buffer(1 << 19)
+        for p, content in files.items():
+            assert pread(ctypes.addressof(copy), bytes(p,"UTF-8"), 0, 1 << 19, buf) == len(content)
+            assert buf.raw[:len(content)] == content
+
+    # Invalid roots
+    # Expected outcome:
+    #  * -1 if the internal path is missing or no directory or the host directory can't be created
+    def test_export_tree_invalid(self, tmp_path):
+        fs = setup(20)
+        assert mkfile(ctypes.addressof(fs), b"/file") == 0
+        assert run_export(fs, "/missing", tmp_path, 2) == -1
+        assert run_export(fs, "/file", tmp_path, 2) == -1
+        assert run_export(fs, "/", tmp_path / "missing" / "out", 2) == -1
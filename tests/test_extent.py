@@ -0,0 +1,69 @@
+import ctypes
+import os
+from wrappers import *
+
+# a private handle, so the restype doesn't change for the other tests
+readf = libc["fs_readf"]
+readf.restype = ctypes.c_void_p
+
+def path(p):
+    return ctypes.c_char_p(bytes(p,"UTF-8"))
+
+def read(fs, p):
+    size = ctypes.c_int(0)
+    ptr = readf(ctypes.byref(fs), path(p), ctypes.byref(size))
+    return ctypes.string_at(ptr, size.value) if ptr else b""
+
+class Test_Extent:
+    # Files larger than the direct blocks can be imported, read and exported
+    # Expected outcome:
+    #  * the blocks behind the direct blocks are mapped by the extent tree
+    #  * reading and exporting returns the imported bytes
+    def test_extent_import_export(self):
+        data = os.urandom(300 * BLOCK_SIZE + 123)
+        with open(DEFAULT_TEST_FILE_NAME, "wb") as f:
+            f.write(data)
+
+        fs = setup(400)
+        libc.fs_mkfile(ctypes.byref(fs), path("/big"))
+        assert libc.fs_import(ctypes.byref(fs), path("/big"), path(DEFAULT_TEST_FILE_NAME)) == 0
+        assert fs.inodes[1].size == len(data)
+        assert fs.inodes[1].indirect_block != -1
+        assert read(fs, "/big") == data
+
+        os.remove(DEFAULT_TEST_FILE_NAME)
+        assert libc.fs_export(ctypes.byref(fs), path("/big"), path(DEFAULT_TEST_FILE_NAME)) == 0
+        with open(DEFAULT_TEST_FILE_NAME, "rb") as f:
+            assert f.read() == data
+        delete_temp_file()
+
+    # Appending across the end of the direct blocks continues in the extent tree
+    def test_extent_writef(self):
+        fs = setup(40)
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        assert libc.fs_writef(ctypes.byref(fs), path("/fil"), path("a" * 12000)) == 12000
+        assert fs.inodes[1].indirect_block == -1
+        assert libc.fs_writef(ctypes.byref(fs), path("/fil"), path("b" * 3000)) == 3000
+        assert fs.inodes[1].size == 15000
+        assert read(fs, "/fil") == b"a" * 12000 + b"b" * 3000
+
+    # Interleaved writes fragment both files, so the tree needs more than one leaf
+    # Expected outcome:
+    #  * both files read back correctly and can be copied
+    #  * removing them frees every data and tree block
+    def test_extent_fragmented(self):
+        fs = setup(1000)
+        libc.fs_mkfile(ctypes.byref(fs), path("/a"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/b"))
+        for i in range(200):
+            libc.fs_writef(ctypes.byref(fs), path("/a"), path(chr(ord("a") + i % 26) * BLOCK_SIZE))
+            libc.fs_writef(ctypes.byref(fs), path("/b"), path(chr(ord("A") + i % 26) * BLOCK_SIZE))
+
+        expected = b"".join(bytes([ord("a") + i % 26]) * BLOCK_SIZE for i in range(200))
+        assert read(fs, "/a") == expected
+        assert libc.fs_cp(ctypes.byref(fs), path("/a"), path("/c")) == 0
+        assert read(fs, "/c") == expected
+
+        for p in ["/a", "/b", "/c"]:
+            assert libc.fs_rm(ctypes.byref(fs), path(p)) == 0
+        assert fs.s_block.contents.free_blocks == 1000
@@ -45,4 +45,34 @@ class Test_Imp:
         delete_temp_file()
 
 
-    # TODO: add test for failing operations
+    # Imports a file that doesn't fit into an image that already holds the target file
+    # Expected behaviour:
+    #  * the operation fails before anything is read, retval is -1
+    #  * the old content of the file and the free blocks are unchanged
+    def test_import_too_big(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")), ctypes.c_char_p(bytes(SHORT_DATA,"UTF-8")))
+        filename = create_temp_file(data=LONG_DATA * 4)
+        retval = libc.fs_import(ctypes.byref(fs),ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(filename,"utf-8")))
+
+        assert retval == -1
+        assert fs.inodes[1].size == len(SHORT_DATA)
+        assert fs.inodes[1].direct_blocks[0] == 0
+        assert fs.s_block.contents.free_blocks == 4
+        delete_temp_file()
+
+    # Importing over a file replaces its content and frees the old blocks
+    def test_import_replace(self):
+        fs = setup(10)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        filename = create_temp_file(data=LONG_DATA)
+        libc.fs_import(ctypes.byref(fs),ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(filename,"utf-8")))
+        filename = create_temp_file(data=SHORT_DATA)
+        retval = libc.fs_import(ctypes.byref(fs),ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(filename,"utf-8")))
+
+        assert retval == 0
+        assert fs.inodes[1].size == len(SHORT_DATA)
+        assert fs.inodes[1].direct_blocks[1] == -1
+        assert fs.s_block.contents.free_blocks == 9
+        delete_temp_file()
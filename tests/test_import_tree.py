@@ -0,0 +1,132 @@
+import ctypes
+import os
+from wrappers import *
+
+writef = libc["fs_writef"]
+writef.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+
+def run_import(fs, int_dir, ext_dir, nthreads):
+    return import_tree(ctypes.addressof(fs), bytes(int_dir,"UTF-8"), bytes(str(ext_dir),"UTF-8"), nthreads)
+
+def make_host_tree(root):
+    files = {}
+    for d in range(4):
+        sub = root / ("dir%d" % d)
+        (sub / "inner").mkdir(parents=True)
+        for f in range(5):
+            content = bytes([97 + d]) * (f * 700)
+            (sub / ("f%d" % f)).write_bytes(content)
+            files["/dir%d/f%d" % (d, f)] = content
+        (sub / "inner" / "deep").write_bytes(b"deep" * d)
+        files["/dir%d/inner/deep" % d] = b"deep" * d
+    (root / "top").write_bytes(bytes(LONG_DATA,"UTF-8"))
+    files["/top"] = bytes(LONG_DATA,"UTF-8")
+    return files
+
+class Test_Import_Tree:
+    # Imports a host tree with nested directories and files of 0 to 3 blocks on several threads
+    # Expected outcome:
+    #  * every directory and file is there with its content
+    #  * the blocks the workers didn't use went back to the allocator
+    def test_import_tree_threads(self, tmp_path):
+        files = make_host_tree(tmp_path)
+        fs = setup(400)
+        assert run_import(fs, "/", tmp_path, 4) == 0
+        assert listing(fs, "/") == sorted(["DIR dir0", "DIR dir1", "DIR dir2", "DIR dir3", "FIL top"])
+        assert listing(fs, "/dir2") == sorted(["DIR inner"] + ["FIL f%d" % f for f in range(5)])
+        for p, content in files.items():
+            assert read_all(fs, p) == content
+        used = sum((len(c) + BLOCK_SIZE - 1) // BLOCK_SIZE for c in files.values())
+        assert fs.s_block.contents.free_blocks == 400 - used
+        check_free_blocks(fs)
+
+    # Several threads only turn the locks on for the import, locks the caller enabled stay on
+    def test_import_tree_locks(self, tmp_path):
+        make_host_tree(tmp_path)
+        fs = setup(400)
+        assert run_import(fs, "/", tmp_path, 4) == 0
+        assert not fs.locks
+
+        fs = setup(400)
+        assert libc.fs_threads_enable(ctypes.byref(fs)) == 0
+        assert run_import(fs, "/", tmp_path, 4) == 0
+        assert fs.locks
+
+    # Imports into an existing directory that already holds a file and a directory of the tree
+    # Expected outcome:
+    #  * the directory is merged, the file gets the content of the host file
+    #  * a single thread gives the same result
+    def test_import_tree_merge(self, tmp_path):
+        files = make_host_tree(tmp_path)
+        fs = setup(400)
+        assert mkdir(ctypes.addressof(fs), b"/data") == 0
+        assert mkdir(ctypes.addressof(fs), b"/data/dir1") == 0
+        assert mkfile(ctypes.addressof(fs), b"/data/top") == 0
+        assert writef(ctypes.addressof(fs), b"/data/top", b"old content") == 11
+        assert run_import(fs, "/data", tmp_path, 1) == 0
+        for p, content in files.items():
+            assert read_all(fs, "/data" + p) == content
+        check_free_blocks(fs)
+
+    # The host tree has a name that is too long, a symlink and a file where the fs has a directory
+    # Expected outcome:
+    #  * -2, everything else is imported and the symlink is skipped
+    def test_import_tree_partial(self, tmp_path):
+        files = make_host_tree(tmp_path)
+        (tmp_path / ("x" * NAME_MAX_LENGTH)).write_bytes(b"long name")
+        os.symlink(tmp_path / "top", tmp_path / "link")
+        fs = setup(400)
+        assert mkdir(ctypes.addressof(fs), b"/top") == 0
+        assert run_import(fs, "/", tmp_path, 3) == -2
+        assert listing(fs, "/") == sorted(["DIR dir0", "DIR dir1", "DIR dir2", "DIR dir3", "DIR top"])
+        for p, content in files.items():
+            if p != "/top":
+                assert read_all(fs, p) == content
+        check_free_blocks(fs)
+
+    # Imports into a file system that is too small for everything
+    # Expected outcome:
+    #  * -2, the files that didn't fit are empty and no block is lost
+    def test_import_tree_full(self, tmp_path):
+        make_host_tree(tmp_path)
+        fs = setup(20)
+        assert run_import(fs, "/", tmp_path, 4) == -2
+        check_free_blocks(fs)
+
+    # A file needs every free block, so its blocks fit but the extent index block doesn't.
+    # The directory below is imported after it by the same worker
+    # Expected outcome:
+    #  * -2, the big file is empty
+    #  * the small file got a block of its own, no block is free and used at once
+    def test_import_tree_no_index_block(self, tmp_path):
+        fs = setup(40)
+        free_before = fs.s_block.contents.free_blocks
+        (tmp_path / "big").write_bytes(b"b" * (free_before * BLOCK_SIZE))
+        (tmp_path / "sub").mkdir()
+        (tmp_path / "sub" / "small").write_bytes(b"small")
+        assert run_import(fs, "/", tmp_path, 1) == -2
+        assert read_all(fs, "/big") == b""
+        assert read_all(fs, "/sub/small") == b"small"
+        assert fs.s_block.contents.free_blocks == free_before - 1
+        check_free_blocks(fs)
+
+    # A file that is there already gets host content that doesn't fit
+    # Expected outcome:
+    #  * -2, the file keeps its old content and no block is lost
+    def test_import_tree_keeps_old(self, tmp_path):
+        fs = setup(20)
+        assert mkfile(ctypes.addressof(fs), b"/top") == 0
+        assert writef(ctypes.addressof(fs), b"/top", b"old content") == 11
+        (tmp_path / "top").write_bytes(b"t" * (20 * BLOCK_SIZE))
+        for nthreads in (1, 2):
+            assert run_import(fs, "/", tmp_path, nthreads) == -2
+            assert read_all(fs, "/top") == b"old content"
+            check_free_blocks(fs)
+
+    # Invalid roots
+    # Expected outcome:
+    #  * -1 if the internal directory doesn't exist or the host directory can't be read
+    def test_import_tree_invalid(self, tmp_path):
+        fs = setup(20)
+        assert run_import(fs, "/missing", tmp_path, 2) == -1
+        assert run_import(fs, "/", tmp_path / "missing", 2) == -1
@@ -0,0 +1,127 @@
+import ctypes
+import os
+import pytest
+from wrappers import *
+
+class IoBatch(ctypes.Structure):
+    _fields_ = [
+        ("fd", ctypes.c_int),
+        ("write", ctypes.c_int),
+        ("reqs", ctypes.c_void_p),
+        ("count", ctypes.c_size_t),
+        ("cap", ctypes.c_size_t),
+        ("failed", ctypes.c_int),
+    ]
+
+class IoVec(ctypes.Structure):
+    _fields_ = [("iov_base", ctypes.c_void_p), ("iov_len", ctypes.c_size_t)]
+
+IO_ENGINE_AUTO = 0
+IO_ENGINE_URING = 1
+IO_ENGINE_THREADS = 2
+IO_CHUNK_SIZE = 256 * 1024
+
+set_engine = libc["io_set_engine"]
+set_engine.argtypes = [ctypes.c_int]
+get_engine = libc["io_get_engine"]
+batch_init = libc["io_batch_init"]
+batch_init.argtypes = [ctypes.POINTER(IoBatch), ctypes.c_int, ctypes.c_int]
+batch_add = libc["io_batch_add"]
+batch_add.argtypes = [ctypes.POINTER(IoBatch), ctypes.POINTER(IoVec), ctypes.c_int, ctypes.c_uint64]
+batch_run = libc["io_batch_run"]
+batch_run.argtypes = [ctypes.POINTER(IoBatch)]
+load = libc["fs_load"]
+load.restype = ctypes.POINTER(FileSystem)
+load.argtypes = [ctypes.c_char_p]
+dump = libc["fs_dump"]
+dump.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+checkpoint = libc["fs_checkpoint"]
+checkpoint.restype = ctypes.c_long
+checkpoint.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+
+TEST_IMAGE = "./mypyfiles.fs" # the image setup() creates
+
+@pytest.fixture(params=[IO_ENGINE_URING, IO_ENGINE_THREADS], ids=["uring", "threads"])
+def engine(request):
+    if set_engine(request.param) == -1:
+        pytest.skip("io_uring is not available")
+    assert get_engine() == request.param
+    yield request.param
+    set_engine(IO_ENGINE_AUTO)
+
+def read_all(fs, p, size):
+    buf = ctypes.create_string_buffer(size)
+    ret = pread(ctypes.addressof(fs), bytes(p,"UTF-8"), 0, size, buf)
+    return buf.raw[:ret]
+
+def fill(fs, count, size):
+    files = {}
+    for i in range(count):
+        p = "/file%d" % i
+        content = os.urandom(size)
+        assert mkfile(ctypes.addressof(fs), bytes(p,"UTF-8")) == 0
+        assert pwrite(ctypes.addressof(fs), bytes(p,"UTF-8"), 0, content, len(content)) == len(content)
+        files[p] = content
+    return files
+
+def run_batch(fd, write, buffers, offset):
+    iov = (IoVec * len(buffers))(*[IoVec(ctypes.addressof(b), len(b)) for b in buffers])
+    batch = IoBatch()
+    batch_init(ctypes.byref(batch), fd, write)
+    assert batch_add(ctypes.byref(batch), iov, len(buffers), offset) == 0
+    return batch_run(ctypes.byref(batch))
+
+class Test_Io:
+    # Buffers of odd sizes that cross chunk boundaries are written and read back
+    # Expected outcome:
+    #  * the file holds the buffers one after another from the offset on
+    #  * reading them back gives the same bytes
+    def test_io_batch(self, engine, tmp_path):
+        path = tmp_path / "batch"
+        data = [os.urandom(n) for n in (1, 300000, 4096, IO_CHUNK_SIZE * 3 + 7, 12345)]
+        fd = os.open(path, os.O_RDWR | os.O_CREAT)
+        try:
+            assert run_batch(fd, 1, [ctypes.create_string_buffer(d, len(d)) for d in data], 1000) == 0
+            assert path.read_bytes()[1000:] == b"".join(data)
+            buffers = [ctypes.create_string_buffer(len(d)) for d in data]
+            assert run_batch(fd, 0, buffers, 1000) == 0
+            assert [b.raw for b in buffers] == data
+        finally:
+            os.close(fd)
+
+    # A read that reaches behind the end of the file
+    # Expected outcome:
+    #  * -1
+    def test_io_batch_eof(self, engine, tmp_path):
+        path = tmp_path / "short"
+        path.write_bytes(b"x" * 1000)
+        fd = os.open(path, os.O_RDONLY)
+        try:
+            assert run_batch(fd, 0, [ctypes.create_string_buffer(2000)], 0) == -1
+        finally:
+            os.close(fd)
+
+    # An image of several chunks is dumped and loaded again
+    # Expected outcome:
+    #  * the loaded file system holds the same files
+    def test_io_dump_load(self, engine, tmp_path):
+        fs = setup(1000)
+        files = fill(fs, 20, 30000)
+        image = bytes(str(tmp_path / "image.fs"),"UTF-8")
+        assert dump(ctypes.addressof(fs), image) == 0
+        loaded = load(image).contents
+        for p, content in files.items():
+            assert read_all(loaded, p, len(content)) == content
+
+    # Changes spread over the image are checkpointed into it
+    # Expected outcome:
+    #  * the checkpoint writes only part of the image, loading it gives the changed files
+    def test_io_checkpoint(self, engine):
+        fs = setup(1000)
+        image = bytes(TEST_IMAGE,"UTF-8")
+        assert checkpoint(ctypes.addressof(fs), image) >= 0
+        files = fill(fs, 10, 5000)
+        assert 0 < checkpoint(ctypes.addressof(fs), image)
+        loaded = load(image).contents
+        for p, content in files.items():
+            assert read_all(loaded, p, len(content)) == content
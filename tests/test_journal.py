@@ -0,0 +1,157 @@
+import ctypes
+import os
+from wrappers import *
+
+libc.fs_load.restype = ctypes.POINTER(FileSystem)
+libc.fs_checkpoint.restype = ctypes.c_long
+# a private handle, test_writev sets its own argtypes
+writev = libc["fs_writev"]
+
+TEST_IMAGE = "./mypyfiles.fs" # the image setup() creates
+JOURNAL = TEST_IMAGE + ".journal"
+
+def path(p):
+    return ctypes.c_char_p(bytes(p,"UTF-8"))
+
+def setup_journaled(fs_size):
+    fs = setup(fs_size)
+    assert libc.journal_open(ctypes.byref(fs), path(TEST_IMAGE)) == 0
+    return fs
+
+def load():
+    return libc.fs_load(path(TEST_IMAGE)).contents
+
+class Test_Journal:
+    # Operations that were never dumped are replayed when the image is loaded
+    # Expected outcome:
+    #  * the loaded fs contains the directory, the file and its content
+    #  * the content sits in the same block as before
+    def test_journal_replay(self):
+        fs = setup_journaled(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/dir/fil"), path(SHORT_DATA))
+        libc.fs_rm(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/fil"), path(SHORT_DATA))
+        block = fs.inodes[1].direct_blocks[0]
+        assert os.path.getsize(JOURNAL) > 0
+
+        loaded = load()
+        assert loaded.inodes[1].name.decode("utf-8") == "fil"
+        assert loaded.inodes[1].n_type == 1
+        assert loaded.inodes[1].direct_blocks[0] == block
+        assert loaded.inodes[2].n_type == 3
+        outstring = ctypes.c_char_p(ctypes.addressof(loaded.data_blocks[block].block)).value
+        assert outstring.decode("utf-8") == SHORT_DATA
+
+    # An imported file is replayed from the journal, even if the external file is gone
+    def test_journal_import(self):
+        create_temp_file()
+        fs = setup_journaled(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        libc.fs_import(ctypes.byref(fs), path("/fil"), path(DEFAULT_TEST_FILE_NAME))
+        delete_temp_file()
+
+        loaded = load()
+        assert loaded.inodes[1].size == len(SHORT_DATA)
+        block = loaded.inodes[1].direct_blocks[0]
+        outstring = ctypes.c_char_p(ctypes.addressof(loaded.data_blocks[block].block)).value
+        assert outstring.decode("utf-8")[:len(SHORT_DATA)] == SHORT_DATA
+
+    # Positional writes are replayed with their offset, binary data included
+    def test_journal_pwrite(self):
+        fs = setup_journaled(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/fil"), path(SHORT_DATA))
+        libc.fs_pwrite(ctypes.byref(fs), path("/fil"), ctypes.c_uint64(4), ctypes.c_char_p(b"\0x\0"), ctypes.c_size_t(3))
+
+        loaded = load()
+        assert loaded.inodes[1].size == len(SHORT_DATA)
+        block = loaded.inodes[1].direct_blocks[0]
+        expected = bytes(SHORT_DATA[:4],"UTF-8") + b"\0x\0" + bytes(SHORT_DATA[7:],"UTF-8")
+        assert ctypes.string_at(ctypes.addressof(loaded.data_blocks[block].block), len(SHORT_DATA)) == expected
+
+    # A vectored append is replayed as one buffer
+    def test_journal_writev(self):
+        fs = setup_journaled(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        iov = (ctypes.c_void_p * 4)()
+        parts = [ctypes.create_string_buffer(b"a" * 1000, 1000), ctypes.create_string_buffer(b"b" * 100, 100)]
+        iov[0], iov[1], iov[2], iov[3] = ctypes.addressof(parts[0]), 1000, ctypes.addressof(parts[1]), 100
+        assert writev(ctypes.byref(fs), path("/fil"), iov, 2) == 1100
+
+        loaded = load()
+        assert loaded.inodes[1].size == 1100
+        data = b"".join(ctypes.string_at(ctypes.addressof(loaded.data_blocks[loaded.inodes[1].direct_blocks[i]].block), n) for i, n in [(0, 1024), (1, 76)])
+        assert data == b"a" * 1000 + b"b" * 100
+
+    # A checkpoint writes the changes into the image and empties the journal
+    def test_journal_checkpoint(self):
+        fs = setup_journaled(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        assert libc.fs_checkpoint(ctypes.byref(fs), path(TEST_IMAGE)) > 0
+        assert os.path.getsize(JOURNAL) == 0
+
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir2"))
+        loaded = load()
+        assert loaded.inodes[1].name.decode("utf-8") == "dir"
+        assert loaded.inodes[2].name.decode("utf-8") == "dir2"
+
+    # A record that was only partly written is ignored and cut off
+    def test_journal_torn_tail(self):
+        fs = setup_journaled(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir2"))
+        size = os.path.getsize(JOURNAL)
+        os.truncate(JOURNAL, size - 2)
+
+        loaded = load()
+        assert loaded.inodes[1].name.decode("utf-8") == "dir"
+        assert loaded.inodes[2].n_type == 3
+        assert os.path.getsize(JOURNAL) < size - 2
+
+    # Mounting replays the journal into the image itself, a later load must not apply it again
+    # Expected outcome:
+    #  * the mounted and the loaded fs both have the file with its content once
+    #  * the journal is gone after the mount
+    def test_journal_mount_then_load(self):
+        fs = setup_journaled(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/fil"), path(SHORT_DATA))
+        libc.journal_close(ctypes.byref(fs))
+
+        libc.fs_mount.restype = ctypes.POINTER(FileSystem)
+        mounted = libc.fs_mount(path(TEST_IMAGE)).contents
+        assert mounted.inodes[1].size == len(SHORT_DATA)
+        assert not os.path.exists(JOURNAL)
+        libc.cleanup(ctypes.byref(mounted))
+
+        loaded = load()
+        assert loaded.inodes[1].name.decode("utf-8") == "fil"
+        assert loaded.inodes[1].size == len(SHORT_DATA)
+
+    # The journal can't be written any more, e.g. because the disk is full
+    # Expected outcome:
+    #  * the operations still work, but nothing after the failure is logged
+    #  * a load replays the records before it, a dump starts logging again
+    def test_journal_write_fails(self):
+        fs = setup_journaled(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/before"))
+        journal_fd = next(int(fd) for fd in os.listdir("/proc/self/fd")
+                          if os.path.realpath("/proc/self/fd/" + fd) == os.path.realpath(JOURNAL))
+        readonly = os.open("/dev/null", os.O_RDONLY)
+        os.dup2(readonly, journal_fd)
+        os.close(readonly)
+        assert libc.fs_mkdir(ctypes.byref(fs), path("/lost")) == 0
+        assert libc.fs_mkdir(ctypes.byref(fs), path("/after")) == 0
+
+        loaded = load()
+        assert loaded.inodes[1].name.decode("utf-8") == "before"
+        assert loaded.inodes[2].n_type == 3
+
+        assert libc.fs_dump(ctypes.byref(fs), path(TEST_IMAGE)) == 0
+        libc.fs_mkdir(ctypes.byref(fs), path("/later"))
+        loaded = load()
+        assert loaded.inodes[3].name.decode("utf-8") == "after"
+        assert loaded.inodes[4].name.decode("utf-8") == "later"
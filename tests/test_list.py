@@ -35,3 +35,65 @@ class Test_List:
         libc.fs_list.restype = ctypes.c_char_p
         retval = libc.fs_list(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")))
         assert retval.decode("utf-8") == "DIR Dir1\nDIR Dir2\nDIR Dir3\nFIL Fil1\nFIL Fil2\n"
+
+    # Listings are not cut off at 4 KiB
+    # Expected outcome:
+    #  * every child is listed, sorted by inode-index
+    def test_list_large_dir(self):
+        fs = setup(400)
+        for i in range(300):
+            libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/file_with_a_long_name_%03d" % i,"UTF-8")))
+        libc.fs_list.restype = ctypes.c_char_p
+        retval = libc.fs_list(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")))
+        assert len(retval) > 4096
+        assert retval.decode("utf-8") == "".join("FIL file_with_a_long_name_%03d\n" % i for i in range(300))
+
+class Dirent(ctypes.Structure):
+    _fields_ = [
+        ("inode", ctypes.c_int),
+        ("type", ctypes.c_int),
+        ("name", ctypes.c_char_p)
+    ]
+
+class Dir(ctypes.Structure):
+    _fields_ = [
+        ("dir", ctypes.c_int),
+        ("children", ctypes.POINTER(ctypes.c_int)),
+        ("count", ctypes.c_uint32),
+        ("pos", ctypes.c_uint32),
+        ("inline_children", ctypes.c_int * 12),
+        ("entry", Dirent)
+    ]
+
+libc.fs_dir_next.restype = ctypes.POINTER(Dirent)
+
+class Test_Dir_Cursor:
+    # The cursor yields the children in inode order, for inline and hashed directories
+    def test_dir_cursor(self):
+        for count in [5, 40]:
+            fs = setup(50)
+            for i in reversed(range(count)):
+                libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/d%d" % i,"UTF-8")))
+            d = Dir()
+            assert libc.fs_dir_open(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")), ctypes.byref(d)) == 0
+            entries = []
+            entry = libc.fs_dir_next(ctypes.byref(fs), ctypes.byref(d))
+            while entry:
+                entries.append((entry.contents.inode, entry.contents.type, entry.contents.name.decode("utf-8")))
+                entry = libc.fs_dir_next(ctypes.byref(fs), ctypes.byref(d))
+            libc.fs_dir_close(ctypes.byref(d))
+            assert entries == [(i + 1, 2, "d%d" % (count - 1 - i)) for i in range(count)]
+
+    # Children removed while the directory is read are skipped, files can't be opened
+    def test_dir_cursor_removed(self):
+        fs = setup(10)
+        for name in ["a", "b", "c"]:
+            libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/" + name,"UTF-8")))
+        d = Dir()
+        assert libc.fs_dir_open(ctypes.byref(fs), ctypes.c_char_p(bytes("/a","UTF-8")), ctypes.byref(d)) == -1
+        assert libc.fs_dir_open(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")), ctypes.byref(d)) == 0
+        assert libc.fs_dir_next(ctypes.byref(fs), ctypes.byref(d)).contents.name == b"a"
+        libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/b","UTF-8")))
+        assert libc.fs_dir_next(ctypes.byref(fs), ctypes.byref(d)).contents.name == b"c"
+        assert not libc.fs_dir_next(ctypes.byref(fs), ctypes.byref(d))
+        libc.fs_dir_close(ctypes.byref(d))
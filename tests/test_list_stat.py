@@ -0,0 +1,54 @@
+import ctypes
+from wrappers import *
+
+class Stat(ctypes.Structure):
+    _fields_ = [
+        ("inode", ctypes.c_int32),
+        ("type", ctypes.c_uint32),
+        ("size", ctypes.c_uint64),
+        ("blocks", ctypes.c_uint64),
+        ("name", ctypes.c_char * 32)
+    ]
+
+libc.fs_list_stat.restype = ctypes.c_long
+
+def path(p):
+    return ctypes.c_char_p(bytes(p,"UTF-8"))
+
+def list_stat(fs, p, cap):
+    out = (Stat * max(cap, 1))()
+    count = libc.fs_list_stat(ctypes.byref(fs), path(p), out, ctypes.c_size_t(cap))
+    return count, [(s.inode, s.type, s.size, s.blocks, s.name.decode("utf-8")) for s in out[:min(max(count, 0), cap)]]
+
+class Test_List_Stat:
+    # One call returns type, size and blocks of every child
+    # Expected outcome:
+    #  * records are 56 bytes and sorted by inode-index
+    #  * a file's blocks cover its size, an inline directory has none
+    def test_list_stat(self):
+        assert ctypes.sizeof(Stat) == 56
+        fs = setup(20)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/fil"), path(LONG_DATA))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/nested"))
+        assert list_stat(fs, "/", 10) == (2, [(1, 2, 0, 0, "dir"), (2, 1, len(LONG_DATA), 2, "fil")])
+        assert list_stat(fs, "/dir", 10) == (1, [(3, 1, 0, 0, "nested")])
+
+    # A short array gets the first records, the count tells how many there are
+    def test_list_stat_cap(self):
+        fs = setup(60)
+        for i in range(40):
+            libc.fs_mkfile(ctypes.byref(fs), path("/f%d" % i))
+        count, stats = list_stat(fs, "/", 5)
+        assert count == 40
+        assert [s[4] for s in stats] == ["f%d" % i for i in range(5)]
+        count, stats = list_stat(fs, "/", 40)
+        assert [s[4] for s in stats] == ["f%d" % i for i in range(40)]
+
+    # Only directories can be listed
+    def test_list_stat_invalid(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        assert list_stat(fs, "/fil", 5)[0] == -1
+        assert list_stat(fs, "/nodir", 5)[0] == -1
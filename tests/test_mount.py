@@ -0,0 +1,52 @@
+import ctypes
+from wrappers import *
+
+libc.fs_mount.restype = ctypes.POINTER(FileSystem)
+libc.fs_load.restype = ctypes.POINTER(FileSystem)
+
+MOUNT_TEST_IMAGE = "./mount_test.fs"
+
+class Test_Mount:
+    # Dumps a filesystem with one file, then mounts that image
+    # Expected outcome:
+    #  * the mounted filesystem contains the same inodes and data
+    def test_mount_simple(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")), ctypes.c_char_p(bytes(SHORT_DATA,"UTF-8")))
+        assert libc.fs_dump(ctypes.byref(fs), ctypes.c_char_p(bytes(MOUNT_TEST_IMAGE,"UTF-8"))) == 0
+
+        mounted = libc.fs_mount(ctypes.c_char_p(bytes(MOUNT_TEST_IMAGE,"UTF-8"))).contents
+        assert mounted.s_block.contents.num_blocks == 5
+        # 5 bytes of free list, the regions behind it are padded to their alignment
+        assert ctypes.addressof(mounted.inodes.contents) % ctypes.alignment(Inode) == 0
+        assert ctypes.addressof(mounted.data_blocks.contents) % ctypes.alignment(DataBlock) == 0
+        assert mounted.root_node == 0
+        assert mounted.inodes[1].name.decode("utf-8") == "fil1"
+        assert mounted.inodes[1].size == len(SHORT_DATA)
+        outstring = ctypes.c_char_p(ctypes.addressof(mounted.data_blocks[0].block)).value
+        assert outstring.decode("utf-8") == SHORT_DATA
+        libc.cleanup(ctypes.byref(mounted))
+        delete_temp_file(MOUNT_TEST_IMAGE)
+
+    # Changes on a mounted filesystem end up in the image after a dump
+    def test_mount_dump(self):
+        fs = setup(5)
+        assert libc.fs_dump(ctypes.byref(fs), ctypes.c_char_p(bytes(MOUNT_TEST_IMAGE,"UTF-8"))) == 0
+
+        mounted = libc.fs_mount(ctypes.c_char_p(bytes(MOUNT_TEST_IMAGE,"UTF-8"))).contents
+        assert libc.fs_mkdir(ctypes.byref(mounted), ctypes.c_char_p(bytes("/newDir","UTF-8"))) == 0
+        assert libc.fs_dump(ctypes.byref(mounted), ctypes.c_char_p(bytes(MOUNT_TEST_IMAGE,"UTF-8"))) == 0
+        libc.cleanup(ctypes.byref(mounted))
+
+        loaded = libc.fs_load(ctypes.c_char_p(bytes(MOUNT_TEST_IMAGE,"UTF-8"))).contents
+        assert loaded.inodes[1].name.decode("utf-8") == "newDir"
+        assert loaded.inodes[1].n_type == 2
+        assert loaded.inodes[0].direct_blocks[0] == 1
+        delete_temp_file(MOUNT_TEST_IMAGE)
+
+    # Mounting a file that isn't a valid image fails
+    def test_mount_invalid_image(self):
+        filename = create_temp_file(data=SHORT_DATA)
+        assert not libc.fs_mount(ctypes.c_char_p(bytes(filename,"UTF-8")))
+        delete_temp_file()
@@ -0,0 +1,44 @@
+import ctypes
+from wrappers import *
+
+class PathLookup(ctypes.Structure):
+    _fields_ = [
+        ("parent", ctypes.c_int),
+        ("inode", ctypes.c_int),
+        ("name", ctypes.c_void_p),
+        ("name_len", ctypes.c_size_t)
+    ]
+
+def resolve(fs, p):
+    lookup = PathLookup()
+    raw = bytes(p,"UTF-8")
+    ret = libc.resolve_path(ctypes.byref(fs), ctypes.c_char_p(raw), ctypes.c_size_t(len(raw)), ctypes.byref(lookup))
+    name = ctypes.string_at(lookup.name, lookup.name_len).decode("utf-8") if lookup.name else ""
+    return ret, lookup.parent, lookup.inode, name
+
+class Test_Path:
+    # An existing path yields the leaf, its parent and its name
+    def test_resolve_existing(self):
+        fs = setup(10)
+        set_dir("dir", 1, 0, 0, fs)
+        set_fil("fil", 2, 1, 0, fs)
+        assert resolve(fs, "/dir/fil") == (0, 1, 2, "fil")
+        assert resolve(fs, "/dir/fil") == (0, 1, 2, "fil") # cached
+        assert resolve(fs, "/dir/") == (0, 0, 1, "dir")
+        assert resolve(fs, "/")[:3] == (0, -1, 0)
+
+    # A missing leaf still yields the parent and the name it would get
+    def test_resolve_missing_leaf(self):
+        fs = setup(10)
+        set_dir("dir", 1, 0, 0, fs)
+        assert resolve(fs, "/dir/new") == (-1, 1, -1, "new")
+        assert resolve(fs, "/dir/new") == (-1, 1, -1, "new")
+
+    # A missing directory on the way or a malformed path yields nothing
+    def test_resolve_invalid(self):
+        fs = setup(10)
+        set_dir("dir", 1, 0, 0, fs)
+        assert resolve(fs, "/nodir/new")[1:3] == (-1, -1)
+        assert resolve(fs, "/dir//new")[1:3] == (-1, -1)
+        assert resolve(fs, "dir/new")[1:3] == (-1, -1)
+        assert resolve(fs, "/dir//")[1:3] == (-1, -1)
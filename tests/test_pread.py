@@ -0,0 +1,40 @@
+import ctypes
+from wrappers import *
+
+libc.fs_pread.restype = ctypes.c_long
+libc.fs_pread.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64, ctypes.c_size_t, ctypes.c_void_p]
+
+def pread(fs, p, offset, length):
+    buf = ctypes.create_string_buffer(max(length, 1))
+    ret = libc.fs_pread(ctypes.addressof(fs), bytes(p,"UTF-8"), offset, length, buf)
+    return ret, buf.raw[:max(ret, 0)]
+
+class Test_Pread:
+    # Reads a range in the middle of a file that spans two blocks
+    # Expected outcome:
+    #  * exactly the requested bytes are returned
+    def test_pread_range(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=LONG_DATA[:1024],parent_inode=1,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=1,string_data=LONG_DATA[1024:],parent_inode=1,parent_block_num=1,fs=fs)
+        assert pread(fs, "/fil1", 1000, 100) == (100, bytes(LONG_DATA[1000:1100],"UTF-8"))
+        assert pread(fs, "/fil1", 0, 10) == (10, bytes(LONG_DATA[:10],"UTF-8"))
+
+    # Reading across the end returns what is left, reading behind it returns 0
+    def test_pread_eof(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=SHORT_DATA,parent_inode=1,parent_block_num=0,fs=fs)
+        assert pread(fs, "/fil1", 10, 1000) == (len(SHORT_DATA) - 10, bytes(SHORT_DATA[10:],"UTF-8"))
+        assert pread(fs, "/fil1", len(SHORT_DATA), 10) == (0, b"")
+        assert pread(fs, "/fil1", 5000, 10) == (0, b"")
+
+    # An empty file is no error, a missing file or a directory is
+    def test_pread_empty_and_invalid(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_dir(name="dir",inode=2,parent=0,parent_block=1,fs=fs)
+        assert pread(fs, "/fil1", 0, 10) == (0, b"")
+        assert pread(fs, "/nofil", 0, 10)[0] == -1
+        assert pread(fs, "/dir", 0, 10)[0] == -1
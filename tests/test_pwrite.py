@@ -0,0 +1,78 @@
+import ctypes
+from wrappers import *
+
+libc.fs_pwrite.restype = ctypes.c_long
+libc.fs_pwrite.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64, ctypes.c_char_p, ctypes.c_size_t]
+libc.fs_pread.restype = ctypes.c_long
+libc.fs_pread.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64, ctypes.c_size_t, ctypes.c_void_p]
+
+def pwrite(fs, p, offset, data):
+    return libc.fs_pwrite(ctypes.addressof(fs), bytes(p,"UTF-8"), offset, data, len(data))
+
+def read_all(fs, p):
+    buf = ctypes.create_string_buffer(1 << 16)
+    ret = libc.fs_pread(ctypes.addressof(fs), bytes(p,"UTF-8"), 0, 1 << 16, buf)
+    return buf.raw[:ret]
+
+class Test_Pwrite:
+    # Overwrites bytes in the middle of a file that spans two blocks
+    # Expected outcome:
+    #  * only the written range changes, no block is allocated
+    #  * the size of the file and the blocks stays the same
+    def test_pwrite_overwrite(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=LONG_DATA[:1024],parent_inode=1,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=1,string_data=LONG_DATA[1024:],parent_inode=1,parent_block_num=1,fs=fs)
+        size = fs.inodes[1].size
+        free = fs.s_block.contents.free_blocks
+        assert pwrite(fs, "/fil1", 1000, b"x" * 100) == 100
+        expected = bytes(LONG_DATA[:1000],"UTF-8") + b"x" * 100 + bytes(LONG_DATA[1100:],"UTF-8")
+        assert read_all(fs, "/fil1") == expected
+        assert fs.inodes[1].size == size
+        assert fs.data_blocks[0].size == 1024
+        assert fs.s_block.contents.free_blocks == free
+
+    # Writes across the end of the file, the data may contain zero bytes
+    # Expected outcome:
+    #  * the tail is overwritten and the file grows into a new block
+    def test_pwrite_extend(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=SHORT_DATA,parent_inode=1,parent_block_num=0,fs=fs)
+        data = b"\0ab\0" * 300
+        assert pwrite(fs, "/fil1", 10, data) == len(data)
+        assert fs.inodes[1].size == 10 + len(data)
+        assert fs.inodes[1].direct_blocks[1] != -1
+        assert fs.data_blocks[fs.inodes[1].direct_blocks[1]].size == 10 + len(data) - 1024
+        assert read_all(fs, "/fil1") == bytes(SHORT_DATA[:10],"UTF-8") + data
+
+    # Writing behind the end leaves a gap of zeros
+    def test_pwrite_gap(self):
+        fs = setup(10)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        assert pwrite(fs, "/fil1", 3000, b"end") == 3
+        assert fs.inodes[1].size == 3003
+        assert read_all(fs, "/fil1") == b"\0" * 3000 + b"end"
+
+    # Missing files and directories can't be written, a full fs keeps what fit
+    def test_pwrite_invalid_and_full(self):
+        fs = setup(3)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_dir(name="dir",inode=2,parent=0,parent_block=1,fs=fs)
+        assert pwrite(fs, "/nofil", 0, b"abc") == -1
+        assert pwrite(fs, "/dir", 0, b"abc") == -1
+        assert pwrite(fs, "/fil1", 0, b"a" * 4000) == -2
+        assert fs.inodes[1].size == 3 * BLOCK_SIZE
+
+    # Writing far behind the end of the file needs more blocks for the gap than there are
+    # Expected outcome:
+    #  * -2 without taking a single block, the file is unchanged
+    def test_pwrite_sparse_offset_full(self):
+        fs = setup(10)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        free = fs.s_block.contents.free_blocks
+        assert pwrite(fs, "/fil1", 1 << 40, b"far") == -2
+        assert fs.s_block.contents.free_blocks == free
+        assert fs.inodes[1].size == 0
+        assert fs.inodes[1].direct_blocks[0] == -1
@@ -0,0 +1,132 @@
+import ctypes
+from wrappers import *
+
+enable = libc["fs_threads_enable"]
+enable.argtypes = [ctypes.c_void_p]
+cp = libc["fs_cp"]
+cp.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+
+class Test_Threads:
+    # Every thread creates its own file and writes it chunk by chunk, reading it back after each write
+    # Expected outcome:
+    #  * every file holds exactly what its thread wrote
+    #  * the allocator's count of free blocks matches the free list
+    def test_threads_write_own_files(self):
+        fs = setup(600)
+        assert enable(ctypes.addressof(fs)) == 0
+        def work(t):
+            p = "/file%d" % t
+            assert mkfile(ctypes.addressof(fs), bytes(p,"UTF-8")) == 0
+            expected = b""
+            for i in range(40):
+                chunk = bytes([65 + t]) * (100 + i * 37)
+                assert pwrite(ctypes.addressof(fs), bytes(p,"UTF-8"), len(expected), chunk, len(chunk)) == len(chunk)
+                expected += chunk
+                assert read_all(fs, p) == expected
+        run_threads(work)
+        assert listing(fs, "/") == sorted("FIL file%d" % t for t in range(THREADS))
+        for t in range(THREADS):
+            assert read_all(fs, "/file%d" % t)[-1:] == bytes([65 + t])
+        check_free_blocks(fs)
+
+    # All threads try to create the same names in the same directory
+    # Expected outcome:
+    #  * every name is created exactly once, the other threads get -2
+    def test_threads_create_same_names(self):
+        fs = setup(200)
+        assert enable(ctypes.addressof(fs)) == 0
+        assert mkdir(ctypes.addressof(fs), b"/dir") == 0
+        results = [[] for t in range(THREADS)]
+        def work(t):
+            for i in range(40):
+                results[t].append(mkfile(ctypes.addressof(fs), bytes("/dir/f%d" % i,"UTF-8")))
+        run_threads(work)
+        for i in range(40):
+            outcomes = sorted(results[t][i] for t in range(THREADS))
+            assert outcomes == [-2] * (THREADS - 1) + [0]
+        assert listing(fs, "/dir") == sorted("FIL f%d" % i for i in range(40))
+
+    # Half of the threads create and remove directories while the others read a file
+    # Expected outcome:
+    #  * the readers always see the whole file
+    #  * only the file is left and no block or inode is lost
+    def test_threads_rm_while_reading(self):
+        fs = setup(300)
+        assert enable(ctypes.addressof(fs)) == 0
+        assert mkfile(ctypes.addressof(fs), b"/shared") == 0
+        content = bytes(LONG_DATA * 3,"UTF-8")
+        assert pwrite(ctypes.addressof(fs), b"/shared", 0, content, len(content)) == len(content)
+        free_before = fs.s_block.contents.free_blocks
+        def work(t):
+            for i in range(30):
+                if t % 2 == 0:
+                    assert read_all(fs, "/shared") == content
+                else:
+                    d = bytes("/d%d" % t,"UTF-8")
+                    assert mkdir(ctypes.addressof(fs), d) == 0
+                    assert mkfile(ctypes.addressof(fs), d + b"/f") == 0
+                    assert pwrite(ctypes.addressof(fs), d + b"/f", 0, content, len(content)) == len(content)
+                    assert rm(ctypes.addressof(fs), d) == 0
+        run_threads(work)
+        assert listing(fs, "/") == ["FIL shared"]
+        assert fs.s_block.contents.free_blocks == free_before
+        check_free_blocks(fs)
+
+    # Half of the threads copy a directory while the others overwrite the files in it
+    # Expected outcome:
+    #  * every copy of a file holds one whole version of it
+    #  * of the threads copying to the same name exactly one succeeds, the others get -2
+    def test_threads_cp_while_writing(self):
+        fs = setup(600)
+        assert enable(ctypes.addressof(fs)) == 0
+        assert mkdir(ctypes.addressof(fs), b"/src") == 0
+        size = 3 * BLOCK_SIZE
+        for f in range(4):
+            p = bytes("/src/f%d" % f,"UTF-8")
+            assert mkfile(ctypes.addressof(fs), p) == 0
+            assert pwrite(ctypes.addressof(fs), p, 0, b"a" * size, size) == size
+        results = [[] for t in range(THREADS)]
+        def work(t):
+            for i in range(10):
+                if t % 2 == 0:
+                    results[t].append(cp(ctypes.addressof(fs), b"/src", bytes("/copy%d" % i,"UTF-8")))
+                else:
+                    p = bytes("/src/f%d" % (i % 4),"UTF-8")
+                    content = bytes([97 + (t + i) % 26]) * size
+                    assert pwrite(ctypes.addressof(fs), p, 0, content, size) == size
+        run_threads(work)
+        for i in range(10):
+            outcomes = sorted(results[t][i] for t in range(0, THREADS, 2))
+            assert outcomes == [-2] * (THREADS // 2 - 1) + [0]
+            for f in range(4):
+                content = read_all(fs, "/copy%d/f%d" % (i, f))
+                assert len(content) == size and content == content[:1] * size
+        check_free_blocks(fs)
+
+    # Writers and rm run while another thread holds a view of the file
+    # Expected outcome:
+    #  * nobody waits for the view, it keeps showing the old content
+    #  * the file holds what the writers wrote, after the rm and the release no block is lost
+    def test_threads_view_and_writers(self):
+        fs = setup(200)
+        assert enable(ctypes.addressof(fs)) == 0
+        free_before = fs.s_block.contents.free_blocks
+        assert mkfile(ctypes.addressof(fs), b"/shared") == 0
+        content = bytes(LONG_DATA * 2,"UTF-8")
+        assert pwrite(ctypes.addressof(fs), b"/shared", 0, content, len(content)) == len(content)
+
+        view = ReadView()
+        assert read_view(ctypes.addressof(fs), b"/shared", 0, len(content), ctypes.byref(view)) == 0
+        def work(t):
+            changed = bytes([65 + t]) * len(content)
+            assert pwrite(ctypes.addressof(fs), b"/shared", 0, changed, len(changed)) == len(changed)
+            got = read_all(fs, "/shared")
+            assert len(got) == len(content) and got == got[:1] * len(content)
+        run_threads(work)
+        assert b"".join(ctypes.string_at(view.spans[i].base, view.spans[i].len) for i in range(view.count)) == content
+
+        assert rm(ctypes.addressof(fs), b"/shared") == 0
+        assert b"".join(ctypes.string_at(view.spans[i].base, view.spans[i].len) for i in range(view.count)) == content
+        release_view(ctypes.byref(view))
+        assert fs.s_block.contents.free_blocks == free_before
+        check_free_blocks(fs)
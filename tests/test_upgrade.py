@@ -0,0 +1,78 @@
+import ctypes
+import struct
+from wrappers import *
+
+libc.fs_mount.restype = ctypes.POINTER(FileSystem)
+libc.fs_load.restype = ctypes.POINTER(FileSystem)
+
+UPGRADE_TEST_IMAGE = "./upgrade_test.fs"
+
+# superblock, inode and data block of the first layout
+LEGACY_INODE = struct.Struct("<iH32s2x12ii")
+LEGACY_DATA_BLOCK = struct.Struct("<Q1024s")
+
+def legacy_image(path):
+    # root with the directory "dir", holding the file "fil" with SHORT_DATA in data block 0
+    num_blocks = 4
+    data = bytes(SHORT_DATA, "UTF-8")
+    unused = [-1] * 12
+    inodes = [
+        (2, 0, b"/", [1] + unused[1:], -1),
+        (2, 0, b"dir", [2] + unused[1:], 0),
+        (1, len(data), b"fil", [0] + unused[1:], 1),
+        (3, 0, b"", unused, -1),
+    ]
+    image = struct.pack("<II", num_blocks, 3)
+    image += bytes([0, 1, 1, 1])
+    for n_type, size, name, blocks, parent in inodes:
+        image += LEGACY_INODE.pack(n_type, size, name, *blocks, parent)
+    image += LEGACY_DATA_BLOCK.pack(len(data), data)
+    image += LEGACY_DATA_BLOCK.pack(0, b"") * (num_blocks - 1)
+    with open(path, "wb") as f:
+        f.write(image)
+
+class Test_Upgrade:
+    # An image of the first layout is refused until fs_upgrade converts it
+    # Expected outcome:
+    #  * fs_load and fs_mount return NULL for the old image
+    #  * after the upgrade both accept it and see the same tree and data
+    def test_upgrade_legacy(self):
+        legacy_image(UPGRADE_TEST_IMAGE)
+        path = ctypes.c_char_p(bytes(UPGRADE_TEST_IMAGE, "UTF-8"))
+        assert not libc.fs_load(path)
+        assert not libc.fs_mount(path)
+
+        assert libc.fs_upgrade(path) == 0
+        fs = libc.fs_load(path).contents
+        assert fs.s_block.contents.magic == 0x32534648
+        assert fs.s_block.contents.free_blocks == 3
+        assert listing(fs, "/") == ["DIR dir"]
+        assert listing(fs, "/dir") == ["FIL fil"]
+        assert read_all(fs, "/dir/fil") == bytes(SHORT_DATA, "UTF-8")
+        libc.cleanup(ctypes.byref(fs))
+
+        mounted = libc.fs_mount(path).contents
+        assert read_all(mounted, "/dir/fil") == bytes(SHORT_DATA, "UTF-8")
+        libc.cleanup(ctypes.byref(mounted))
+
+        # a current image is left alone
+        assert libc.fs_upgrade(path) == 0
+        delete_temp_file(UPGRADE_TEST_IMAGE)
+
+    # Images of another version or without the magic are refused
+    def test_upgrade_unknown(self):
+        fs = setup(5)
+        assert libc.fs_dump(ctypes.byref(fs), ctypes.c_char_p(bytes(UPGRADE_TEST_IMAGE, "UTF-8"))) == 0
+        path = ctypes.c_char_p(bytes(UPGRADE_TEST_IMAGE, "UTF-8"))
+        with open(UPGRADE_TEST_IMAGE, "r+b") as f:
+            f.seek(12)
+            f.write(struct.pack("<I", 3))
+        assert not libc.fs_load(path)
+        assert not libc.fs_mount(path)
+        assert libc.fs_upgrade(path) == -1
+
+        with open(UPGRADE_TEST_IMAGE, "wb") as f:
+            f.write(b"not an image")
+        assert not libc.fs_load(path)
+        assert libc.fs_upgrade(path) == -1
+        delete_temp_file(UPGRADE_TEST_IMAGE)
@@ -0,0 +1,59 @@
+import ctypes
+from wrappers import *
+
+def view(fs, p, offset, length):
+    v = ReadView()
+    ret = read_view(ctypes.addressof(fs), bytes(p,"UTF-8"), offset, length, ctypes.byref(v))
+    spans = [(v.spans[i].base, v.spans[i].len) for i in range(v.count)]
+    data = b"".join(ctypes.string_at(base, n) for base, n in spans)
+    release_view(ctypes.byref(v))
+    return ret, spans, data
+
+class Test_View:
+    # A view over two blocks has one span per block, pointing into the data blocks
+    # Expected outcome:
+    #  * the first span starts at the offset inside the first block
+    #  * the spans hold exactly the requested bytes
+    def test_view_spans(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=LONG_DATA[:1024],parent_inode=1,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=1,string_data=LONG_DATA[1024:],parent_inode=1,parent_block_num=1,fs=fs)
+        ret, spans, data = view(fs, "/fil1", 1000, 100)
+        assert ret == 0
+        assert spans == [(ctypes.addressof(fs.data_blocks[0].block) + 1000, 24), (ctypes.addressof(fs.data_blocks[1].block), 76)]
+        assert data == bytes(LONG_DATA[1000:1100],"UTF-8")
+
+    # Views end at the end of the file, missing files and directories have none
+    def test_view_eof_and_invalid(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_dir(name="dir",inode=2,parent=0,parent_block=1,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=SHORT_DATA,parent_inode=1,parent_block_num=0,fs=fs)
+        assert view(fs, "/fil1", 10, 1000)[2] == bytes(SHORT_DATA[10:],"UTF-8")
+        assert view(fs, "/fil1", 1000, 10) == (0, [], b"")
+        assert view(fs, "/nofil", 0, 10)[0] == -1
+        assert view(fs, "/dir", 0, 10)[0] == -1
+
+    # The file is overwritten and removed while a view of it is held by the same thread
+    # Expected outcome:
+    #  * the view keeps showing the old content, the file gets the new one
+    #  * the blocks only the view still uses go back when it is released
+    def test_view_outlives_changes(self):
+        fs = setup(20)
+        free_before = fs.s_block.contents.free_blocks
+        assert mkfile(ctypes.addressof(fs), b"/fil1") == 0
+        content = bytes(LONG_DATA,"UTF-8")
+        assert pwrite(ctypes.addressof(fs), b"/fil1", 0, content, len(content)) == len(content)
+
+        v = ReadView()
+        assert read_view(ctypes.addressof(fs), b"/fil1", 0, len(content), ctypes.byref(v)) == 0
+        changed = b"x" * len(content)
+        assert pwrite(ctypes.addressof(fs), b"/fil1", 0, changed, len(changed)) == len(changed)
+        assert read_all(fs, "/fil1") == changed
+        assert rm(ctypes.addressof(fs), b"/fil1") == 0
+        assert b"".join(ctypes.string_at(v.spans[i].base, v.spans[i].len) for i in range(v.count)) == content
+        assert fs.s_block.contents.free_blocks == free_before - 2
+        release_view(ctypes.byref(v))
+        assert fs.s_block.contents.free_blocks == free_before
+        check_free_blocks(fs)
@@ -0,0 +1,73 @@
+import ctypes
+from wrappers import *
+
+WALK_FN = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_int, ctypes.c_void_p)
+CONTINUE, PRUNE, STOP = 0, 1, 2
+PRE, POST = 0, 1
+
+def max_depth(n):
+    return (n + 1) << 8
+
+def path(p):
+    return ctypes.c_char_p(bytes(p,"UTF-8"))
+
+def walk(fs, root, flags, action=lambda p, d: CONTINUE):
+    visited = []
+    def visit(fs_ptr, inode_num, p, depth, ctx):
+        visited.append((p.decode("utf-8"), depth))
+        return action(p.decode("utf-8"), depth)
+    ret = libc.fs_walk(ctypes.byref(fs), path(root), flags, WALK_FN(visit), None)
+    return ret, visited
+
+def build_tree(fs):
+    for p in ["/a", "/a/b", "/a/b/c"]:
+        libc.fs_mkdir(ctypes.byref(fs), path(p))
+    for p in ["/a/f1", "/a/b/f2", "/a/b/c/f3", "/g"]:
+        libc.fs_mkfile(ctypes.byref(fs), path(p))
+
+class Test_Walk:
+    # Pre-order visits every node once, parents before children, with full paths
+    def test_walk_pre(self):
+        fs = setup(20)
+        build_tree(fs)
+        assert walk(fs, "/", PRE) == (0, [("/", 0), ("/a", 1), ("/a/b", 2), ("/a/b/c", 3), ("/a/b/c/f3", 4),
+                                          ("/a/b/f2", 3), ("/a/f1", 2), ("/g", 1)])
+
+    # Post-order visits the children first, the walk can start anywhere
+    def test_walk_post(self):
+        fs = setup(20)
+        build_tree(fs)
+        assert walk(fs, "/a/b", POST) == (0, [("/a/b/c/f3", 2), ("/a/b/c", 1), ("/a/b/f2", 1), ("/a/b", 0)])
+
+    # Pruned directories and nodes below the max depth are not entered
+    def test_walk_prune_and_depth(self):
+        fs = setup(20)
+        build_tree(fs)
+        ret, visited = walk(fs, "/", PRE, lambda p, d: PRUNE if p == "/a/b" else CONTINUE)
+        assert [p for p, d in visited] == ["/", "/a", "/a/b", "/a/f1", "/g"]
+        ret, visited = walk(fs, "/", PRE | max_depth(1))
+        assert [p for p, d in visited] == ["/", "/a", "/g"]
+        ret, visited = walk(fs, "/a", POST | max_depth(0))
+        assert visited == [("/a", 0)]
+
+    # The callback can stop the walk, missing roots are an error
+    def test_walk_stop_and_invalid(self):
+        fs = setup(20)
+        build_tree(fs)
+        ret, visited = walk(fs, "/", PRE, lambda p, d: STOP if p == "/a/b" else CONTINUE)
+        assert ret == 1
+        assert visited[-1] == ("/a/b", 2)
+        assert walk(fs, "/nothing", PRE)[0] == -1
+
+    # Paths longer than any fixed buffer are built, a post-order walk can remove what it visits
+    def test_walk_deep_remove(self):
+        fs = setup(100)
+        deep = "".join("/dir%06d" % i for i in range(50))
+        for i in range(1, 51):
+            libc.fs_mkdir(ctypes.byref(fs), path(deep[:i * 10]))
+        ret, visited = walk(fs, "/", PRE)
+        assert visited[-1] == (deep, 50)
+        ret, visited = walk(fs, "/dir000000", POST, lambda p, d: libc.fs_rm(ctypes.byref(fs), path(p)) and STOP)
+        assert ret == 0
+        assert len(visited) == 50
+        assert libc.traverse_path(ctypes.byref(fs), path("/dir000000"), 10) == -1
@@ -0,0 +1,58 @@
+import ctypes
+from wrappers import *
+
+class Iovec(ctypes.Structure):
+    _fields_ = [
+        ("base", ctypes.c_char_p),
+        ("len", ctypes.c_size_t)
+    ]
+
+libc.fs_writev.restype = ctypes.c_long
+libc.fs_writev.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(Iovec), ctypes.c_int]
+libc.fs_pread.restype = ctypes.c_long
+libc.fs_pread.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64, ctypes.c_size_t, ctypes.c_void_p]
+
+def writev(fs, p, buffers):
+    iov = (Iovec * max(len(buffers), 1))(*[Iovec(b, len(b)) for b in buffers])
+    return libc.fs_writev(ctypes.addressof(fs), bytes(p,"UTF-8"), iov, len(buffers))
+
+def read_all(fs, p):
+    buf = ctypes.create_string_buffer(1 << 16)
+    ret = libc.fs_pread(ctypes.addressof(fs), bytes(p,"UTF-8"), 0, 1 << 16, buf)
+    return buf.raw[:ret]
+
+class Test_Writev:
+    # Appends many small buffers behind a partly filled block
+    # Expected outcome:
+    #  * the buffers end up in order behind the old content
+    #  * the last block is filled up before new blocks are taken, in order
+    def test_writev_append(self):
+        fs = setup(10)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=SHORT_DATA,parent_inode=1,parent_block_num=0,fs=fs)
+        records = [bytes("record %d;" % i,"UTF-8") for i in range(300)]
+        total = sum(len(r) for r in records)
+        assert writev(fs, "/fil1", records) == total
+        assert fs.inodes[1].size == len(SHORT_DATA) + total
+        assert read_all(fs, "/fil1") == bytes(SHORT_DATA,"UTF-8") + b"".join(records)
+        assert fs.data_blocks[0].size == BLOCK_SIZE
+        assert [fs.inodes[1].direct_blocks[i] for i in range(4)] == [0, 1, 2, 3]
+
+    # Empty buffers and binary data are appended as they are
+    def test_writev_empty_and_binary(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        assert writev(fs, "/fil1", []) == 0
+        assert writev(fs, "/fil1", [b"", b"\0a\0", b""]) == 3
+        assert read_all(fs, "/fil1") == b"\0a\0"
+
+    # Missing files and directories can't be written, a full fs keeps what fit
+    def test_writev_invalid_and_full(self):
+        fs = setup(3)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_dir(name="dir",inode=2,parent=0,parent_block=1,fs=fs)
+        assert writev(fs, "/nofil", [b"abc"]) == -1
+        assert writev(fs, "/dir", [b"abc"]) == -1
+        assert writev(fs, "/fil1", [b"a" * 2000, b"b" * 2000]) == -2
+        assert fs.inodes[1].size == 3 * BLOCK_SIZE
+        assert read_all(fs, "/fil1") == b"a" * 2000 + b"b" * (3 * BLOCK_SIZE - 2000)
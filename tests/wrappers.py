@@ -1,6 +1,7 @@
 import enum
 import ctypes
 import os
+import threading
 libc = ctypes.CDLL("./build/operations.so")
 
 BLOCK_SIZE = 1024
@@ -30,9 +31,10 @@ class DataBlock(ctypes.Structure):
 class Inode(ctypes.Structure):
     _fields_ = [
         ("n_type", ctypes.c_int),
-        ("size", ctypes.c_uint16),
+        ("size", ctypes.c_uint64),
         ("name", ctypes.c_char * NAME_MAX_LENGTH),
         ("direct_blocks", ctypes.c_int * DIRECT_BLOCKS_COUNT),
+        ("indirect_block", ctypes.c_int),
         ("parent", ctypes.c_int)
     ]
 
@@ -40,7 +42,9 @@ class Inode(ctypes.Structure):
 class Superblock(ctypes.Structure):
     _fields_ = [
         ("num_blocks", ctypes.c_uint32),
-        ("free_blocks", ctypes.c_uint32)
+        ("free_blocks", ctypes.c_uint32),
+        ("magic", ctypes.c_uint32),
+        ("version", ctypes.c_uint32)
     ]
 
 # Define the file_system structure
@@ -50,10 +54,106 @@ class FileSystem(ctypes.Structure):
         ("free_list", ctypes.POINTER(ctypes.c_uint8)),
         ("inodes", ctypes.POINTER(Inode)),
         ("data_blocks", ctypes.POINTER(DataBlock)),
-        ("root_node", ctypes.c_int)
+        ("root_node", ctypes.c_int),
+        ("mapping", ctypes.c_void_p),
+        ("mapping_size", ctypes.c_size_t),
+        ("image_fd", ctypes.c_int),
+        ("block_bitmap", ctypes.POINTER(ctypes.c_uint64)),
+        ("alloc_cursor", ctypes.c_uint32),
+        ("free_inodes", ctypes.POINTER(ctypes.c_int)),
+        ("free_inodes_count", ctypes.c_uint32),
+        ("alloc_hints", ctypes.c_void_p),
+        ("alloc_hints_count", ctypes.c_uint32),
+        ("dirty_pages", ctypes.POINTER(ctypes.c_uint64)),
+        ("journal", ctypes.c_void_p),
+        ("dcache", ctypes.c_void_p),
+        ("locks", ctypes.c_void_p)
     ]
 
 
+# Handles with their own argtypes, so tests that set argtypes on libc.fs_* don't change them.
+# They take ctypes.addressof(fs)
+mkfile = libc["fs_mkfile"]
+mkfile.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+mkdir = libc["fs_mkdir"]
+mkdir.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+rm = libc["fs_rm"]
+rm.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+pwrite = libc["fs_pwrite"]
+pwrite.restype = ctypes.c_long
+pwrite.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64, ctypes.c_char_p, ctypes.c_size_t]
+pread = libc["fs_pread"]
+pread.restype = ctypes.c_long
+pread.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64, ctypes.c_size_t, ctypes.c_void_p]
+list_dir = libc["fs_list"]
+list_dir.restype = ctypes.c_void_p
+list_dir.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+import_tree = libc["fs_import_tree"]
+import_tree.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int]
+free = libc["free"]
+free.argtypes = [ctypes.c_void_p]
+
+# Define the read_view structure
+class Iovec(ctypes.Structure):
+    _fields_ = [("base", ctypes.c_void_p), ("len", ctypes.c_size_t)]
+
+class ReadView(ctypes.Structure):
+    _fields_ = [
+        ("spans", ctypes.POINTER(Iovec)),
+        ("count", ctypes.c_int),
+        ("len", ctypes.c_size_t),
+        ("fs", ctypes.c_void_p),
+        ("blocks", ctypes.POINTER(ctypes.c_int))
+    ]
+
+read_view = libc["fs_read_view"]
+read_view.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64, ctypes.c_size_t, ctypes.POINTER(ReadView)]
+release_view = libc["fs_release_view"]
+release_view.argtypes = [ctypes.POINTER(ReadView)]
+
+THREADS = 8
+
+# runs target(t) for t in range(THREADS) at once and fails if one of them failed
+# ctypes drops the GIL during the calls, so the threads really run inside the fs at once
+def run_threads(target):
+    errors = []
+    def guarded(t):
+        try:
+            target(t)
+        except Exception as e:
+            errors.append(e)
+    threads = [threading.Thread(target=guarded, args=(t,)) for t in range(THREADS)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    assert errors == []
+
+# the first 64 KiB of a file, None if it can't be read
+def read_all(fs, p):
+    buf = ctypes.create_string_buffer(1 << 16)
+    ret = pread(ctypes.addressof(fs), bytes(p,"UTF-8"), 0, 1 << 16, buf)
+    return buf.raw[:ret] if ret >= 0 else None
+
+# the sorted lines of fs_list
+def listing(fs, p):
+    ptr = list_dir(ctypes.addressof(fs), bytes(p,"UTF-8"))
+    if ptr is None:
+        return []
+    result = ctypes.string_at(ptr).decode()
+    free(ptr)
+    return sorted(result.splitlines())
+
+# the allocator's count of free blocks and its bitmap, if it has one, agree with the free list
+def check_free_blocks(fs):
+    num_blocks = fs.s_block.contents.num_blocks
+    free_count = sum(1 for i in range(num_blocks) if fs.free_list[i] == 1)
+    assert fs.s_block.contents.free_blocks == free_count
+    if fs.block_bitmap:
+        for i in range(num_blocks):
+            assert (fs.block_bitmap[i // 64] >> (i % 64)) & 1 == (fs.free_list[i] == 1)
+
+
 # creates a new filesystem using the C-Function
 def setup(fs_size):
     fsize= ctypes.c_int();